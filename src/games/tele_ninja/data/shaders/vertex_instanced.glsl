@@ -0,0 +1,34 @@
+//#version 120
+
+uniform mat4 projection;
+uniform mat4 cam;
+uniform vec2 tex_size;
+
+// Unit quad corner, (0, 0) is bottom left and (1, 1) is top right.
+attribute vec2 corner;
+
+// Per instance attributes.
+attribute vec4 position; // x, y, x anchor, y anchor
+attribute vec2 scale_rotation; // scale, rotation in degrees anticlockwise
+attribute vec4 tex_rect; // x, y, w, h in texels. Negative w flips.
+
+varying vec2 frag_tex_coord;
+
+void main()
+{
+        vec2 size = vec2(abs(tex_rect.z), tex_rect.w) * scale_rotation.x;
+        vec2 pos = position.xy + corner * size;
+
+        float angle = radians(scale_rotation.y);
+        float s = sin(angle);
+        float c = cos(angle);
+        vec2 offset = pos - position.zw;
+        pos = position.zw + vec2(offset.x * c - offset.y * s,
+                                 offset.x * s + offset.y * c);
+
+        gl_Position = cam * projection * vec4(pos, 0.0, 1.0);
+
+        // Texture rows run top down so flip the corner's y.
+        vec2 texel = tex_rect.xy + vec2(corner.x, 1.0 - corner.y) * tex_rect.zw;
+        frag_tex_coord = texel / tex_size;
+}
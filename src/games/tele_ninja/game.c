@@ -10,7 +10,9 @@
 #include <seed/assets.h>
 #include <seed/atlas.h>
 #include <seed/camera.h>
+#include <seed/jobs.h>
 #include <seed/log.h>
+#include <seed/rect.h>
 #include <seed/render.h>
 #include <seed/sprite.h>
 #include <seed/stretchy_buffer.h>
@@ -29,6 +31,8 @@ static sprite s_cowboy_sprite;
 
 static sprite s_jurassic_background_sprite;
 static renderer* s_renderer;
+static uint32_t s_virtual_width;
+static uint32_t s_virtual_height;
 
 bool game_init(GLFWwindow* window,
                uint32_t virtual_width, uint32_t virtual_height)
@@ -38,27 +42,41 @@ bool game_init(GLFWwindow* window,
         // Todo: Load shaders path from config file.
         s_renderer = render_create(window,
                                    virtual_width, virtual_height,
+                                   render_mode_instanced, 3,
                                    "data/shaders/vertex.glsl",
+                                   "data/shaders/vertex_instanced.glsl",
                                    "data/shaders/fragment.glsl");
         if (!s_renderer) {
                 LOGERR("%s", "Failed to initialize renderer");
                 return false;
         }
 
-        assets_init();
+        s_virtual_width = virtual_width;
+        s_virtual_height = virtual_height;
+
+        if (!assets_init()) {
+                LOGERR("%s", "Failed to initialize assets");
+                return false;
+        }
         Fps_init();
 
+        // Work is spread across the cores by the job system. Without it
+        // jobs just run on the thread that starts them.
+        if (!jobs_init(0)) {
+                LOGWARN("%s", "Failed to start job system");
+        }
 
+        // Textures are decoded in the background while the rest of the
+        // level loads.
         s_jurassic_background_sprite.scale = 1.0f;
         s_jurassic_background_sprite.depth = CHAR_MAX;
-        s_jurassic_background_sprite.tex = assets_get_texture("data/maps/jurassic/background.png");
-        s_jurassic_background_sprite.tex = assets_get_texture("data/maps/jurassic/background.png");
+        s_jurassic_background_sprite.tex = assets_get_texture_async("data/maps/jurassic/background.png");
 
         s_cowboy_sprite.scale = 0.15f;
         s_cowboy_sprite.depth = 1;
         s_cowboy_sprite.x_pos = 100;
         s_cowboy_sprite.y_pos = 95;
-        s_cowboy_sprite.tex = assets_get_texture("data/characters/cowboy/cowboy.png");
+        s_cowboy_sprite.tex = assets_get_texture_async("data/characters/cowboy/cowboy.png");
         //atlas_init(&s_atlas, &s_player_texture, "data/anims/walk_cycle.txt");
         //atlas_sprite_name(&s_atlas, &s_player_sprite1, "walk_cycle_1.png", 50, 50, 0, 0, 1.0f, 0);
         //atlas_sprite_name(&s_atlas, &s_player_sprite2, "walk_cycle_0.png", 250, 100, 0, 0, 1.0f, 0);
@@ -66,10 +84,25 @@ bool game_init(GLFWwindow* window,
         //s_player_sprite2.depth = 10;
 
         
+        // Compiled from jurassic_atlas.txt with --compile-atlas.
         atlas_init(&s_dirt_atlas, 
-                   assets_get_texture("data/maps/jurassic/jurassic_atlas.png"), 
-                   "data/maps/jurassic/jurassic_atlas.txt");
-        tilemap_init(&s_tile_map, &s_dirt_atlas, "data/maps/jurassic/jurassic_map.json");
+                   assets_get_texture_async("data/maps/jurassic/jurassic_atlas.png"), 
+                   "data/maps/jurassic/jurassic_atlas.satl");
+        // Compiled from jurassic_map.json with --compile-map.
+        tilemap_init(&s_tile_map, &s_dirt_atlas, "data/maps/jurassic/jurassic_map.smap");
+
+        // Pack the loose textures together so they don't each need a
+        // draw call. This waits for them to finish loading.
+        if (!assets_pack_textures(1024, s_renderer)) {
+                LOGWARN("%s", "Failed to pack textures into atlas pages");
+        }
+
+        // The tiles never change so upload them once and draw them
+        // straight from the GPU each frame.
+        if (!tilemap_create_batches(&s_tile_map, s_renderer)) {
+                LOGERR("%s", "Failed to create tile map batches");
+                return false;
+        }
 
         return true;
 }
@@ -80,15 +113,20 @@ void game_update(double dt)
 
         render_add_sprite(s_renderer, &s_jurassic_background_sprite);
         render_add_sprite(s_renderer, &s_cowboy_sprite);
-        render_add_sprites(s_renderer, s_tile_map.sprite_sb, sb_count(s_tile_map.sprite_sb));
+        rect view;
+        cam_view_rect((float)s_virtual_width, (float)s_virtual_height, &view);
+        tilemap_draw(&s_tile_map, s_renderer, &view);
 
         render_submit(s_renderer);
 }
 
 void game_cleanup(void)
 {
-        assets_reset(s_renderer);
+        tilemap_free_batches(&s_tile_map, s_renderer);
+        tilemap_reset(&s_tile_map);
+        assets_free(s_renderer);
         render_free(s_renderer);
+        jobs_free();
 }
 
 void game_mouse_moved(double x_pos, double y_pos)
@@ -1,15 +1,16 @@
 #include <inttypes.h>
 #include <stdio.h>
-
-#include <Windows.h>
+#include <string.h>
 
 #include <glew/glew.h>
 #include <glfw/glfw3.h>
 
+#include <seed/atlas.h>
 #include <seed/log.h>
 #include <seed/thread.h>
 
 #include "game.h"
+#include "tilemap.h"
 
 static void errorCallback(int error, const char* description)
 {
@@ -55,6 +56,17 @@ int32_t main(int32_t argc, char* args[])
 {
         uint32_t return_code = 1;
         log_init("pong.log", 4);
+
+        // Offline map compilation: --compile-map <map json> <output file>
+        if (argc == 4 && strcmp(args[1], "--compile-map") == 0) {
+                return tilemap_compile(args[2], args[3]) ? 0 : 1;
+        }
+
+        // Offline atlas compilation: --compile-atlas <atlas txt> <output file>
+        if (argc == 4 && strcmp(args[1], "--compile-atlas") == 0) {
+                return atlas_compile(args[2], args[3]) ? 0 : 1;
+        }
+
         LOGDBG("%s", "Game starting");
 
         glfwSetErrorCallback(errorCallback);
@@ -102,7 +114,7 @@ int32_t main(int32_t argc, char* args[])
 
                 double frame_time = (glfwGetTime() * 1000) - start_time;
                 if (frame_time < EXPECTED_FRAME_TIME) {
-                        Sleep((DWORD)(EXPECTED_FRAME_TIME - frame_time));
+                        thread_sleep((uint32_t)(EXPECTED_FRAME_TIME - frame_time));
                 }
 
                 double total_time = (glfwGetTime() * 1000) - start_time;
@@ -4,13 +4,45 @@
 #include <stdio.h>
 
 #include <seed/atlas.h>
+#include <seed/json_reader.h>
 #include <seed/log.h>
-#include <seed/parson.h>
+#include <seed/mapped_file.h>
+#include <seed/render.h>
 #include <seed/sprite.h>
 #include <seed/stretchy_buffer.h>
 
+// Compiled maps start with a map_header followed by a map_layer for
+// each layer. The packed tiles for each layer are at tiles_offset from
+// the start of the file. All values are little endian.
+#define MAP_MAGIC 0x50414d53 // "SMAP"
+#define MAP_VERSION 1
+
+typedef struct map_header {
+        uint32_t magic;
+        uint32_t version;
+        int32_t tiles_wide;
+        int32_t tiles_high;
+        int32_t tile_width;
+        int32_t tile_height;
+        int32_t layer_count;
+        uint32_t reserved;
+} map_header;
+
+typedef struct map_layer {
+        int32_t index;
+        uint32_t tiles_offset;
+        char name[LAYER_NAME_MAX_LEN];
+} map_layer;
+
+bool load_compiled_map(tilemap* tm, mapped_file* f, const char* map_file);
 bool parse_map_file(tilemap* tm, const char* map_file);
+bool read_map_size(tilemap* tm, json_reader* jr);
+bool read_layers(tilemap* tm, json_reader* jr, const char* map_file);
+bool read_layer(tilemap* tm, json_reader* jr, const char* map_file);
+bool read_tile(tilemap* tm, json_reader* jr, uint16_t* tiles, const char* map_file);
+bool write_compiled_map(tilemap* tm, const char* out_file);
 void update_sprites(tilemap* tm);
+void update_sprite(tilemap* tm, layer* l, int32_t row, int32_t col);
 
 bool tilemap_init(tilemap* tm, atlas* atlas, const char* map_file)
 {
@@ -18,8 +50,25 @@ bool tilemap_init(tilemap* tm, atlas* atlas, const char* map_file)
 
         memset(tm, 0, sizeof(*tm));
         tm->atlas = atlas;
-        if (!parse_map_file(tm, map_file)) {
-                return false;
+
+        // Use compiled maps in place if the file is one.
+        mapped_file* f = mapped_file_open(map_file);
+        if (f && mapped_file_size(f) >= sizeof(map_header) &&
+            ((const map_header*)mapped_file_data(f))->magic == MAP_MAGIC) {
+                if (!load_compiled_map(tm, f, map_file)) {
+                        mapped_file_close(f);
+                        tilemap_reset(tm);
+                        return false;
+                }
+                tm->map_file = f;
+        } else {
+                if (f) {
+                        mapped_file_close(f);
+                }
+                if (!parse_map_file(tm, map_file)) {
+                        tilemap_reset(tm);
+                        return false;
+                }
         }
 
         update_sprites(tm);
@@ -31,77 +80,450 @@ void tilemap_reset(tilemap* tm)
 {
         assert(tm);
 
+        for (int32_t i = 0; i < sb_count(tm->layer_sb); ++i) {
+                sb_free(tm->layer_sb[i].tile_sb);
+        }
         sb_free(tm->layer_sb);
         sb_free(tm->sprite_sb);
+        sb_free(tm->chunk_sb);
+        if (tm->map_file) {
+                mapped_file_close(tm->map_file);
+        }
         memset(tm, 0, sizeof(*tm));
 }
 
-bool parse_map_file(tilemap* tm, const char* map_file)
+bool tilemap_compile(const char* map_file, const char* out_file)
 {
-        JSON_Value* root = json_parse_file(map_file);
-        if (!root) {
-                LOGERR("Failed to parse json from map file %s", map_file);
+        tilemap tm;
+        memset(&tm, 0, sizeof(tm));
+        if (!parse_map_file(&tm, map_file)) {
+                tilemap_reset(&tm);
                 return false;
         }
-        JSON_Object* root_obj = json_value_get_object(root);
-        tm->tiles_wide = (int32_t)json_object_get_number(root_obj, "tileswide");
-        tm->tiles_high = (int32_t)json_object_get_number(root_obj, "tileshigh");
-        tm->tile_width = (int32_t)json_object_get_number(root_obj, "tilewidth");
-        tm->tile_height = (int32_t)json_object_get_number(root_obj, "tileheight");
 
-        JSON_Array* layer_arr = json_object_get_array(root_obj, "layers");
-        for (size_t i = 0; i < json_array_get_count(layer_arr); ++i) {
+        bool result = write_compiled_map(&tm, out_file);
+        if (result) {
+                LOGINFO("Compiled map %s to %s", map_file, out_file);
+        }
+
+        tilemap_reset(&tm);
+        return result;
+}
+
+// Points the tilemap's layers at the tiles in the mapped compiled map.
+// Returns false if the map is malformed.
+bool load_compiled_map(tilemap* tm, mapped_file* f, const char* map_file)
+{
+        const uint8_t* data = mapped_file_data(f);
+        size_t size = mapped_file_size(f);
+        const map_header* header = (const map_header*)data;
+
+        if (header->version != MAP_VERSION) {
+                LOGERR("Compiled map %s has version %u, expected %u",
+                       map_file, header->version, MAP_VERSION);
+                return false;
+        }
+
+        if (header->tiles_wide < 0 || header->tiles_high < 0 ||
+            header->layer_count < 0 ||
+            sizeof(map_header) + (size_t)header->layer_count * sizeof(map_layer) > size) {
+                LOGERR("Compiled map %s has a malformed header", map_file);
+                return false;
+        }
+
+        tm->tiles_wide = header->tiles_wide;
+        tm->tiles_high = header->tiles_high;
+        tm->tile_width = header->tile_width;
+        tm->tile_height = header->tile_height;
+
+        size_t tiles_size = (size_t)tm->tiles_wide * tm->tiles_high * sizeof(uint16_t);
+        const map_layer* layers = (const map_layer*)(header + 1);
+        for (int32_t i = 0; i < header->layer_count; ++i) {
+                const map_layer* ml = &layers[i];
+                if (ml->tiles_offset % sizeof(uint16_t) != 0 ||
+                    ml->tiles_offset > size || size - ml->tiles_offset < tiles_size) {
+                        LOGERR("Compiled map %s has malformed layer %d", map_file, i);
+                        return false;
+                }
+
                 layer* l = sb_add(tm->layer_sb, 1);
                 memset(l, 0, sizeof(*l));
+                l->index = (int16_t)ml->index;
+                l->tiles = (const uint16_t*)(data + ml->tiles_offset);
+                memcpy(l->name, ml->name, LAYER_NAME_MAX_LEN);
+                l->name[LAYER_NAME_MAX_LEN - 1] = '\0';
+        }
+
+        return true;
+}
+
+// Streams the pyxel map json in the mapped file straight into the
+// tilemap's layers without building a json tree.
+bool parse_map_file(tilemap* tm, const char* map_file)
+{
+        mapped_file* f = mapped_file_open(map_file);
+        if (!f) {
+                LOGERR("Failed to open map file %s", map_file);
+                return false;
+        }
+
+        // Pyxel maps have their layers before the map size, so the size
+        // is read on a first pass to let the second write tiles straight
+        // into their layers.
+        json_reader jr;
+        json_reader_init(&jr, mapped_file_data(f), mapped_file_size(f));
+        bool ok = read_map_size(tm, &jr);
+        if (ok) {
+                json_reader_init(&jr, mapped_file_data(f), mapped_file_size(f));
+                ok = read_layers(tm, &jr, map_file);
+        }
+
+        if (!ok) {
+                const char* error = json_reader_error(&jr);
+                LOGERR("Failed to parse json from map file %s at line %u: %s",
+                       map_file, json_reader_line(&jr),
+                       error ? error : "Unexpected value");
+        }
+
+        mapped_file_close(f);
+        return ok;
+}
+
+// Reads the map's size from the root object, skipping everything else.
+// Returns false if the json is malformed.
+bool read_map_size(tilemap* tm, json_reader* jr)
+{
+        if (json_reader_next(jr) != json_token_object_begin) {
+                return false;
+        }
+
+        while (json_reader_next(jr) == json_token_key) {
+                int32_t* field = NULL;
+                if (json_reader_is(jr, "tileswide")) {
+                        field = &tm->tiles_wide;
+                } else if (json_reader_is(jr, "tileshigh")) {
+                        field = &tm->tiles_high;
+                } else if (json_reader_is(jr, "tilewidth")) {
+                        field = &tm->tile_width;
+                } else if (json_reader_is(jr, "tileheight")) {
+                        field = &tm->tile_height;
+                }
+
+                if (json_reader_next(jr) == json_token_error) {
+                        return false;
+                }
+                if (field) {
+                        *field = json_reader_int(jr);
+                }
+                if (!json_reader_skip(jr)) {
+                        return false;
+                }
+        }
+
+        return jr->token == json_token_object_end &&
+               tm->tiles_wide >= 0 && tm->tiles_high >= 0;
+}
+
+// Reads each of the layers in the root object's layers array.
+// Returns false if the json is malformed.
+bool read_layers(tilemap* tm, json_reader* jr, const char* map_file)
+{
+        if (json_reader_next(jr) != json_token_object_begin) {
+                return false;
+        }
+
+        while (json_reader_next(jr) == json_token_key) {
+                bool layers = json_reader_is(jr, "layers");
+                if (json_reader_next(jr) == json_token_error) {
+                        return false;
+                }
+
+                if (layers && jr->token == json_token_array_begin) {
+                        while (json_reader_next(jr) != json_token_array_end) {
+                                if (!read_layer(tm, jr, map_file)) {
+                                        return false;
+                                }
+                        }
+                } else if (!json_reader_skip(jr)) {
+                        return false;
+                }
+        }
+
+        return jr->token == json_token_object_end;
+}
+
+// Adds a layer for the layer object that was just begun and reads its
+// tiles into it. Values that aren't objects are skipped.
+// Returns false if the json is malformed.
+bool read_layer(tilemap* tm, json_reader* jr, const char* map_file)
+{
+        if (jr->token != json_token_object_begin) {
+                return json_reader_skip(jr);
+        }
+
+        layer* l = sb_add(tm->layer_sb, 1);
+        memset(l, 0, sizeof(*l));
+
+        size_t tile_count = (size_t)tm->tiles_wide * tm->tiles_high;
+        uint16_t* tiles = sb_add(l->tile_sb, (int)tile_count);
+        memset(tiles, 0, tile_count * sizeof(uint16_t));
+        l->tiles = tiles;
+
+        while (json_reader_next(jr) == json_token_key) {
+                bool number = json_reader_is(jr, "number");
+                bool name = json_reader_is(jr, "name");
+                bool tile_arr = json_reader_is(jr, "tiles");
+                if (json_reader_next(jr) == json_token_error) {
+                        return false;
+                }
 
-                JSON_Object* layer_obj = json_array_get_object(layer_arr, i);
-                l->index = (int16_t)json_object_get_number(layer_obj, "number");
-                strcpy(l->name, json_object_get_string(layer_obj, "name"));
+                if (number) {
+                        l->index = (int16_t)json_reader_int(jr);
+                } else if (name) {
+                        json_reader_copy_string(jr, l->name, LAYER_NAME_MAX_LEN);
+                } else if (tile_arr && jr->token == json_token_array_begin) {
+                        while (json_reader_next(jr) != json_token_array_end) {
+                                if (!read_tile(tm, jr, tiles, map_file)) {
+                                        return false;
+                                }
+                        }
+                        continue;
+                }
+
+                if (!json_reader_skip(jr)) {
+                        return false;
+                }
+        }
+
+        return jr->token == json_token_object_end;
+}
+
+// Packs the tile object that was just begun into the layer's tiles.
+// Values that aren't objects are skipped.
+// Returns false if the json is malformed.
+bool read_tile(tilemap* tm, json_reader* jr, uint16_t* tiles, const char* map_file)
+{
+        if (jr->token != json_token_object_begin) {
+                return json_reader_skip(jr);
+        }
+
+        int32_t id = 0;
+        int32_t x = 0;
+        int32_t y = 0;
+        int32_t rot = 0;
+        bool flip_x = false;
+        while (json_reader_next(jr) == json_token_key) {
+                int32_t* field = NULL;
+                bool flip = json_reader_is(jr, "flipX");
+                if (json_reader_is(jr, "tile")) {
+                        field = &id;
+                } else if (json_reader_is(jr, "x")) {
+                        field = &x;
+                } else if (json_reader_is(jr, "y")) {
+                        field = &y;
+                } else if (json_reader_is(jr, "rot")) {
+                        field = &rot;
+                }
+
+                if (json_reader_next(jr) == json_token_error) {
+                        return false;
+                }
+                if (field) {
+                        *field = json_reader_int(jr);
+                } else if (flip) {
+                        flip_x = jr->token == json_token_true;
+                }
+                if (!json_reader_skip(jr)) {
+                        return false;
+                }
+        }
+        if (jr->token != json_token_object_end) {
+                return false;
+        }
+
+        if (id < 0) {
+                return true;
+        }
+        if (id > TILE_MAX_ID ||
+            x < 0 || x >= tm->tiles_wide ||
+            y < 0 || y >= tm->tiles_high) {
+                LOGWARN("Skipping invalid tile %d at %d,%d in map file %s",
+                        id, x, y, map_file);
+                return true;
+        }
+
+        tiles[tm->tiles_wide * y + x] = TILE_PACK(id, flip_x, rot);
+        return true;
+}
+
+// Writes the parsed tilemap out as a compiled map.
+// Returns false if the file could not be written.
+bool write_compiled_map(tilemap* tm, const char* out_file)
+{
+        FILE* f = fopen(out_file, "wb");
+        if (!f) {
+                LOGERR("Failed to open %s for writing", out_file);
+                return false;
+        }
+
+        map_header header;
+        memset(&header, 0, sizeof(header));
+        header.magic = MAP_MAGIC;
+        header.version = MAP_VERSION;
+        header.tiles_wide = tm->tiles_wide;
+        header.tiles_high = tm->tiles_high;
+        header.tile_width = tm->tile_width;
+        header.tile_height = tm->tile_height;
+        header.layer_count = sb_count(tm->layer_sb);
+
+        bool ok = fwrite(&header, sizeof(header), 1, f) == 1;
+
+        size_t tiles_size = (size_t)tm->tiles_wide * tm->tiles_high * sizeof(uint16_t);
+        uint32_t tiles_offset = sizeof(map_header) +
+                                header.layer_count * sizeof(map_layer);
+        for (int32_t i = 0; i < header.layer_count && ok; ++i) {
+                map_layer ml;
+                memset(&ml, 0, sizeof(ml));
+                ml.index = tm->layer_sb[i].index;
+                ml.tiles_offset = tiles_offset;
+                memcpy(ml.name, tm->layer_sb[i].name, LAYER_NAME_MAX_LEN);
+                ok = fwrite(&ml, sizeof(ml), 1, f) == 1;
+                tiles_offset += (uint32_t)tiles_size;
+        }
+
+        for (int32_t i = 0; i < header.layer_count && ok; ++i) {
+                ok = fwrite(tm->layer_sb[i].tiles, 1, tiles_size, f) == tiles_size;
+        }
+
+        fclose(f);
+        if (!ok) {
+                LOGERR("Failed to write compiled map %s", out_file);
+        }
+
+        return ok;
+}
+
+bool tilemap_create_batches(tilemap* tm, renderer* r)
+{
+        assert(tm);
+        assert(r);
+
+        for (int32_t i = 0; i < sb_count(tm->chunk_sb); ++i) {
+                chunk* c = &tm->chunk_sb[i];
+                if (c->sprite_count == 0) {
+                        continue;
+                }
 
-                JSON_Array* tile_arr = json_object_get_array(layer_obj, "tiles");
-                size_t tile_count = json_array_get_count(tile_arr);
-                tile* tile_start = sb_add(l->tile_sb, (int)tile_count);
-                for (size_t j = 0; j < tile_count; ++j) {
-                        JSON_Object* tile_object = json_array_get_object(tile_arr, j);
-                        tile* t = &tile_start[j];
-                        t->value = (int16_t)json_object_get_number(tile_object, "tile");
-                        t->flip_x = (bool)json_object_get_boolean(tile_object, "flipX");
-                        t->pos.x = (float)json_object_get_number(tile_object, "x");
-                        t->pos.y = (float)json_object_get_number(tile_object, "y");
-                        t->rot = (float)json_object_get_number(tile_object, "rot");
+                c->batch = render_create_static_batch(r,
+                                                      &tm->sprite_sb[c->first_sprite],
+                                                      c->sprite_count);
+                if (!c->batch) {
+                        LOGERR("Failed to create batch for tilemap chunk %d", i);
+                        tilemap_free_batches(tm, r);
+                        return false;
                 }
         }
 
-        json_value_free(root);
         return true;
 }
 
+void tilemap_free_batches(tilemap* tm, renderer* r)
+{
+        assert(tm);
+        assert(r);
+
+        for (int32_t i = 0; i < sb_count(tm->chunk_sb); ++i) {
+                chunk* c = &tm->chunk_sb[i];
+                if (c->batch) {
+                        render_free_static_batch(r, c->batch);
+                        c->batch = NULL;
+                }
+        }
+}
+
+int32_t tilemap_draw(tilemap* tm, renderer* r, const rect* view)
+{
+        assert(tm);
+        assert(r);
+        assert(view);
+
+        int32_t drawn = 0;
+        for (int32_t i = 0; i < sb_count(tm->chunk_sb); ++i) {
+                chunk* c = &tm->chunk_sb[i];
+                if (!c->batch || !rect_intersects(&c->bounds, view)) {
+                        continue;
+                }
+
+                render_add_static_batch(r, c->batch);
+                ++drawn;
+        }
+
+        return drawn;
+}
+
 void update_sprites(tilemap* tm)
 {
-        for (int32_t h = 0; h < sb_count(tm->layer_sb); ++h) {
-                for (int32_t i = 0; i < tm->tiles_high; ++i) {
-                        for (int32_t j = 0; j < tm->tiles_wide; ++j) {
-                                layer* l = &tm->layer_sb[h];
-                                tile* t = &l->tile_sb[tm->tiles_wide * i + j];
-                                if (t->value == -1) {
-                                        continue;
+        tm->chunks_wide = (tm->tiles_wide + CHUNK_TILES - 1) / CHUNK_TILES;
+        tm->chunks_high = (tm->tiles_high + CHUNK_TILES - 1) / CHUNK_TILES;
+
+        // Sprites are built a chunk at a time so each chunk's sprites
+        // are contiguous in sprite_sb.
+        for (int32_t cy = 0; cy < tm->chunks_high; ++cy) {
+                for (int32_t cx = 0; cx < tm->chunks_wide; ++cx) {
+                        int32_t row_start = cy * CHUNK_TILES;
+                        int32_t row_end = row_start + CHUNK_TILES;
+                        if (row_end > tm->tiles_high) {
+                                row_end = tm->tiles_high;
+                        }
+                        int32_t col_start = cx * CHUNK_TILES;
+                        int32_t col_end = col_start + CHUNK_TILES;
+                        if (col_end > tm->tiles_wide) {
+                                col_end = tm->tiles_wide;
+                        }
+
+                        chunk* c = sb_add(tm->chunk_sb, 1);
+                        c->first_sprite = sb_count(tm->sprite_sb);
+                        c->batch = NULL;
+
+                        // PyxelEdit's rows run top down.
+                        c->bounds.x = (float)(col_start * tm->tile_width);
+                        c->bounds.y = (float)((tm->tiles_high - row_end) * tm->tile_height);
+                        c->bounds.w = (float)((col_end - col_start) * tm->tile_width);
+                        c->bounds.h = (float)((row_end - row_start) * tm->tile_height);
+
+                        for (int32_t h = 0; h < sb_count(tm->layer_sb); ++h) {
+                                for (int32_t i = row_start; i < row_end; ++i) {
+                                        for (int32_t j = col_start; j < col_end; ++j) {
+                                                update_sprite(tm, &tm->layer_sb[h], i, j);
+                                        }
                                 }
-                                sprite* s = sb_add(tm->sprite_sb, 1);
-                                s->flip_x = t->flip_x;
-
-                                // PyxelEdit's y index is backwards.
-                                float y_index = tm->tiles_high - t->pos.y - 1;
-
-                                float x_pos = t->pos.x * tm->tile_width;
-                                float y_pos = y_index * tm->tile_height;
-                                atlas_sprite_id(tm->atlas, s, t->value,
-                                                x_pos, y_pos,
-                                                x_pos + (tm->tile_width / 2.0f), 
-                                                y_pos + (tm->tile_height / 2.0f),
-                                                1.0f,
-                                                t->rot * -90); // 0 = 0, 1 = 90, 2 = 180 etc.
-                                s->depth = l->index + 100; // Todo: Deal with tilemap depth.
                         }
+
+                        c->sprite_count = sb_count(tm->sprite_sb) - c->first_sprite;
                 }
         }
+}
+
+// Adds a sprite for the tile in the specified row and column of the layer.
+void update_sprite(tilemap* tm, layer* l, int32_t row, int32_t col)
+{
+        uint16_t t = l->tiles[tm->tiles_wide * row + col];
+        if (t == TILE_EMPTY) {
+                return;
+        }
+        sprite* s = sb_add(tm->sprite_sb, 1);
+        s->flip_x = TILE_FLIP_X(t);
+
+        // PyxelEdit's y index is backwards.
+        float y_index = (float)(tm->tiles_high - row - 1);
+
+        float x_pos = (float)(col * tm->tile_width);
+        float y_pos = y_index * tm->tile_height;
+        atlas_sprite_id(tm->atlas, s, TILE_ID(t),
+                        x_pos, y_pos,
+                        x_pos + (tm->tile_width / 2.0f),
+                        y_pos + (tm->tile_height / 2.0f),
+                        1.0f,
+                        TILE_ROT(t) * -90.0f); // 0 = 0, 1 = 90, 2 = 180 etc.
+        s->depth = l->index + 100; // Todo: Deal with tilemap depth.
 }
\ No newline at end of file
@@ -3,23 +3,42 @@
 #include <stdbool.h>
 #include <stdint.h>
 
-#include <kazmath/vec2.h>
+#include <seed/rect.h>
 
 #define LAYER_NAME_MAX_LEN 32
+// Width and height of a tilemap chunk in tiles.
+#define CHUNK_TILES 16
 
-typedef struct tile {
-        int16_t value;
-        bool flip_x;
-        kmVec2 pos;
-        float rot;
-} tile;
+// Tiles are packed into 16 bits as
+// | 2 bits rotation | 1 bit flip x | 13 bits atlas sprite id + 1 |
+// where rotation is in quarter turns and a packed value of 0 means
+// there is no tile.
+#define TILE_EMPTY 0
+#define TILE_MAX_ID 0x1ffe
+#define TILE_PACK(id, flip_x, rot) \
+        ((uint16_t)(((id) + 1) | ((flip_x) ? 0x2000 : 0) | (((rot) & 3) << 14)))
+#define TILE_ID(t) ((int32_t)((t) & 0x1fff) - 1)
+#define TILE_FLIP_X(t) (((t) & 0x2000) != 0)
+#define TILE_ROT(t) ((t) >> 14)
 
 typedef struct layer {
         int16_t index;
-        tile* tile_sb;
+        // tiles_wide * tiles_high packed tiles with rows running top down.
+        // Points into the mapped file for compiled maps.
+        const uint16_t* tiles;
+        uint16_t* tile_sb; // Owns the tiles for maps loaded from json.
         char name[LAYER_NAME_MAX_LEN];
 } layer;
 
+// A square block of tiles across all layers. Chunks are drawn or
+// culled as a whole depending on whether their bounds are visible.
+typedef struct chunk {
+        rect bounds; // World space bounds of the chunk.
+        int32_t first_sprite; // Index of the chunk's first sprite in sprite_sb.
+        int32_t sprite_count;
+        struct static_batch* batch;
+} chunk;
+
 typedef struct tilemap {
         int32_t tiles_wide;
         int32_t tiles_high;
@@ -27,13 +46,36 @@ typedef struct tilemap {
         int32_t tile_height;
         layer* layer_sb;
         struct atlas* atlas;
-        struct sprite* sprite_sb;
+        struct sprite* sprite_sb; // Sprites for every tile, grouped by chunk.
+        int32_t chunks_wide;
+        int32_t chunks_high;
+        chunk* chunk_sb;
+        struct mapped_file* map_file; // Set for compiled maps.
 } tilemap;
 
-// Initializes the specified tilemap from the specified pyxel map json file
-// and atlas. This does not take ownership of the atlas.
+// Initializes the specified tilemap from the specified map file and atlas.
+// The map file can either be a pyxel map json file or a map compiled
+// from one by tilemap_compile, which is mapped and used without parsing.
+// This does not take ownership of the atlas.
 // Returns true if initialization was successful, false otherwise.
 bool tilemap_init(tilemap*, struct atlas*, const char* map_file);
 
+// Compiles the specified pyxel map json file into the binary map format
+// and writes it to out_file.
+// Returns true if the map was compiled, false otherwise.
+bool tilemap_compile(const char* map_file, const char* out_file);
+
 // Frees any allocation done by the tilemap and resets it to the default state.
-void tilemap_reset(tilemap*);
\ No newline at end of file
+// Any batches created by tilemap_create_batches must be freed first.
+void tilemap_reset(tilemap*);
+
+// Creates a static batch in the renderer for each chunk that has tiles.
+// Returns false if a batch could not be created.
+bool tilemap_create_batches(tilemap*, struct renderer*);
+
+// Frees the static batches created by tilemap_create_batches.
+void tilemap_free_batches(tilemap*, struct renderer*);
+
+// Adds the batches of the chunks that overlap the view to the renderer.
+// Returns the number of chunks added.
+int32_t tilemap_draw(tilemap*, struct renderer*, const rect* view);
\ No newline at end of file
@@ -0,0 +1,145 @@
+#include "arena.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "log.h"
+#include "stretchy_buffer.h"
+
+// Smallest overflow block so small allocations don't each get one.
+#define ARENA_MIN_OVERFLOW (64 * 1024)
+
+static size_t align_size(size_t size);
+static void* alloc_overflow(arena* a, size_t size);
+
+bool arena_init(arena* a, size_t size)
+{
+        assert(a);
+
+        a->data = NULL;
+        a->size = 0;
+        a->used = 0;
+        a->overflow_sb = NULL;
+        a->overflow_size = 0;
+        a->overflow_used = 0;
+        a->total = 0;
+
+        if (size == 0) {
+                return true;
+        }
+
+        a->data = malloc(size);
+        if (!a->data) {
+                LOGERR("Failed to allocate %u byte arena", (uint32_t)size);
+                return false;
+        }
+        a->size = size;
+
+        return true;
+}
+
+void arena_free(arena* a)
+{
+        assert(a);
+
+        for (int32_t i = 0; i < sb_count(a->overflow_sb); ++i) {
+                free(a->overflow_sb[i]);
+        }
+        sb_free(a->overflow_sb);
+        free(a->data);
+
+        a->overflow_sb = NULL;
+        a->data = NULL;
+        a->size = 0;
+        a->used = 0;
+        a->overflow_size = 0;
+        a->overflow_used = 0;
+        a->total = 0;
+}
+
+void* arena_alloc(arena* a, size_t size)
+{
+        assert(a);
+
+        size = align_size(size);
+        if (size <= a->size - a->used) {
+                void* p = a->data + a->used;
+                a->used += size;
+                a->total += size;
+                return p;
+        }
+
+        return alloc_overflow(a, size);
+}
+
+void arena_reset(arena* a)
+{
+        assert(a);
+
+        int32_t overflows = sb_count(a->overflow_sb);
+        if (overflows > 0) {
+                for (int32_t i = 0; i < overflows; ++i) {
+                        free(a->overflow_sb[i]);
+                }
+                sb_reset(a->overflow_sb);
+                a->overflow_size = 0;
+                a->overflow_used = 0;
+
+                // Grow to fit everything with room to spare so a load
+                // that creeps up doesn't overflow every time.
+                size_t size = a->size > 0 ? a->size : ARENA_MIN_OVERFLOW;
+                while (size < a->total) {
+                        size *= 2;
+                }
+
+                free(a->data);
+                a->data = malloc(size);
+                a->size = a->data ? size : 0;
+                if (!a->data) {
+                        LOGERR("Failed to grow arena to %u bytes", (uint32_t)size);
+                }
+        }
+
+        a->used = 0;
+        a->total = 0;
+}
+
+size_t arena_used(const arena* a)
+{
+        assert(a);
+        return a->total;
+}
+
+static size_t align_size(size_t size)
+{
+        return (size + ARENA_ALIGN - 1) & ~(size_t)(ARENA_ALIGN - 1);
+}
+
+// Bumps into the current overflow block or allocates a new one if it
+// is full.
+static void* alloc_overflow(arena* a, size_t size)
+{
+        if (size > a->overflow_size - a->overflow_used) {
+                size_t block_size = a->size > ARENA_MIN_OVERFLOW ?
+                                    a->size : ARENA_MIN_OVERFLOW;
+                if (block_size < size) {
+                        block_size = size;
+                }
+
+                uint8_t* block = malloc(block_size);
+                if (!block) {
+                        LOGERR("Failed to allocate %u byte arena overflow block",
+                               (uint32_t)block_size);
+                        return NULL;
+                }
+                sb_push(a->overflow_sb, block);
+                a->overflow_size = block_size;
+                a->overflow_used = 0;
+        }
+
+        uint8_t* block = a->overflow_sb[sb_count(a->overflow_sb) - 1];
+        void* p = block + a->overflow_used;
+        a->overflow_used += size;
+        a->total += size;
+        return p;
+}
\ No newline at end of file
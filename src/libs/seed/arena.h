@@ -0,0 +1,51 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Every allocation is aligned to this many bytes.
+#define ARENA_ALIGN 16
+
+// A linear allocator that hands out memory by bumping an offset into a
+// block and frees everything at once. Allocations that don't fit in
+// the block come from overflow blocks and the block is grown to fit
+// them all on the next reset, so an arena that sees the same load
+// every reset stops allocating after the first few.
+typedef struct arena {
+        uint8_t* data;
+        size_t size;
+        size_t used;
+
+        // Blocks allocated since the last reset because data was full.
+        // Allocations keep bumping into the last one.
+        uint8_t** overflow_sb;
+        size_t overflow_size;
+        size_t overflow_used;
+
+        // Bytes allocated since the last reset, including padding.
+        size_t total;
+} arena;
+
+// Reserves count elements of type from the arena.
+#define ARENA_ALLOC(a, type, count) \
+        ((type*)arena_alloc((a), sizeof(type) * (count)))
+
+// Initializes the arena with a block of size bytes, which can be 0 to
+// leave allocating it to the first reset after it is used.
+// Returns false if the block couldn't be allocated.
+bool arena_init(arena*, size_t size);
+
+// Frees the arena's memory.
+void arena_free(arena*);
+
+// Reserves size bytes from the arena. The memory is uninitialized and
+// is valid until the arena is reset or freed.
+// Returns NULL if an overflow block couldn't be allocated.
+void* arena_alloc(arena*, size_t size);
+
+// Frees every allocation, growing the block if the arena overflowed.
+void arena_reset(arena*);
+
+// Returns the number of bytes allocated since the last reset.
+size_t arena_used(const arena*);
\ No newline at end of file
@@ -2,107 +2,569 @@
 
 #include <assert.h>
 #include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
 
+#include "atlas_packer.h"
 #include "khash.h"
 #include "log.h"
+#include "platform/condition_var.h"
+#include "platform/mutex.h"
+#include "platform/thread.h"
 #include "render.h"
 #include "stretchy_buffer.h"
 #include "texture.h"
 
-#define PATH_MAX_LEN 127
-#define MAX_TEXTURES 32
-#define MAX_SOUNDS 32
+#define LOADER_THREADS 4
 
-static const int8_t unused_index = -1;
+// Transparent border around each packed texture. Its edges are
+// extruded into it so filtering never picks up a neighbour.
+#define PAGE_PADDING 1
 
+// Maps an interned texture path to the handle of its texture_asset.
+KHASH_MAP_INIT_STR(texture_map, uint32_t);
+
+// Texture assets are allocated individually so the textures handed
+// out stay put when the registry grows. The texture id is the handle,
+// an index into texture_asset_sb.
 typedef struct texture_asset {
-        uint8_t ref_count;
-        int8_t path_len;
-        char path[PATH_MAX_LEN];
+        texture texture;
+        uint32_t ref_count;
+        char* path; // Interned copy owned by the asset, also the map key.
+        bool is_page; // The texture is an atlas page made by the packer.
+        bool released; // Removed but frames in flight may still draw it.
 } texture_asset;
 
+// Decodes textures on a pool of threads. GL uploads still happen on
+// the render thread the first time each texture is drawn.
+typedef struct loader {
+        thread* threads[LOADER_THREADS];
+        mutex* mutex;
+        condition_var* work_condition; // Signalled when requests are added.
+        condition_var* done_condition; // Signalled when requests finish.
+        texture_asset** request_sb; // Textures waiting to be loaded.
+        int32_t next_request;
+        int32_t pending; // Requests queued or being loaded.
+        bool stopping;
+} loader;
+
 typedef struct assets {
-        // Space for the path to each texture_asset and texture.
-        texture_asset texture_assets[MAX_TEXTURES];
-        texture textures[MAX_TEXTURES];
+        // Slots for every texture handle given out. Released slots
+        // are NULL and their handles are kept in free_handle_sb.
+        texture_asset** texture_asset_sb;
+        uint32_t* free_handle_sb;
+        khash_t(texture_map)* texture_map;
+        uint32_t page_count; // Used to give each atlas page a unique path.
+        loader loader;
 } assets;
 
 static assets s_assets;
 
-void assets_init()
+void stbi_image_free(void *);
+texture_asset* find_texture(const char* texture_path);
+texture_asset* add_texture(const char* texture_path);
+void remove_texture(texture_asset* ta, renderer* r);
+void free_texture(texture* t, renderer* r);
+texture_asset* add_page(int32_t page_size);
+void copy_to_page(texture* page, texture* t, int32_t x, int32_t y);
+int compare_texture_heights(const void* a, const void* b);
+void wait_for_texture(texture* t);
+bool loader_init(loader* l);
+void loader_free(loader* l);
+void loader_push(loader* l, texture_asset* ta);
+uint32_t __stdcall loader_func(void* data);
+
+bool assets_init()
 {
-        // Mark the resources as unused
-        for (int8_t i = 0; i < MAX_TEXTURES; ++i) {
-                texture_asset* ta = &s_assets.texture_assets[i];
-                ta->ref_count = 0;
-                ta->path_len = -1;
+        s_assets.texture_asset_sb = NULL;
+        s_assets.free_handle_sb = NULL;
+        s_assets.texture_map = kh_init(texture_map);
+        if (!s_assets.texture_map) {
+                LOGERR("%s", "Failed to allocate texture map");
+                return false;
+        }
+
+        if (!loader_init(&s_assets.loader)) {
+                kh_destroy(texture_map, s_assets.texture_map);
+                s_assets.texture_map = NULL;
+                return false;
         }
+
+        return true;
 }
 
 void assets_reset(renderer* r)
 {
-        for (int8_t i = 0; i < MAX_TEXTURES; ++i) {
-                texture_asset* ta = &s_assets.texture_assets[i];
-                texture* t = &s_assets.textures[i];
+        // Nothing can be freed while it is still being loaded.
+        assets_wait_textures();
 
-                if (ta->ref_count > 0) {
-                        ta->ref_count = 0;
-                        ta->path_len = -1;
-                        texture_reset(t, r);
+        for (int32_t i = 0; i < sb_count(s_assets.texture_asset_sb); ++i) {
+                texture_asset* ta = s_assets.texture_asset_sb[i];
+                if (ta && !ta->released) {
+                        remove_texture(ta, r);
                 }
         }
+
+        // Frees everything removed, now or in earlier frames, once the
+        // frames in flight are done with it.
+        if (r) {
+                render_flush_textures(r);
+        }
+
+        sb_free(s_assets.texture_asset_sb);
+        s_assets.texture_asset_sb = NULL;
+        sb_free(s_assets.free_handle_sb);
+        s_assets.free_handle_sb = NULL;
 }
 
-texture* assets_get_texture(const char* texture_path)
+void assets_free(renderer* r)
 {
-        // Check if the texture is already loaded.
-        size_t path_len = strlen(texture_path);
-        int8_t unused_texture_index = -1;
-        for (int8_t i = 0; i < MAX_TEXTURES; ++i) {
-                texture_asset* ta = &s_assets.texture_assets[i];
-                if (path_len == ta->path_len && strcmp(texture_path, ta->path) == 0) {
-                        ta->ref_count++;
-
-                        LOGDBG("Assets: Texture %s already loaded", texture_path);
-                        return &s_assets.textures[i];
-                }
+        assets_reset(r);
+        loader_free(&s_assets.loader);
 
-                // Save the first unused texture resource we find in case we have to load
-                // the texture.
-                if (unused_texture_index == -1 && ta->ref_count == 0) {
-                        unused_texture_index = i;
-                }
+        if (s_assets.texture_map) {
+                kh_destroy(texture_map, s_assets.texture_map);
+                s_assets.texture_map = NULL;
         }
+}
 
-        // Load the texture cos we didn't find it in the array of texture resources.
-        if (unused_texture_index == -1) {
-                LOGWARN("Unable to load texture %s because no more slots available", texture_path);
+texture* assets_get_texture(const char* texture_path)
+{
+        texture* t = assets_get_texture_async(texture_path);
+        if (!t) {
                 return NULL;
         }
 
-        texture* t = &s_assets.textures[unused_texture_index];
-        if (!texture_init(t, unused_texture_index, texture_path)) {
+        wait_for_texture(t);
+        if (texture_get_state(t) != texture_loaded) {
+                assets_release_texture(t, NULL);
+                return NULL;
+        }
+
+        return t;
+}
+
+texture* assets_get_texture_async(const char* texture_path)
+{
+        assert(texture_path);
+
+        // Check if the texture is already loaded.
+        texture_asset* ta = find_texture(texture_path);
+        if (ta) {
+                ta->ref_count++;
+
+                LOGDBG("Assets: Texture %s already loaded", texture_path);
+                return &ta->texture;
+        }
+
+        ta = add_texture(texture_path);
+        if (!ta) {
+                LOGWARN("Unable to load texture %s", texture_path);
                 return NULL;
         }
 
-        texture_asset* ta = &s_assets.texture_assets[unused_texture_index];
-        ta->path_len = path_len;
         ta->ref_count++;
-        strcpy(ta->path, texture_path);
+        loader_push(&s_assets.loader, ta);
 
-        LOGDBG("Assets: Texture %s loaded", texture_path);
-        return t;
+        LOGDBG("Assets: Texture %s loading", texture_path);
+        return &ta->texture;
+}
+
+void assets_wait_textures()
+{
+        loader* l = &s_assets.loader;
+
+        mutex_lock(l->mutex);
+        while (l->pending > 0) {
+                condition_var_wait(l->done_condition, l->mutex);
+        }
+        mutex_unlock(l->mutex);
 }
 
 void assets_release_texture(texture* t, renderer* r)
 {
         assert(t);
 
-        texture_asset* ta = &s_assets.texture_assets[t->id];
+        assert(t->id < (uint32_t)sb_count(s_assets.texture_asset_sb));
+
+        texture_asset* ta = s_assets.texture_asset_sb[t->id];
+        assert(ta && ta->ref_count > 0);
         ta->ref_count--;
 
         if (ta->ref_count == 0) {
-                ta->path_len = -1;
-                texture_reset(t, r);
+                wait_for_texture(t);
+                texture* page = t->page;
+                remove_texture(ta, r);
+
+                // Each texture packed into a page holds a reference to it.
+                if (page) {
+                        assets_release_texture(page, r);
+                }
+        }
+}
+
+bool assets_pack_textures(int32_t page_size, renderer* r)
+{
+        assert(page_size > 2 * PAGE_PADDING);
+        assert(r);
+
+        // Pages are set and pixels freed below, which the render thread
+        // reads when drawing or uploading a texture.
+        assets_wait_textures();
+        render_wait_idle(r);
+
+        // Pack the tallest textures first, the skyline wastes less
+        // space that way.
+        texture** texture_sb = NULL;
+        for (int32_t i = 0; i < sb_count(s_assets.texture_asset_sb); ++i) {
+                texture_asset* ta = s_assets.texture_asset_sb[i];
+                if (!ta || ta->is_page) {
+                        continue;
+                }
+
+                texture* t = &ta->texture;
+                if (texture_get_state(t) != texture_loaded ||
+                    t->uploaded || t->page ||
+                    t->width + 2 * PAGE_PADDING > page_size ||
+                    t->height + 2 * PAGE_PADDING > page_size) {
+                        continue;
+                }
+                sb_push(texture_sb, t);
+        }
+
+        if (sb_count(texture_sb) < 2) {
+                // Nothing to gain from a page with a single texture.
+                sb_free(texture_sb);
+                return true;
+        }
+        qsort(texture_sb, sb_count(texture_sb), sizeof(texture*),
+              compare_texture_heights);
+
+        bool result = true;
+        texture_asset** page_sb = NULL;
+        atlas_packer* packer_sb = NULL;
+        for (int32_t i = 0; i < sb_count(texture_sb); ++i) {
+                texture* t = texture_sb[i];
+                int32_t w = t->width + 2 * PAGE_PADDING;
+                int32_t h = t->height + 2 * PAGE_PADDING;
+
+                // Try each of the pages in turn before starting a new one.
+                int32_t x, y;
+                int32_t p = 0;
+                while (p < sb_count(page_sb) &&
+                       !atlas_packer_add(&packer_sb[p], w, h, &x, &y)) {
+                        ++p;
+                }
+
+                if (p == sb_count(page_sb)) {
+                        texture_asset* page = add_page(page_size);
+                        if (!page) {
+                                result = false;
+                                break;
+                        }
+                        sb_push(page_sb, page);
+                        atlas_packer_init(sb_add(packer_sb, 1), page_size, page_size);
+                        atlas_packer_add(&packer_sb[p], w, h, &x, &y);
+                }
+
+                texture_asset* page = page_sb[p];
+                copy_to_page(&page->texture, t, x + PAGE_PADDING, y + PAGE_PADDING);
+                page->ref_count++;
+
+                t->page = &page->texture;
+                t->page_x = x + PAGE_PADDING;
+                t->page_y = y + PAGE_PADDING;
+                stbi_image_free(t->data);
+                t->data = NULL;
+        }
+
+        LOGDBG("Assets: Packed %d textures into %d atlas pages",
+               sb_count(texture_sb), sb_count(page_sb));
+
+        for (int32_t i = 0; i < sb_count(packer_sb); ++i) {
+                atlas_packer_reset(&packer_sb[i]);
+        }
+        sb_free(packer_sb);
+        sb_free(page_sb);
+        sb_free(texture_sb);
+
+        return result;
+}
+
+// Returns the texture asset with the specified path or NULL if it
+// isn't loaded.
+texture_asset* find_texture(const char* texture_path)
+{
+        khiter_t iter = kh_get(texture_map, s_assets.texture_map, texture_path);
+        if (iter == kh_end(s_assets.texture_map)) {
+                return NULL;
+        }
+
+        return s_assets.texture_asset_sb[kh_val(s_assets.texture_map, iter)];
+}
+
+// Allocates a texture asset for the specified path, gives it a handle
+// and adds it to the texture map. The texture is left in the loading
+// state with no references.
+// Returns NULL if there are no handles left or allocation fails.
+texture_asset* add_texture(const char* texture_path)
+{
+        uint32_t handle;
+        if (sb_count(s_assets.free_handle_sb) > 0) {
+                handle = sb_pop(s_assets.free_handle_sb);
+        } else {
+                handle = sb_count(s_assets.texture_asset_sb);
+                if (handle > TEXTURE_MAX_ID) {
+                        LOGERR("%s", "Out of texture handles");
+                        return NULL;
+                }
+                sb_push(s_assets.texture_asset_sb, NULL);
+        }
+
+        texture_asset* ta = malloc(sizeof(*ta));
+        if (!ta) {
+                LOGERR("%s", "Failed to allocate texture asset");
+                goto cleanup_handle;
+        }
+
+        size_t path_size = strlen(texture_path) + 1;
+        ta->path = malloc(path_size);
+        if (!ta->path) {
+                LOGERR("%s", "Failed to allocate texture path");
+                goto cleanup_asset;
+        }
+        memcpy(ta->path, texture_path, path_size);
+
+        int kh_ret;
+        khiter_t iter = kh_put(texture_map, s_assets.texture_map, ta->path, &kh_ret);
+        if (kh_ret == -1) {
+                LOGERR("%s", "Failed to add texture to texture map");
+                goto cleanup_path;
         }
+        kh_val(s_assets.texture_map, iter) = handle;
+
+        ta->ref_count = 0;
+        ta->is_page = false;
+        ta->released = false;
+        texture_init_async(&ta->texture, handle);
+        s_assets.texture_asset_sb[handle] = ta;
+        return ta;
+
+cleanup_path:
+        free(ta->path);
+cleanup_asset:
+        free(ta);
+cleanup_handle:
+        sb_push(s_assets.free_handle_sb, handle);
+        return NULL;
+}
+
+// Creates an empty, fully transparent atlas page and adds it to the
+// registry with no references.
+// Returns NULL if the page could not be created.
+texture_asset* add_page(int32_t page_size)
+{
+        char path[32];
+        snprintf(path, sizeof(path), "<atlas page %u>", s_assets.page_count++);
+
+        texture_asset* ta = add_texture(path);
+        if (!ta) {
+                return NULL;
+        }
+        ta->is_page = true;
+
+        if (!texture_load_blank(&ta->texture, page_size, page_size)) {
+                remove_texture(ta, NULL);
+                return NULL;
+        }
+
+        return ta;
+}
+
+// Copies the texture's pixels into the page with their top left
+// corner at x, y and extrudes the edge pixels into the padding.
+void copy_to_page(texture* page, texture* t, int32_t x, int32_t y)
+{
+        // Textures are always loaded with 4 channels.
+        uint32_t* dst = (uint32_t*)page->data;
+        const uint32_t* src = (const uint32_t*)t->data;
+        int32_t pad = PAGE_PADDING;
+
+        for (int32_t row = -pad; row < t->height + pad; ++row) {
+                int32_t src_row = row < 0 ? 0 : (row >= t->height ? t->height - 1 : row);
+                const uint32_t* src_line = src + src_row * t->width;
+                uint32_t* dst_line = dst + (y + row) * page->width + x;
+
+                memcpy(dst_line, src_line, t->width * sizeof(uint32_t));
+                for (int32_t i = 1; i <= pad; ++i) {
+                        dst_line[-i] = src_line[0];
+                        dst_line[t->width - 1 + i] = src_line[t->width - 1];
+                }
+        }
+}
+
+// Sorts textures from tallest to shortest.
+int compare_texture_heights(const void* a, const void* b)
+{
+        const texture* ta = *(const texture* const*)a;
+        const texture* tb = *(const texture* const*)b;
+        return tb->height - ta->height;
+}
+
+// Removes the texture asset from the texture map so its path can be
+// loaded again. The asset is freed, and its handle made available for
+// reuse, once frames in flight can no longer draw it. Without a renderer
+// the texture can't have been drawn so it is freed straight away.
+// The texture must not be loading.
+void remove_texture(texture_asset* ta, renderer* r)
+{
+        khiter_t iter = kh_get(texture_map, s_assets.texture_map, ta->path);
+        if (iter != kh_end(s_assets.texture_map)) {
+                kh_del(texture_map, s_assets.texture_map, iter);
+        }
+
+        ta->released = true;
+        if (r) {
+                render_release_texture(r, &ta->texture, free_texture);
+        } else {
+                free_texture(&ta->texture, NULL);
+        }
+}
+
+// Frees the removed texture asset and makes its handle available for
+// reuse.
+void free_texture(texture* t, renderer* r)
+{
+        uint32_t handle = t->id;
+        texture_asset* ta = s_assets.texture_asset_sb[handle];
+        assert(ta && ta->released);
+
+        texture_reset(t, r);
+        free(ta->path);
+        free(ta);
+
+        s_assets.texture_asset_sb[handle] = NULL;
+        sb_push(s_assets.free_handle_sb, handle);
+}
+
+// Blocks until the texture is no longer loading.
+void wait_for_texture(texture* t)
+{
+        loader* l = &s_assets.loader;
+
+        mutex_lock(l->mutex);
+        while (texture_get_state(t) == texture_loading) {
+                condition_var_wait(l->done_condition, l->mutex);
+        }
+        mutex_unlock(l->mutex);
+}
+
+bool loader_init(loader* l)
+{
+        memset(l, 0, sizeof(*l));
+
+        l->mutex = mutex_create();
+        if (!l->mutex) {
+                LOGERR("%s", "Failed to allocate texture loader mutex");
+                goto return_failed;
+        }
+
+        l->work_condition = condition_var_create();
+        if (!l->work_condition) {
+                LOGERR("%s", "Failed to allocate texture loader condition variable");
+                goto cleanup_mutex;
+        }
+
+        l->done_condition = condition_var_create();
+        if (!l->done_condition) {
+                LOGERR("%s", "Failed to allocate texture loader condition variable");
+                goto cleanup_work_condition;
+        }
+
+        for (int32_t i = 0; i < LOADER_THREADS; ++i) {
+                l->threads[i] = thread_create("texture_loader", loader_func, l);
+                if (!l->threads[i]) {
+                        LOGERR("%s", "Failed to create texture loader thread");
+                        loader_free(l);
+                        goto return_failed;
+                }
+        }
+
+        return true;
+
+cleanup_work_condition:
+        condition_var_free(l->work_condition);
+cleanup_mutex:
+        mutex_free(l->mutex);
+return_failed:
+        memset(l, 0, sizeof(*l));
+        return false;
+}
+
+void loader_free(loader* l)
+{
+        if (!l->mutex) {
+                return;
+        }
+
+        mutex_lock(l->mutex);
+        l->stopping = true;
+        condition_var_notify_all(l->work_condition);
+        mutex_unlock(l->mutex);
+
+        for (int32_t i = 0; i < LOADER_THREADS; ++i) {
+                if (l->threads[i]) {
+                        thread_join(l->threads[i]);
+                        thread_free(l->threads[i]);
+                }
+        }
+
+        sb_free(l->request_sb);
+        condition_var_free(l->done_condition);
+        condition_var_free(l->work_condition);
+        mutex_free(l->mutex);
+        memset(l, 0, sizeof(*l));
+}
+
+// Queues the texture asset to be loaded.
+void loader_push(loader* l, texture_asset* ta)
+{
+        mutex_lock(l->mutex);
+        sb_push(l->request_sb, ta);
+        l->pending++;
+        condition_var_notify(l->work_condition);
+        mutex_unlock(l->mutex);
+}
+
+uint32_t __stdcall loader_func(void* data)
+{
+        loader* l = (loader*)data;
+
+        mutex_lock(l->mutex);
+        for (;;) {
+                while (l->next_request == sb_count(l->request_sb) && !l->stopping) {
+                        condition_var_wait(l->work_condition, l->mutex);
+                }
+                if (l->next_request == sb_count(l->request_sb)) {
+                        break;
+                }
+
+                texture_asset* ta = l->request_sb[l->next_request++];
+                if (l->next_request == sb_count(l->request_sb)) {
+                        sb_reset(l->request_sb);
+                        l->next_request = 0;
+                }
+                mutex_unlock(l->mutex);
+
+                // The asset can't be freed while the texture is loading.
+                texture_load(&ta->texture, ta->path);
+
+                mutex_lock(l->mutex);
+                l->pending--;
+                condition_var_notify_all(l->done_condition);
+        }
+        mutex_unlock(l->mutex);
+
+        return 0;
 }
\ No newline at end of file
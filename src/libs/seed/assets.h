@@ -1,16 +1,48 @@
 #pragma once
 
+#include <inttypes.h>
 #include <stdbool.h>
 
-// Initializes the assets singleton.
-void assets_init();
+// Initializes the assets singleton and starts the threads
+// textures are loaded on.
+// Returns false if initialization failed.
+bool assets_init();
 
 // Resets the assets singleton to default state freeing
-// any loaded assets in the process.
+// any loaded assets in the process. Waits for r to draw every submitted
+// frame first, the frame being added to must not draw any of them.
 void assets_reset(struct renderer* r);
 
-// Returns the texture for the specified path.
+// Frees all loaded assets and stops the loading threads.
+void assets_free(struct renderer* r);
+
+// Returns the texture for the specified path. Blocks until the
+// texture is loaded.
 struct texture* assets_get_texture(const char* texture_path);
 
-// Releases the specified texture back to the asset manager.
+// Returns the texture for the specified path straight away and loads
+// it in the background if it isn't loaded already. Sprites using the
+// texture are not drawn until it has loaded. Use texture_get_state to
+// check on it or assets_wait_textures to wait for it.
+// Returns NULL if the texture could not be added.
+struct texture* assets_get_texture_async(const char* texture_path);
+
+// Blocks until all textures being loaded in the background are done.
+void assets_wait_textures();
+
+// Packs all loaded textures that fit into shared atlas pages of
+// page_size by page_size pixels so sprites using different textures
+// can be drawn together. Sprites keep using the original textures and
+// tex rects, the renderer draws them from the pages instead.
+// Waits for background loads to finish and for r to draw every
+// submitted frame first, as packing changes textures it may be drawing.
+// Must be called before any of the textures are used in a static batch.
+// Returns false if a page could not be created. Textures that were not
+// packed are still drawn on their own.
+bool assets_pack_textures(int32_t page_size, struct renderer* r);
+
+// Releases the specified texture back to the asset manager. Once it has
+// no references left it is freed after r has drawn every frame submitted
+// so far and the one being added to. r can only be NULL if the texture
+// was never drawn.
 void assets_release_texture(struct texture* t, struct renderer* r);
\ No newline at end of file
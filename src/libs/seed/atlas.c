@@ -3,16 +3,54 @@
 #include <assert.h>
 #include <inttypes.h>
 #include <stdio.h>
+#include <string.h>
 
 #include "log.h"
+#include "platform/mapped_file.h"
 #include "rect.h"
 #include "sprite.h"
 #include "stretchy_buffer.h"
 #include "texture.h"
 
+// Compiled atlases start with an atlas_header followed by the sprite
+// rects indexed by ID, the offset of each sprite's name in the string
+// table, the perfect hash buckets and slots and finally the string
+// table of null terminated names. All values are little endian.
+#define ATLAS_MAGIC 0x4c544153 // "SATL"
+#define ATLAS_VERSION 1
+
+// Limits the search for a seed that places a bucket's names in free
+// slots. Buckets average one name so this is never close.
+#define ATLAS_MAX_SEED 0x100000
+
+// Names are hashed into one of sprite_count buckets. Each bucket holds
+// either a seed that rehashes its names into distinct slots or, for
+// buckets of a single name, -(slot + 1). Slots hold sprite IDs, so a
+// name is found with two lookups and confirmed with one comparison.
+typedef struct atlas_header {
+        uint32_t magic;
+        uint32_t version;
+        int32_t sprite_count;
+        uint32_t rects_offset; // sprite_count rects.
+        uint32_t names_offset; // sprite_count uint32_t string offsets.
+        uint32_t buckets_offset; // sprite_count int32_t seeds.
+        uint32_t slots_offset; // sprite_count int32_t sprite IDs.
+        uint32_t strings_offset;
+        uint32_t strings_size;
+        uint32_t reserved;
+} atlas_header;
+
 unsigned char* stbi_load(const char*, int*, int*, int*, int);
 void stbi_image_free(void *);
 bool parse_atlas_info(atlas*, const char* atlas_info_path);
+bool load_compiled_atlas(atlas* a, mapped_file* f, const char* atlas_info_path);
+bool write_compiled_atlas(atlas* a, const char* out_file);
+bool build_perfect_hash(atlas* a, int32_t* buckets, int32_t* slots);
+bool place_bucket(const uint32_t* hashes, const int32_t* members, int32_t size,
+                  int32_t* slots, int32_t count, int32_t* seed);
+int32_t find_compiled_sprite(atlas* a, const char* name);
+uint32_t hash_name(const char* name);
+uint32_t hash_seed(uint32_t hash, int32_t seed);
 
 bool atlas_init(atlas* a,
                 texture* texture,
@@ -21,16 +59,51 @@ bool atlas_init(atlas* a,
         assert(a);
         assert(texture);
 
+        memset(a, 0, sizeof(*a));
         a->texture = texture;
-        a->rect_sb = NULL;
-        a->sprite_name_sb = NULL;
+
+        // Use compiled atlases in place if the file is one.
+        mapped_file* f = mapped_file_open(atlas_info_path);
+        if (f && mapped_file_size(f) >= sizeof(atlas_header) &&
+            ((const atlas_header*)mapped_file_data(f))->magic == ATLAS_MAGIC) {
+                if (!load_compiled_atlas(a, f, atlas_info_path)) {
+                        mapped_file_close(f);
+                        atlas_reset(a);
+                        return false;
+                }
+                a->atlas_file = f;
+                return true;
+        }
+
+        if (f) {
+                mapped_file_close(f);
+        }
         if (!parse_atlas_info(a, atlas_info_path)) {
+                atlas_reset(a);
                 return false;
         }
 
         return true;
 }
 
+bool atlas_compile(const char* atlas_info_path, const char* out_file)
+{
+        atlas a;
+        memset(&a, 0, sizeof(a));
+        if (!parse_atlas_info(&a, atlas_info_path)) {
+                atlas_reset(&a);
+                return false;
+        }
+
+        bool result = write_compiled_atlas(&a, out_file);
+        if (result) {
+                LOGINFO("Compiled atlas %s to %s", atlas_info_path, out_file);
+        }
+
+        atlas_reset(&a);
+        return result;
+}
+
 void atlas_reset(atlas* a)
 {
         assert(a);
@@ -38,6 +111,10 @@ void atlas_reset(atlas* a)
         sb_free(a->rect_sb);
         sb_free(a->sprite_name_sb);
         kh_destroy(sprite_map, a->sprite_names_map);
+        if (a->atlas_file) {
+                mapped_file_close(a->atlas_file);
+        }
+        memset(a, 0, sizeof(*a));
 }
 
 bool atlas_sprite_name(atlas* a, sprite* s,
@@ -48,13 +125,20 @@ bool atlas_sprite_name(atlas* a, sprite* s,
                        float rotation)
 {
         // Find the ID in the hash map using the name.
-        khiter_t iter = kh_get(sprite_map, a->sprite_names_map, name);
-        if (iter == kh_end(a->sprite_names_map)) {
+        int32_t sprite_id = -1;
+        if (a->header) {
+                sprite_id = find_compiled_sprite(a, name);
+        } else {
+                khiter_t iter = kh_get(sprite_map, a->sprite_names_map, name);
+                if (iter != kh_end(a->sprite_names_map)) {
+                        sprite_id = kh_val(a->sprite_names_map, iter);
+                }
+        }
+        if (sprite_id < 0) {
                 LOGERR("Failed to find sprite %s when adding to atlas", name);
                 return false;
         }
 
-        int32_t sprite_id = kh_val(a->sprite_names_map, iter);
         return atlas_sprite_id(a, s,
                                sprite_id,
                                x_pos, y_pos,
@@ -70,7 +154,7 @@ bool atlas_sprite_id(atlas* a, sprite* s,
                      float scale,
                      float rotation)
 {
-        if (sprite_id < 0 || sprite_id >= sb_count(a->rect_sb)) {
+        if (sprite_id < 0 || sprite_id >= a->rect_count) {
                 return false;
         }
 
@@ -80,7 +164,7 @@ bool atlas_sprite_id(atlas* a, sprite* s,
         s->y_anchor = y_anchor;
         s->scale = scale;
         s->rotation = rotation;
-        s->tex_rect = a->rect_sb[sprite_id];
+        s->tex_rect = a->rects[sprite_id];
         s->tex = a->texture;
 
         return true;
@@ -126,6 +210,281 @@ bool parse_atlas_info(atlas *a, const char* atlas_info_path)
         }
 
         fclose(atlas_file);
+
+        a->rects = a->rect_sb;
+        a->rect_count = sb_count(a->rect_sb);
+        return true;
+}
+
+// Points the atlas at the rects and name lookup in the mapped compiled
+// atlas.
+// Returns false if the atlas is malformed.
+bool load_compiled_atlas(atlas* a, mapped_file* f, const char* atlas_info_path)
+{
+        const uint8_t* data = mapped_file_data(f);
+        size_t size = mapped_file_size(f);
+        const atlas_header* header = (const atlas_header*)data;
+
+        if (header->version != ATLAS_VERSION) {
+                LOGERR("Compiled atlas %s has version %u, expected %u",
+                       atlas_info_path, header->version, ATLAS_VERSION);
+                return false;
+        }
+
+        // Check every table fits in the file so lookups needn't.
+        size_t count = header->sprite_count < 0 ? 0 : (size_t)header->sprite_count;
+        const uint32_t offsets[] = {
+                header->rects_offset, header->names_offset,
+                header->buckets_offset, header->slots_offset
+        };
+        const size_t sizes[] = {
+                count * sizeof(rect), count * sizeof(uint32_t),
+                count * sizeof(int32_t), count * sizeof(int32_t)
+        };
+        bool ok = header->sprite_count >= 0 &&
+                  header->strings_offset <= size &&
+                  size - header->strings_offset >= header->strings_size &&
+                  (count == 0 || (header->strings_size > 0 &&
+                                  data[header->strings_offset + header->strings_size - 1] == '\0'));
+        for (int32_t i = 0; i < 4 && ok; ++i) {
+                ok = offsets[i] % sizeof(uint32_t) == 0 &&
+                     offsets[i] <= size && size - offsets[i] >= sizes[i];
+        }
+
+        const uint32_t* names = (const uint32_t*)(data + header->names_offset);
+        const int32_t* buckets = (const int32_t*)(data + header->buckets_offset);
+        const int32_t* slots = (const int32_t*)(data + header->slots_offset);
+        for (size_t i = 0; i < count && ok; ++i) {
+                ok = names[i] < header->strings_size &&
+                     slots[i] >= 0 && (size_t)slots[i] < count &&
+                     (buckets[i] >= 0 || (size_t)-(int64_t)buckets[i] <= count);
+        }
+
+        if (!ok) {
+                LOGERR("Compiled atlas %s is malformed", atlas_info_path);
+                return false;
+        }
+
+        a->rects = (const rect*)(data + header->rects_offset);
+        a->rect_count = header->sprite_count;
+        a->header = header;
         return true;
 }
 
+// Writes the parsed atlas out as a compiled atlas.
+// Returns false if the names can't be hashed or the file could not be
+// written.
+bool write_compiled_atlas(atlas* a, const char* out_file)
+{
+        int32_t count = a->rect_count;
+        int32_t* bucket_sb = NULL;
+        int32_t* slot_sb = NULL;
+        int32_t* buckets = sb_add(bucket_sb, count);
+        int32_t* slots = sb_add(slot_sb, count);
+        if (!build_perfect_hash(a, buckets, slots)) {
+                sb_free(bucket_sb);
+                sb_free(slot_sb);
+                return false;
+        }
+
+        // Names are written in ID order after the tables.
+        uint32_t* name_sb = NULL;
+        uint32_t strings_size = 0;
+        for (int32_t i = 0; i < count; ++i) {
+                sb_push(name_sb, strings_size);
+                strings_size += (uint32_t)strlen(a->sprite_name_sb[i].name) + 1;
+        }
+
+        atlas_header header;
+        memset(&header, 0, sizeof(header));
+        header.magic = ATLAS_MAGIC;
+        header.version = ATLAS_VERSION;
+        header.sprite_count = count;
+        header.rects_offset = sizeof(atlas_header);
+        header.names_offset = header.rects_offset + count * sizeof(rect);
+        header.buckets_offset = header.names_offset + count * sizeof(uint32_t);
+        header.slots_offset = header.buckets_offset + count * sizeof(int32_t);
+        header.strings_offset = header.slots_offset + count * sizeof(int32_t);
+        header.strings_size = strings_size;
+
+        FILE* f = fopen(out_file, "wb");
+        bool ok = f != NULL;
+        if (ok) {
+                ok = fwrite(&header, sizeof(header), 1, f) == 1 &&
+                     (count == 0 ||
+                      (fwrite(a->rects, sizeof(rect), count, f) == (size_t)count &&
+                       fwrite(name_sb, sizeof(uint32_t), count, f) == (size_t)count &&
+                       fwrite(buckets, sizeof(int32_t), count, f) == (size_t)count &&
+                       fwrite(slots, sizeof(int32_t), count, f) == (size_t)count));
+                for (int32_t i = 0; i < count && ok; ++i) {
+                        const char* name = a->sprite_name_sb[i].name;
+                        ok = fwrite(name, strlen(name) + 1, 1, f) == 1;
+                }
+                fclose(f);
+        }
+        if (!ok) {
+                LOGERR("Failed to write compiled atlas %s", out_file);
+        }
+
+        sb_free(bucket_sb);
+        sb_free(slot_sb);
+        sb_free(name_sb);
+        return ok;
+}
+
+// Fills the sprite_count buckets and slots of the perfect hash for the
+// atlas's names, placing the biggest buckets first while most slots are
+// free.
+// Returns false if two sprites have the same name.
+bool build_perfect_hash(atlas* a, int32_t* buckets, int32_t* slots)
+{
+        int32_t count = a->rect_count;
+        memset(buckets, 0, count * sizeof(int32_t));
+        for (int32_t i = 0; i < count; ++i) {
+                slots[i] = -1;
+        }
+
+        // Group the IDs by bucket. Bucket b's IDs are members[starts[b]] up
+        // to members[starts[b + 1]].
+        uint32_t* hash_sb = NULL;
+        int32_t* start_sb = NULL;
+        int32_t* member_sb = NULL;
+        uint32_t* hashes = sb_add(hash_sb, count);
+        int32_t* starts = sb_add(start_sb, count + 1);
+        int32_t* members = sb_add(member_sb, count);
+        memset(starts, 0, (count + 1) * sizeof(int32_t));
+        for (int32_t i = 0; i < count; ++i) {
+                hashes[i] = hash_name(a->sprite_name_sb[i].name);
+                starts[hashes[i] % count + 1]++;
+        }
+        int32_t max_size = 0;
+        for (int32_t b = 0; b < count; ++b) {
+                if (starts[b + 1] > max_size) {
+                        max_size = starts[b + 1];
+                }
+                starts[b + 1] += starts[b];
+        }
+        for (int32_t i = 0; i < count; ++i) {
+                members[starts[hashes[i] % count]++] = i;
+        }
+        for (int32_t b = count; b > 0; --b) {
+                starts[b] = starts[b - 1];
+        }
+        if (count > 0) {
+                starts[0] = 0;
+        }
+
+        bool ok = true;
+        int32_t free_slot = 0;
+        for (int32_t size = max_size; size > 0 && ok; --size) {
+                for (int32_t b = 0; b < count && ok; ++b) {
+                        if (starts[b + 1] - starts[b] != size) {
+                                continue;
+                        }
+
+                        const int32_t* bucket = &members[starts[b]];
+                        if (size == 1) {
+                                // The rest of the buckets fill the free
+                                // slots in order.
+                                while (slots[free_slot] >= 0) {
+                                        ++free_slot;
+                                }
+                                slots[free_slot] = bucket[0];
+                                buckets[b] = -(free_slot + 1);
+                                continue;
+                        }
+
+                        ok = place_bucket(hashes, bucket, size, slots, count,
+                                          &buckets[b]);
+                        if (!ok) {
+                                LOGERR("Failed to hash sprite %s, its name is not unique",
+                                       a->sprite_name_sb[bucket[0]].name);
+                        }
+                }
+        }
+
+        sb_free(hash_sb);
+        sb_free(start_sb);
+        sb_free(member_sb);
+        return ok;
+}
+
+// Finds a seed that hashes the bucket's members into free slots and puts
+// them there.
+// Returns false if there is no such seed, which means some of the
+// members hash the same.
+bool place_bucket(const uint32_t* hashes, const int32_t* members, int32_t size,
+                  int32_t* slots, int32_t count, int32_t* seed)
+{
+        for (int32_t s = 1; s < ATLAS_MAX_SEED; ++s) {
+                int32_t placed = 0;
+                while (placed < size) {
+                        uint32_t slot = hash_seed(hashes[members[placed]], s) % count;
+                        if (slots[slot] >= 0) {
+                                break;
+                        }
+                        slots[slot] = members[placed];
+                        ++placed;
+                }
+                if (placed == size) {
+                        *seed = s;
+                        return true;
+                }
+
+                while (placed > 0) {
+                        --placed;
+                        slots[hash_seed(hashes[members[placed]], s) % count] = -1;
+                }
+        }
+
+        return false;
+}
+
+// Returns the ID of the named sprite in the compiled atlas, or -1 if it
+// has no such sprite.
+int32_t find_compiled_sprite(atlas* a, const char* name)
+{
+        const atlas_header* header = a->header;
+        int32_t count = header->sprite_count;
+        if (count == 0) {
+                return -1;
+        }
+
+        const uint8_t* data = (const uint8_t*)header;
+        const uint32_t* names = (const uint32_t*)(data + header->names_offset);
+        const int32_t* buckets = (const int32_t*)(data + header->buckets_offset);
+        const int32_t* slots = (const int32_t*)(data + header->slots_offset);
+        const char* strings = (const char*)(data + header->strings_offset);
+
+        // Any name hashes to some sprite so check it is the right one.
+        uint32_t hash = hash_name(name);
+        int32_t seed = buckets[hash % count];
+        int32_t slot = seed < 0 ? -seed - 1 : (int32_t)(hash_seed(hash, seed) % count);
+        int32_t id = slots[slot];
+        return strcmp(strings + names[id], name) == 0 ? id : -1;
+}
+
+// Returns the FNV-1a hash of the name.
+uint32_t hash_name(const char* name)
+{
+        uint32_t hash = 2166136261u;
+        for (; *name; ++name) {
+                hash ^= (uint8_t)*name;
+                hash *= 16777619u;
+        }
+        return hash;
+}
+
+// Returns the name's hash rehashed with the seed, using the murmur3
+// finalizer so each seed scatters the names differently.
+uint32_t hash_seed(uint32_t hash, int32_t seed)
+{
+        hash ^= (uint32_t)seed * 0x9e3779b9u;
+        hash ^= hash >> 16;
+        hash *= 0x85ebca6bu;
+        hash ^= hash >> 13;
+        hash *= 0xc2b2ae35u;
+        hash ^= hash >> 16;
+        return hash;
+}
+
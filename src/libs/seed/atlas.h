@@ -16,7 +16,11 @@ KHASH_MAP_INIT_STR(sprite_map, int32_t);
 // even though they are actually part of a texture atlas.
 
 typedef struct atlas {
-        struct rect* rect_sb;
+        // rect_count texture rects indexed by sprite ID. Points into the
+        // mapped file for compiled atlases.
+        const struct rect* rects;
+        int32_t rect_count;
+        struct rect* rect_sb; // Owns the rects for text atlases.
         struct texture* texture;
 
         // Names for each of the sprites in the texture atlas.
@@ -27,14 +31,26 @@ typedef struct atlas {
 
         // Hash map for getting sprites via name rather than ID.
         khash_t(sprite_map) *sprite_names_map;
+
+        // Compiled atlases look names up in the mapped file instead.
+        struct mapped_file* atlas_file;
+        const struct atlas_header* header;
 } atlas;
 
 // Initializes the atlas_info using the provided texture and
 // atlas info. Does not take ownership of the texture.
+// The atlas info can either be a TexturePacker text file or an atlas
+// compiled from one by atlas_compile, which is mapped and used without
+// parsing.
 // Returns false if initialization failed.
 bool atlas_init(atlas*, struct texture*,
                 const char* atlas_info_path);
 
+// Compiles the specified TexturePacker atlas info into the binary atlas
+// format and writes it to out_file.
+// Returns true if the atlas was compiled, false otherwise.
+bool atlas_compile(const char* atlas_info_path, const char* out_file);
+
 // Resets the sprite altas to its default state.
 void atlas_reset(atlas*);
 
@@ -0,0 +1,150 @@
+#include "atlas_packer.h"
+
+#include <assert.h>
+
+#include "stretchy_buffer.h"
+
+int32_t fit_skyline(atlas_packer* p, int32_t node, int32_t w, int32_t h);
+
+void atlas_packer_init(atlas_packer* p, int32_t width, int32_t height)
+{
+        assert(p);
+        assert(width > 0 && height > 0);
+
+        p->width = width;
+        p->height = height;
+        p->skyline_sb = NULL;
+
+        struct skyline_node* n = sb_add(p->skyline_sb, 1);
+        n->x = 0;
+        n->y = 0;
+        n->w = width;
+}
+
+void atlas_packer_reset(atlas_packer* p)
+{
+        assert(p);
+
+        sb_free(p->skyline_sb);
+        p->skyline_sb = NULL;
+        p->width = 0;
+        p->height = 0;
+}
+
+bool atlas_packer_add(atlas_packer* p, int32_t w, int32_t h,
+                      int32_t* x, int32_t* y)
+{
+        assert(p);
+        assert(x && y);
+
+        if (w <= 0 || h <= 0 || w > p->width || h > p->height) {
+                return false;
+        }
+
+        // Pick the spot that leaves the rect lowest, breaking ties on
+        // the narrowest node to waste the least space.
+        int32_t best = -1;
+        int32_t best_y = p->height;
+        int32_t best_w = p->width + 1;
+        for (int32_t i = 0; i < sb_count(p->skyline_sb); ++i) {
+                int32_t fit_y = fit_skyline(p, i, w, h);
+                if (fit_y < 0) {
+                        continue;
+                }
+
+                int32_t node_w = p->skyline_sb[i].w;
+                if (fit_y < best_y || (fit_y == best_y && node_w < best_w)) {
+                        best = i;
+                        best_y = fit_y;
+                        best_w = node_w;
+                }
+        }
+
+        if (best == -1) {
+                return false;
+        }
+
+        *x = p->skyline_sb[best].x;
+        *y = best_y;
+
+        // Insert the new node for the top of the rect then shrink or
+        // remove the nodes it covers.
+        struct skyline_node n = { *x, best_y + h, w };
+        sb_push(p->skyline_sb, n);
+        int32_t count = sb_count(p->skyline_sb);
+        for (int32_t i = count - 1; i > best; --i) {
+                p->skyline_sb[i] = p->skyline_sb[i - 1];
+        }
+        p->skyline_sb[best] = n;
+
+        int32_t right = n.x + n.w;
+        int32_t i = best + 1;
+        while (i < sb_count(p->skyline_sb)) {
+                struct skyline_node* next = &p->skyline_sb[i];
+                if (next->x >= right) {
+                        break;
+                }
+
+                int32_t shrink = right - next->x;
+                if (shrink < next->w) {
+                        next->x += shrink;
+                        next->w -= shrink;
+                        break;
+                }
+
+                // Completely covered so remove it.
+                count = sb_count(p->skyline_sb);
+                for (int32_t j = i; j < count - 1; ++j) {
+                        p->skyline_sb[j] = p->skyline_sb[j + 1];
+                }
+                stb__sbn(p->skyline_sb)--;
+        }
+
+        // Merge neighbours at the same height.
+        i = 0;
+        while (i < sb_count(p->skyline_sb) - 1) {
+                struct skyline_node* a = &p->skyline_sb[i];
+                struct skyline_node* b = &p->skyline_sb[i + 1];
+                if (a->y != b->y) {
+                        ++i;
+                        continue;
+                }
+
+                a->w += b->w;
+                count = sb_count(p->skyline_sb);
+                for (int32_t j = i + 1; j < count - 1; ++j) {
+                        p->skyline_sb[j] = p->skyline_sb[j + 1];
+                }
+                stb__sbn(p->skyline_sb)--;
+        }
+
+        return true;
+}
+
+// Returns the y a w by h rect would sit at if its left edge was placed
+// at the start of the specified node, or -1 if it doesn't fit there.
+int32_t fit_skyline(atlas_packer* p, int32_t node, int32_t w, int32_t h)
+{
+        int32_t x = p->skyline_sb[node].x;
+        if (x + w > p->width) {
+                return -1;
+        }
+
+        // The rect rests on the highest node it spans.
+        int32_t y = 0;
+        int32_t remaining = w;
+        for (int32_t i = node; remaining > 0; ++i) {
+                assert(i < sb_count(p->skyline_sb));
+                struct skyline_node* n = &p->skyline_sb[i];
+                if (n->y > y) {
+                        y = n->y;
+                }
+                remaining -= n->w;
+        }
+
+        if (y + h > p->height) {
+                return -1;
+        }
+
+        return y;
+}
\ No newline at end of file
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// An atlas packer finds space for rectangles in a fixed size atlas
+// page using the skyline bottom left heuristic. It only tracks the
+// space used, the caller copies the pixels in.
+
+typedef struct atlas_packer {
+        int32_t width;
+        int32_t height;
+
+        // The top edge of the packed rects from left to right. Each
+        // node starts at x and is y high until the next node.
+        struct skyline_node {
+                int32_t x, y, w;
+        };
+        struct skyline_node* skyline_sb;
+} atlas_packer;
+
+// Initializes the atlas packer for an empty page of the specified size.
+void atlas_packer_init(atlas_packer*, int32_t width, int32_t height);
+
+// Resets the atlas packer to its default state.
+void atlas_packer_reset(atlas_packer*);
+
+// Finds space for a w by h rect and marks it as used. x and y are set
+// to the corner of the space nearest the origin.
+// Returns false if there is no space for the rect.
+bool atlas_packer_add(atlas_packer*, int32_t w, int32_t h,
+                      int32_t* x, int32_t* y);
\ No newline at end of file
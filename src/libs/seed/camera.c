@@ -1,14 +1,20 @@
 #include "camera.h"
 
+#include <assert.h>
+#include <math.h>
+
 #include <kazmath/kazmath.h>
 
 #include "log.h"
+#include "rect.h"
 
 static float _x = 0;
 static float _y = 0;
 static float _scale_x = 1;
 static float _scale_y = 1;
 
+void build_transform(kmMat4* cam);
+
 void cam_move(float x, float y)
 {
         _x += x;
@@ -36,10 +42,51 @@ void cam_zoom_to(float scale_x, float scale_y)
 kmMat4* cam_transform()
 {
         static kmMat4 cam;
-        kmMat4Identity(&cam);
-        kmMat4Translation(&cam, -_x, -_y, 0);
+        build_transform(&cam);
+        return &cam;
+}
+
+void cam_view_rect(float virtual_width, float virtual_height, rect* view)
+{
+        assert(view);
+
+        // Sprites are transformed by cam * projection so undo that for
+        // the bottom left and top right corners of the screen.
+        kmMat4 cam;
+        build_transform(&cam);
+        kmMat4 proj;
+        kmMat4OrthographicProjection(&proj,
+                                     0, virtual_width,
+                                     0, virtual_height,
+                                     -1, 1);
+        kmMat4 view_proj;
+        kmMat4Multiply(&view_proj, &cam, &proj);
+
+        kmMat4 inverse;
+        if (!kmMat4Inverse(&inverse, &view_proj)) {
+                LOGWARN("%s", "Camera transform is not invertible");
+                *view = rect_zero;
+                return;
+        }
+
+        kmVec3 bl, tr;
+        kmVec3Fill(&bl, -1.0f, -1.0f, 0.0f);
+        kmVec3Fill(&tr, 1.0f, 1.0f, 0.0f);
+        kmVec3TransformCoord(&bl, &bl, &inverse);
+        kmVec3TransformCoord(&tr, &tr, &inverse);
+
+        // A negative scale flips the corners.
+        view->x = bl.x < tr.x ? bl.x : tr.x;
+        view->y = bl.y < tr.y ? bl.y : tr.y;
+        view->w = fabsf(tr.x - bl.x);
+        view->h = fabsf(tr.y - bl.y);
+}
+
+void build_transform(kmMat4* cam)
+{
+        kmMat4Identity(cam);
+        kmMat4Translation(cam, -_x, -_y, 0);
         kmMat4 scale_mat;
         kmMat4Scaling(&scale_mat, _scale_x, _scale_y, 1);
-        kmMat4Multiply(&cam, &cam, &scale_mat);
-        return &cam;
+        kmMat4Multiply(cam, cam, &scale_mat);
 }
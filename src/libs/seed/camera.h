@@ -16,3 +16,7 @@ void cam_zoom_to(float scale_x, float scale_y);
 
 // Returns the camera transform matrix. Ownership is not transferred.
 kmMat4* cam_transform();
+
+// Calculates the region of the world visible through the camera for a
+// renderer with the specified virtual resolution.
+void cam_view_rect(float virtual_width, float virtual_height, struct rect* view);
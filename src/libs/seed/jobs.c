@@ -0,0 +1,501 @@
+#include "jobs.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "log.h"
+#include "platform/atomic.h"
+#include "platform/condition_var.h"
+#include "platform/mutex.h"
+#include "platform/thread.h"
+#include "stretchy_buffer.h"
+
+#ifdef _WIN32
+#define THREAD_LOCAL __declspec(thread)
+#else
+#define THREAD_LOCAL __thread
+#endif
+
+#define MAX_WORKERS 64
+// Must be a power of 2.
+#define DEQUE_SIZE 4096
+// jobs_parallel_for never splits the work up more than this.
+#define MAX_RANGES 64
+// Ranges per thread so uneven ranges still balance out.
+#define RANGES_PER_THREAD 4
+
+typedef struct job {
+        job_fn fn;
+        void* data;
+        job_counter* counter;
+        job_counter* dependency;
+} job;
+
+// A Chase-Lev work stealing deque. The owning worker pushes and pops
+// at the bottom without locking and other threads steal from the top.
+// Indices only ever increase and wrap around the ring.
+typedef struct job_deque {
+        volatile int32_t top;
+        volatile int32_t bottom;
+        job jobs[DEQUE_SIZE];
+} job_deque;
+
+typedef struct worker {
+        thread* thread;
+        job_deque deque;
+} worker;
+
+typedef struct jobs {
+        worker* workers;
+        uint32_t worker_count;
+        bool running;
+        volatile int32_t stopping;
+
+        // Jobs submitted by threads that aren't workers.
+        mutex* shared_mutex;
+        job* shared_sb;
+        int32_t shared_next;
+
+        // Jobs waiting on a dependency, queued once it reaches 0. Also
+        // guarded by shared_mutex. parked counts them so finished jobs
+        // only take the mutex when something might be waiting.
+        job* parked_sb;
+        volatile int32_t parked;
+
+        // Jobs waiting in any queue. Workers sleep when there are none.
+        volatile int32_t queued;
+        volatile int32_t sleeping;
+        mutex* sleep_mutex;
+        condition_var* sleep_condition;
+} jobs;
+
+static jobs s_jobs;
+
+// The worker the current thread is, or NULL if it isn't one.
+static THREAD_LOCAL worker* t_worker;
+
+uint32_t __stdcall worker_func(void* data);
+void push_job(const job* j);
+bool park_job(const job* j);
+void unpark_jobs(job_counter* counter);
+bool take_job(job* j);
+void execute_job(const job* j);
+bool deque_push(job_deque* d, const job* j);
+bool deque_pop(job_deque* d, job* j);
+bool deque_steal(job_deque* d, job* j);
+void run_range(void* data);
+
+bool jobs_init(uint32_t worker_count)
+{
+        assert(!s_jobs.running);
+
+        if (worker_count == 0) {
+                uint32_t cpus = thread_cpu_count();
+                worker_count = cpus > 1 ? cpus - 1 : 1;
+        }
+        if (worker_count > MAX_WORKERS) {
+                worker_count = MAX_WORKERS;
+        }
+
+        memset(&s_jobs, 0, sizeof(s_jobs));
+
+        s_jobs.workers = calloc(worker_count, sizeof(worker));
+        if (!s_jobs.workers) {
+                LOGERR("%s", "Failed to allocate job workers");
+                goto return_failed;
+        }
+
+        s_jobs.shared_mutex = mutex_create();
+        if (!s_jobs.shared_mutex) {
+                LOGERR("%s", "Failed to allocate job queue mutex");
+                goto cleanup_workers;
+        }
+
+        s_jobs.sleep_mutex = mutex_create();
+        if (!s_jobs.sleep_mutex) {
+                LOGERR("%s", "Failed to allocate job sleep mutex");
+                goto cleanup_shared_mutex;
+        }
+
+        s_jobs.sleep_condition = condition_var_create();
+        if (!s_jobs.sleep_condition) {
+                LOGERR("%s", "Failed to allocate job condition variable");
+                goto cleanup_sleep_mutex;
+        }
+
+        s_jobs.running = true;
+        for (uint32_t i = 0; i < worker_count; ++i) {
+                worker* w = &s_jobs.workers[i];
+                w->thread = thread_create("job_worker", worker_func, w);
+                if (!w->thread) {
+                        LOGERR("%s", "Failed to create job worker thread");
+                        jobs_free();
+                        return false;
+                }
+                s_jobs.worker_count++;
+        }
+
+        LOGINFO("Started job system with %u workers", worker_count);
+        return true;
+
+cleanup_sleep_mutex:
+        mutex_free(s_jobs.sleep_mutex);
+cleanup_shared_mutex:
+        mutex_free(s_jobs.shared_mutex);
+cleanup_workers:
+        free(s_jobs.workers);
+return_failed:
+        memset(&s_jobs, 0, sizeof(s_jobs));
+        return false;
+}
+
+void jobs_free()
+{
+        if (!s_jobs.running) {
+                return;
+        }
+
+        // Workers run everything still queued before they stop.
+        mutex_lock(s_jobs.sleep_mutex);
+        atomic_store_i32(&s_jobs.stopping, 1);
+        condition_var_notify_all(s_jobs.sleep_condition);
+        mutex_unlock(s_jobs.sleep_mutex);
+
+        for (uint32_t i = 0; i < s_jobs.worker_count; ++i) {
+                thread_join(s_jobs.workers[i].thread);
+                thread_free(s_jobs.workers[i].thread);
+        }
+
+        // Nothing is left to take their dependencies to 0.
+        assert(sb_count(s_jobs.parked_sb) == 0);
+
+        condition_var_free(s_jobs.sleep_condition);
+        mutex_free(s_jobs.sleep_mutex);
+        mutex_free(s_jobs.shared_mutex);
+        sb_free(s_jobs.shared_sb);
+        sb_free(s_jobs.parked_sb);
+        free(s_jobs.workers);
+        memset(&s_jobs, 0, sizeof(s_jobs));
+}
+
+uint32_t jobs_worker_count()
+{
+        return s_jobs.worker_count;
+}
+
+void jobs_run(job_fn fn, void* data, job_counter* counter)
+{
+        jobs_run_after(fn, data, counter, NULL);
+}
+
+void jobs_run_after(job_fn fn, void* data, job_counter* counter,
+                    job_counter* dependency)
+{
+        assert(fn);
+
+        job j = { fn, data, counter, dependency };
+        if (counter) {
+                atomic_add_i32(&counter->value, 1);
+        }
+
+        if (!s_jobs.running) {
+                jobs_wait(dependency);
+                execute_job(&j);
+                return;
+        }
+
+        if (dependency && park_job(&j)) {
+                return;
+        }
+        push_job(&j);
+}
+
+void jobs_wait(job_counter* counter)
+{
+        if (!counter) {
+                return;
+        }
+
+        while (atomic_load_i32(&counter->value) > 0) {
+                job j;
+                if (s_jobs.running && take_job(&j)) {
+                        execute_job(&j);
+                } else {
+                        thread_yield();
+                }
+        }
+}
+
+// A slice of a jobs_parallel_for.
+typedef struct range_job {
+        job_range_fn fn;
+        void* data;
+        uint32_t begin;
+        uint32_t end;
+} range_job;
+
+void jobs_parallel_for(job_range_fn fn, void* data,
+                       uint32_t count, uint32_t min_range)
+{
+        assert(fn);
+
+        if (count == 0) {
+                return;
+        }
+        if (min_range == 0) {
+                min_range = 1;
+        }
+
+        uint32_t ranges = (s_jobs.worker_count + 1) * RANGES_PER_THREAD;
+        if (ranges > MAX_RANGES) {
+                ranges = MAX_RANGES;
+        }
+        uint32_t range_size = (count + ranges - 1) / ranges;
+        if (range_size < min_range) {
+                range_size = min_range;
+        }
+
+        // Not worth handing out if it all fits in one range.
+        if (!s_jobs.running || range_size >= count) {
+                fn(data, 0, count);
+                return;
+        }
+
+        range_job range_jobs[MAX_RANGES];
+        job_counter counter = { 0 };
+        uint32_t n = 0;
+        for (uint32_t begin = 0; begin < count; begin += range_size) {
+                range_job* rj = &range_jobs[n++];
+                rj->fn = fn;
+                rj->data = data;
+                rj->begin = begin;
+                rj->end = begin + range_size < count ? begin + range_size : count;
+        }
+
+        // Keep the first range for this thread.
+        for (uint32_t i = 1; i < n; ++i) {
+                jobs_run(run_range, &range_jobs[i], &counter);
+        }
+        run_range(&range_jobs[0]);
+
+        jobs_wait(&counter);
+}
+
+void run_range(void* data)
+{
+        range_job* rj = (range_job*)data;
+        rj->fn(rj->data, rj->begin, rj->end);
+}
+
+uint32_t __stdcall worker_func(void* data)
+{
+        t_worker = (worker*)data;
+
+        for (;;) {
+                job j;
+                if (take_job(&j)) {
+                        execute_job(&j);
+                        continue;
+                }
+
+                // Only stops once the queues are empty so no counter is
+                // left waiting on a job that never runs.
+                if (atomic_load_i32(&s_jobs.stopping)) {
+                        break;
+                }
+
+                // Nothing to do so sleep until a job is queued. Anyone
+                // queueing a job checks sleeping after bumping queued so
+                // either they see us or we see their job.
+                atomic_add_i32(&s_jobs.sleeping, 1);
+                mutex_lock(s_jobs.sleep_mutex);
+                while (atomic_load_i32(&s_jobs.queued) == 0 &&
+                       !atomic_load_i32(&s_jobs.stopping)) {
+                        condition_var_wait(s_jobs.sleep_condition, s_jobs.sleep_mutex);
+                }
+                mutex_unlock(s_jobs.sleep_mutex);
+                atomic_add_i32(&s_jobs.sleeping, -1);
+        }
+
+        return 0;
+}
+
+// Queues the job on the current worker's deque, or the shared queue if
+// this thread isn't a worker, and wakes a sleeping worker.
+void push_job(const job* j)
+{
+        if (!t_worker || !deque_push(&t_worker->deque, j)) {
+                mutex_lock(s_jobs.shared_mutex);
+                sb_push(s_jobs.shared_sb, *j);
+                mutex_unlock(s_jobs.shared_mutex);
+        }
+
+        atomic_add_i32(&s_jobs.queued, 1);
+        if (atomic_load_i32(&s_jobs.sleeping) > 0) {
+                mutex_lock(s_jobs.sleep_mutex);
+                condition_var_notify(s_jobs.sleep_condition);
+                mutex_unlock(s_jobs.sleep_mutex);
+        }
+}
+
+// Parks the job until its dependency reaches 0. Parked jobs aren't
+// counted as queued so workers can sleep while they wait.
+// Returns false if the dependency has already reached 0.
+bool park_job(const job* j)
+{
+        // Counted before checking the dependency so whoever takes it to
+        // 0 either sees the job parked or this thread sees the 0.
+        atomic_add_i32(&s_jobs.parked, 1);
+
+        mutex_lock(s_jobs.shared_mutex);
+        bool parked = atomic_load_i32(&j->dependency->value) > 0;
+        if (parked) {
+                sb_push(s_jobs.parked_sb, *j);
+        }
+        mutex_unlock(s_jobs.shared_mutex);
+
+        if (!parked) {
+                atomic_add_i32(&s_jobs.parked, -1);
+        }
+        return parked;
+}
+
+// Queues the jobs parked on the counter now that it has reached 0 and
+// wakes the workers to run them.
+void unpark_jobs(job_counter* counter)
+{
+        if (atomic_load_i32(&s_jobs.parked) == 0) {
+                return;
+        }
+
+        int32_t count = 0;
+        mutex_lock(s_jobs.shared_mutex);
+        int32_t i = 0;
+        while (i < sb_count(s_jobs.parked_sb)) {
+                if (s_jobs.parked_sb[i].dependency != counter) {
+                        ++i;
+                        continue;
+                }
+
+                sb_push(s_jobs.shared_sb, s_jobs.parked_sb[i]);
+                s_jobs.parked_sb[i] = sb_pop(s_jobs.parked_sb);
+                ++count;
+        }
+        mutex_unlock(s_jobs.shared_mutex);
+
+        if (count == 0) {
+                return;
+        }
+        atomic_add_i32(&s_jobs.parked, -count);
+        atomic_add_i32(&s_jobs.queued, count);
+        if (atomic_load_i32(&s_jobs.sleeping) > 0) {
+                mutex_lock(s_jobs.sleep_mutex);
+                condition_var_notify_all(s_jobs.sleep_condition);
+                mutex_unlock(s_jobs.sleep_mutex);
+        }
+}
+
+// Finds a job for the current thread, first from its own deque, then
+// the shared queue and finally by stealing from the other workers.
+// Returns false if there are no jobs.
+bool take_job(job* j)
+{
+        if (atomic_load_i32(&s_jobs.queued) == 0) {
+                return false;
+        }
+
+        bool found = t_worker && deque_pop(&t_worker->deque, j);
+
+        if (!found) {
+                mutex_lock(s_jobs.shared_mutex);
+                if (s_jobs.shared_next < sb_count(s_jobs.shared_sb)) {
+                        *j = s_jobs.shared_sb[s_jobs.shared_next++];
+                        if (s_jobs.shared_next == sb_count(s_jobs.shared_sb)) {
+                                sb_reset(s_jobs.shared_sb);
+                                s_jobs.shared_next = 0;
+                        }
+                        found = true;
+                }
+                mutex_unlock(s_jobs.shared_mutex);
+        }
+
+        // Start stealing from the next worker along so thieves spread out.
+        uint32_t start = t_worker ? (uint32_t)(t_worker - s_jobs.workers) + 1 : 0;
+        for (uint32_t i = 0; !found && i < s_jobs.worker_count; ++i) {
+                worker* victim = &s_jobs.workers[(start + i) % s_jobs.worker_count];
+                if (victim != t_worker) {
+                        found = deque_steal(&victim->deque, j);
+                }
+        }
+
+        if (!found) {
+                return false;
+        }
+        atomic_add_i32(&s_jobs.queued, -1);
+
+        return true;
+}
+
+void execute_job(const job* j)
+{
+        j->fn(j->data);
+        if (j->counter && atomic_add_i32(&j->counter->value, -1) == 0) {
+                unpark_jobs(j->counter);
+        }
+}
+
+// Pushes a job onto the bottom of the deque. Only the owner may push.
+// Returns false if the deque is full.
+bool deque_push(job_deque* d, const job* j)
+{
+        uint32_t b = (uint32_t)d->bottom;
+        uint32_t t = (uint32_t)atomic_load_i32(&d->top);
+        if (b - t >= DEQUE_SIZE) {
+                return false;
+        }
+
+        d->jobs[b & (DEQUE_SIZE - 1)] = *j;
+        atomic_store_i32(&d->bottom, (int32_t)(b + 1));
+        return true;
+}
+
+// Pops the most recently pushed job off the bottom of the deque. Only
+// the owner may pop.
+// Returns false if the deque is empty or a thief took the last job.
+bool deque_pop(job_deque* d, job* j)
+{
+        uint32_t b = (uint32_t)d->bottom - 1;
+        atomic_store_i32(&d->bottom, (int32_t)b);
+        uint32_t t = (uint32_t)atomic_load_i32(&d->top);
+
+        if ((int32_t)(b - t) < 0) {
+                // Empty.
+                atomic_store_i32(&d->bottom, (int32_t)(b + 1));
+                return false;
+        }
+
+        *j = d->jobs[b & (DEQUE_SIZE - 1)];
+        if (b != t) {
+                return true;
+        }
+
+        // Last job so race any thieves for it.
+        bool won = atomic_cas_i32(&d->top, (int32_t)t, (int32_t)(t + 1));
+        atomic_store_i32(&d->bottom, (int32_t)(b + 1));
+        return won;
+}
+
+// Steals the oldest job from the top of the deque. Safe from any thread.
+// Returns false if the deque is empty or another thread got there first.
+bool deque_steal(job_deque* d, job* j)
+{
+        uint32_t t = (uint32_t)atomic_load_i32(&d->top);
+        uint32_t b = (uint32_t)atomic_load_i32(&d->bottom);
+        if ((int32_t)(b - t) <= 0) {
+                return false;
+        }
+
+        *j = d->jobs[t & (DEQUE_SIZE - 1)];
+        return atomic_cas_i32(&d->top, (int32_t)t, (int32_t)(t + 1));
+}
\ No newline at end of file
@@ -0,0 +1,52 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+// The job system runs small pieces of work on a pool of worker threads.
+// Each worker has its own deque of jobs and steals from the others when
+// it runs out so work spreads evenly across the cores. Threads that
+// aren't workers submit jobs to a shared queue and help run jobs while
+// they wait on them.
+
+typedef void (*job_fn)(void* data);
+typedef void (*job_range_fn)(void* data, uint32_t begin, uint32_t end);
+
+// Tracks a group of jobs. The value is the number of jobs started with
+// the counter that haven't finished yet. Must start at 0.
+typedef struct job_counter {
+        volatile int32_t value;
+} job_counter;
+
+// Starts the job system with the specified number of worker threads.
+// Pass 0 to use one worker for each CPU apart from the calling thread's.
+// Returns false if the workers could not be started. Jobs are run
+// straight away on the submitting thread until the system is started.
+bool jobs_init(uint32_t worker_count);
+
+// Waits for the workers to run every queued job and stops them. Jobs
+// waiting on a dependency must have had it reach 0 by then.
+void jobs_free();
+
+// Returns the number of worker threads.
+uint32_t jobs_worker_count();
+
+// Queues fn to be run with data on any thread. If counter isn't NULL it
+// is incremented now and decremented when the job finishes.
+void jobs_run(job_fn fn, void* data, job_counter* counter);
+
+// Same as jobs_run but the job doesn't start until dependency reaches 0.
+// Until then it is set aside rather than queued, so it doesn't keep the
+// workers busy.
+void jobs_run_after(job_fn fn, void* data, job_counter* counter,
+                    job_counter* dependency);
+
+// Blocks until the counter reaches 0. The calling thread runs other jobs
+// while it waits so it is safe to wait from inside a job.
+void jobs_wait(job_counter* counter);
+
+// Calls fn over [0, count) split into ranges of at least min_range items
+// spread across the workers and the calling thread. Returns when all
+// ranges are done.
+void jobs_parallel_for(job_range_fn fn, void* data,
+                       uint32_t count, uint32_t min_range);
\ No newline at end of file
@@ -0,0 +1,557 @@
+#include "json_reader.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Numbers longer than this are too long to be anything but malformed.
+#define MAX_NUMBER_LEN 63
+
+static json_token fail(json_reader* r, const char* error);
+static void skip_space(json_reader* r);
+static json_token read_value(json_reader* r);
+static bool read_string(json_reader* r);
+static bool read_number(json_reader* r);
+static bool read_literal(json_reader* r, const char* literal, uint32_t len);
+static bool push(json_reader* r, bool object);
+static bool in_object(const json_reader* r);
+static uint32_t read_hex4(const char* p);
+static size_t encode_utf8(uint32_t c, char* out);
+
+void json_reader_init(json_reader* r, const char* data, size_t size)
+{
+        assert(r);
+        assert(data || size == 0);
+
+        r->data = data;
+        r->pos = data;
+        r->end = data + size;
+        r->token = json_token_error;
+        r->slice = NULL;
+        r->slice_len = 0;
+        r->escaped = false;
+        r->depth = 0;
+        r->object_bits = 0;
+        r->need_comma = false;
+        r->expect_key = false;
+        r->expect_value = false;
+        r->started = false;
+        r->error = NULL;
+}
+
+json_token json_reader_next(json_reader* r)
+{
+        assert(r);
+
+        if (r->error) {
+                return json_token_error;
+        }
+
+        skip_space(r);
+        if (r->error) {
+                return json_token_error;
+        }
+
+        if (r->pos == r->end) {
+                if (r->started && r->depth == 0) {
+                        r->token = json_token_end;
+                        return r->token;
+                }
+                return fail(r, "Unexpected end of document");
+        }
+
+        if (r->started && r->depth == 0) {
+                return fail(r, "Unexpected characters after document");
+        }
+
+        char c = *r->pos;
+        if ((c == '}' || c == ']') && r->depth > 0 && !r->expect_value) {
+                if ((c == '}') != in_object(r)) {
+                        return fail(r, "Mismatched closing bracket");
+                }
+
+                r->pos++;
+                r->depth--;
+                r->need_comma = r->depth > 0;
+                r->expect_key = false;
+                r->token = c == '}' ? json_token_object_end : json_token_array_end;
+                return r->token;
+        }
+
+        if (r->need_comma) {
+                if (c != ',') {
+                        return fail(r, "Expected a comma");
+                }
+                r->pos++;
+                r->need_comma = false;
+                r->expect_key = in_object(r);
+
+                skip_space(r);
+                if (r->error) {
+                        return json_token_error;
+                }
+                if (r->pos == r->end) {
+                        return fail(r, "Unexpected end of document");
+                }
+                if (*r->pos == '}' || *r->pos == ']') {
+                        return fail(r, "Trailing comma");
+                }
+        }
+
+        if (r->expect_key) {
+                if (*r->pos != '"' || !read_string(r)) {
+                        return fail(r, "Expected a key");
+                }
+
+                skip_space(r);
+                if (r->error) {
+                        return json_token_error;
+                }
+                if (r->pos == r->end || *r->pos != ':') {
+                        return fail(r, "Expected a colon after key");
+                }
+                r->pos++;
+
+                r->expect_key = false;
+                r->expect_value = true;
+                r->token = json_token_key;
+                return r->token;
+        }
+
+        r->expect_value = false;
+        return read_value(r);
+}
+
+bool json_reader_skip(json_reader* r)
+{
+        assert(r);
+
+        if (r->token != json_token_object_begin &&
+            r->token != json_token_array_begin) {
+                return r->token != json_token_error;
+        }
+
+        uint32_t depth = r->depth - 1;
+        while (r->depth > depth) {
+                if (json_reader_next(r) == json_token_error) {
+                        return false;
+                }
+        }
+
+        return true;
+}
+
+bool json_reader_is(const json_reader* r, const char* str)
+{
+        assert(r);
+        assert(str);
+
+        if (r->token != json_token_key && r->token != json_token_string) {
+                return false;
+        }
+
+        return strlen(str) == r->slice_len &&
+               memcmp(r->slice, str, r->slice_len) == 0;
+}
+
+double json_reader_number(const json_reader* r)
+{
+        assert(r);
+
+        if (r->token != json_token_number) {
+                return 0.0;
+        }
+
+        // The slice isn't null terminated so strtod gets a copy.
+        char buf[MAX_NUMBER_LEN + 1];
+        memcpy(buf, r->slice, r->slice_len);
+        buf[r->slice_len] = '\0';
+        return strtod(buf, NULL);
+}
+
+int32_t json_reader_int(const json_reader* r)
+{
+        assert(r);
+
+        if (r->token != json_token_number) {
+                return 0;
+        }
+
+        // Plain integers are by far the most common so skip strtod.
+        const char* p = r->slice;
+        const char* end = p + r->slice_len;
+        bool negative = *p == '-';
+        if (negative) {
+                ++p;
+        }
+
+        int64_t value = 0;
+        while (p < end && *p >= '0' && *p <= '9' && value <= INT32_MAX) {
+                value = value * 10 + (*p - '0');
+                ++p;
+        }
+        if (p < end || value > INT32_MAX) {
+                return (int32_t)json_reader_number(r);
+        }
+
+        return (int32_t)(negative ? -value : value);
+}
+
+bool json_reader_copy_string(const json_reader* r, char* out, size_t out_size)
+{
+        assert(r);
+        assert(out);
+        assert(out_size > 0);
+
+        if (r->token != json_token_key && r->token != json_token_string) {
+                out[0] = '\0';
+                return false;
+        }
+
+        const char* p = r->slice;
+        const char* end = p + r->slice_len;
+        size_t len = 0;
+        while (p < end) {
+                char buf[4];
+                size_t n = 1;
+                buf[0] = *p++;
+
+                if (buf[0] == '\\') {
+                        char e = *p++;
+                        switch (e) {
+                        case 'b': buf[0] = '\b'; break;
+                        case 'f': buf[0] = '\f'; break;
+                        case 'n': buf[0] = '\n'; break;
+                        case 'r': buf[0] = '\r'; break;
+                        case 't': buf[0] = '\t'; break;
+                        case 'u': {
+                                uint32_t c = read_hex4(p);
+                                p += 4;
+
+                                // Characters outside the BMP are escaped as
+                                // a surrogate pair.
+                                if (c >= 0xd800 && c <= 0xdbff && end - p >= 6 &&
+                                    p[0] == '\\' && p[1] == 'u') {
+                                        uint32_t low = read_hex4(p + 2);
+                                        if (low >= 0xdc00 && low <= 0xdfff) {
+                                                c = 0x10000 + ((c - 0xd800) << 10) +
+                                                    (low - 0xdc00);
+                                                p += 6;
+                                        }
+                                }
+                                n = encode_utf8(c, buf);
+                                break;
+                        }
+                        default: buf[0] = e; break;
+                        }
+                }
+
+                if (len + n >= out_size) {
+                        out[len] = '\0';
+                        return false;
+                }
+                memcpy(out + len, buf, n);
+                len += n;
+        }
+
+        out[len] = '\0';
+        return true;
+}
+
+const char* json_reader_error(const json_reader* r)
+{
+        assert(r);
+        return r->error;
+}
+
+uint32_t json_reader_line(const json_reader* r)
+{
+        assert(r);
+
+        uint32_t line = 1;
+        for (const char* p = r->data; p < r->pos; ++p) {
+                if (*p == '\n') {
+                        ++line;
+                }
+        }
+        return line;
+}
+
+static json_token fail(json_reader* r, const char* error)
+{
+        r->error = error;
+        r->token = json_token_error;
+        return r->token;
+}
+
+static void skip_space(json_reader* r)
+{
+        const char* p = r->pos;
+        const char* end = r->end;
+        while (p < end) {
+                char c = *p;
+                if (c == ' ' || c == '\n' || c == '\r' || c == '\t') {
+                        ++p;
+                        continue;
+                }
+                if (c != '/' || end - p < 2) {
+                        break;
+                }
+
+                if (p[1] == '/') {
+                        p += 2;
+                        while (p < end && *p != '\n') {
+                                ++p;
+                        }
+                } else if (p[1] == '*') {
+                        p += 2;
+                        while (end - p >= 2 && !(p[0] == '*' && p[1] == '/')) {
+                                ++p;
+                        }
+                        if (end - p < 2) {
+                                r->pos = end;
+                                fail(r, "Unterminated comment");
+                                return;
+                        }
+                        p += 2;
+                } else {
+                        break;
+                }
+        }
+        r->pos = p;
+}
+
+// Reads the value starting at the current position.
+static json_token read_value(json_reader* r)
+{
+        r->started = true;
+        r->need_comma = r->depth > 0;
+
+        switch (*r->pos) {
+        case '{':
+                r->pos++;
+                if (!push(r, true)) {
+                        return fail(r, "Nested too deeply");
+                }
+                r->need_comma = false;
+                r->expect_key = true;
+                r->token = json_token_object_begin;
+                return r->token;
+        case '[':
+                r->pos++;
+                if (!push(r, false)) {
+                        return fail(r, "Nested too deeply");
+                }
+                r->need_comma = false;
+                r->token = json_token_array_begin;
+                return r->token;
+        case '"':
+                if (!read_string(r)) {
+                        return fail(r, "Malformed string");
+                }
+                r->token = json_token_string;
+                return r->token;
+        case 't':
+                if (!read_literal(r, "true", 4)) {
+                        return fail(r, "Unknown literal");
+                }
+                r->token = json_token_true;
+                return r->token;
+        case 'f':
+                if (!read_literal(r, "false", 5)) {
+                        return fail(r, "Unknown literal");
+                }
+                r->token = json_token_false;
+                return r->token;
+        case 'n':
+                if (!read_literal(r, "null", 4)) {
+                        return fail(r, "Unknown literal");
+                }
+                r->token = json_token_null;
+                return r->token;
+        default:
+                if (!read_number(r)) {
+                        return fail(r, "Malformed value");
+                }
+                r->token = json_token_number;
+                return r->token;
+        }
+}
+
+// Points the slice at the contents of the string at the current
+// position and moves past its closing quote.
+// Returns false if the string is unterminated or has control characters
+// or bad escapes in it.
+static bool read_string(json_reader* r)
+{
+        const char* p = r->pos + 1;
+        const char* end = r->end;
+        bool escaped = false;
+        while (p < end && *p != '"') {
+                unsigned char c = (unsigned char)*p;
+                if (c < 0x20) {
+                        return false;
+                }
+                if (c != '\\') {
+                        ++p;
+                        continue;
+                }
+
+                escaped = true;
+                if (end - p < 2) {
+                        return false;
+                }
+                if (p[1] == 'u') {
+                        if (end - p < 6 || read_hex4(p + 2) > 0xffff) {
+                                return false;
+                        }
+                        p += 6;
+                } else if (strchr("\"\\/bfnrt", p[1]) && p[1] != '\0') {
+                        p += 2;
+                } else {
+                        return false;
+                }
+        }
+        if (p == end) {
+                return false;
+        }
+
+        r->slice = r->pos + 1;
+        r->slice_len = (uint32_t)(p - r->slice);
+        r->escaped = escaped;
+        r->pos = p + 1;
+        return true;
+}
+
+// Points the slice at the number at the current position and moves
+// past it.
+// Returns false if it isn't a valid JSON number.
+static bool read_number(json_reader* r)
+{
+        const char* p = r->pos;
+        const char* end = r->end;
+
+        if (p < end && *p == '-') {
+                ++p;
+        }
+        if (p == end || *p < '0' || *p > '9') {
+                return false;
+        }
+        if (*p == '0') {
+                ++p;
+        } else {
+                while (p < end && *p >= '0' && *p <= '9') {
+                        ++p;
+                }
+        }
+
+        if (p < end && *p == '.') {
+                ++p;
+                if (p == end || *p < '0' || *p > '9') {
+                        return false;
+                }
+                while (p < end && *p >= '0' && *p <= '9') {
+                        ++p;
+                }
+        }
+
+        if (p < end && (*p == 'e' || *p == 'E')) {
+                ++p;
+                if (p < end && (*p == '+' || *p == '-')) {
+                        ++p;
+                }
+                if (p == end || *p < '0' || *p > '9') {
+                        return false;
+                }
+                while (p < end && *p >= '0' && *p <= '9') {
+                        ++p;
+                }
+        }
+
+        if (p - r->pos > MAX_NUMBER_LEN) {
+                return false;
+        }
+
+        r->slice = r->pos;
+        r->slice_len = (uint32_t)(p - r->pos);
+        r->pos = p;
+        return true;
+}
+
+static bool read_literal(json_reader* r, const char* literal, uint32_t len)
+{
+        if ((size_t)(r->end - r->pos) < len ||
+            memcmp(r->pos, literal, len) != 0) {
+                return false;
+        }
+
+        r->pos += len;
+        return true;
+}
+
+// Enters an object or array.
+// Returns false if it is nested too deeply.
+static bool push(json_reader* r, bool object)
+{
+        if (r->depth == JSON_READER_MAX_DEPTH) {
+                return false;
+        }
+
+        uint64_t bit = (uint64_t)1 << r->depth;
+        r->object_bits = object ? r->object_bits | bit : r->object_bits & ~bit;
+        r->depth++;
+        return true;
+}
+
+static bool in_object(const json_reader* r)
+{
+        return r->depth > 0 &&
+               (r->object_bits & ((uint64_t)1 << (r->depth - 1))) != 0;
+}
+
+// Returns the value of the 4 hex digits at p or a value above 0xffff if
+// they aren't all hex digits.
+static uint32_t read_hex4(const char* p)
+{
+        uint32_t value = 0;
+        for (int i = 0; i < 4; ++i) {
+                char c = p[i];
+                value <<= 4;
+                if (c >= '0' && c <= '9') {
+                        value |= c - '0';
+                } else if (c >= 'a' && c <= 'f') {
+                        value |= c - 'a' + 10;
+                } else if (c >= 'A' && c <= 'F') {
+                        value |= c - 'A' + 10;
+                } else {
+                        return 0x10000;
+                }
+        }
+        return value;
+}
+
+// Writes the character to out as UTF-8.
+// Returns the number of bytes written.
+static size_t encode_utf8(uint32_t c, char* out)
+{
+        if (c < 0x80) {
+                out[0] = (char)c;
+                return 1;
+        }
+        if (c < 0x800) {
+                out[0] = (char)(0xc0 | (c >> 6));
+                out[1] = (char)(0x80 | (c & 0x3f));
+                return 2;
+        }
+        if (c < 0x10000) {
+                out[0] = (char)(0xe0 | (c >> 12));
+                out[1] = (char)(0x80 | ((c >> 6) & 0x3f));
+                out[2] = (char)(0x80 | (c & 0x3f));
+                return 3;
+        }
+        out[0] = (char)(0xf0 | (c >> 18));
+        out[1] = (char)(0x80 | ((c >> 12) & 0x3f));
+        out[2] = (char)(0x80 | ((c >> 6) & 0x3f));
+        out[3] = (char)(0x80 | (c & 0x3f));
+        return 4;
+}
\ No newline at end of file
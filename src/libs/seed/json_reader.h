@@ -0,0 +1,87 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+// Objects and arrays can be nested this deep.
+#define JSON_READER_MAX_DEPTH 64
+
+typedef enum {
+        json_token_error,
+        json_token_end, // The end of the document.
+        json_token_object_begin,
+        json_token_object_end,
+        json_token_array_begin,
+        json_token_array_end,
+        json_token_key,
+        json_token_string,
+        json_token_number,
+        json_token_true,
+        json_token_false,
+        json_token_null
+} json_token;
+
+// A pull parser that walks a JSON document in place, returning one
+// token at a time without allocating or building a tree. Keys, strings
+// and numbers are returned as slices of the document, so callers can
+// compare or convert them as they go and stream values straight into
+// their own arrays.
+// Comments in the style of /* */ and // are skipped like whitespace to
+// match json_parse_file_with_comments.
+typedef struct json_reader {
+        const char* data;
+        const char* pos;
+        const char* end;
+
+        json_token token;
+        const char* slice; // Key, string or number of the current token.
+        uint32_t slice_len;
+        bool escaped; // The string slice contains escape sequences.
+
+        uint32_t depth;
+        uint64_t object_bits; // Bit per depth, set for objects.
+        bool need_comma;
+        bool expect_key;
+        bool expect_value; // A key has been read but not its value.
+        bool started;
+
+        const char* error;
+} json_reader;
+
+// Starts reading the document of size bytes at data, which doesn't
+// have to be null terminated and must stay valid while it is read.
+void json_reader_init(json_reader*, const char* data, size_t size);
+
+// Reads the next token. Objects give a json_token_key before each of
+// their values.
+// Returns json_token_error if the document is malformed, after which
+// json_reader_error describes what went wrong.
+json_token json_reader_next(json_reader*);
+
+// Skips the value whose first token was just read, so if it began an
+// object or array reads up to and including its end.
+// Returns false if the document is malformed.
+bool json_reader_skip(json_reader*);
+
+// Returns true if the current token is a key or string equal to str.
+bool json_reader_is(const json_reader*, const char* str);
+
+// Returns the value of the current number token, or 0.0 if it isn't one.
+double json_reader_number(const json_reader*);
+
+// Returns the value of the current number token truncated to an
+// integer, or 0 if it isn't one.
+int32_t json_reader_int(const json_reader*);
+
+// Copies the current key or string token into out with escape sequences
+// decoded, truncating it to fit out_size including the null terminator.
+// Returns false if the token isn't a key or string or was truncated.
+bool json_reader_copy_string(const json_reader*, char* out, size_t out_size);
+
+// Returns a description of the error that stopped reading, or NULL.
+const char* json_reader_error(const json_reader*);
+
+// Returns the line the reader is on, counting from 1. Counts the lines
+// from the start each time so is meant for error messages.
+uint32_t json_reader_line(const json_reader*);
\ No newline at end of file
@@ -22,12 +22,34 @@
 */
 
 #include "parson.h"
+#include "arena.h"
 
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ctype.h>
 
+/* Define PARSON_NO_SIMD to force the scalar scanners, for example to
+   compare the two. AddressSanitizer builds always use them as the SIMD
+   scanners read whole 16 byte blocks, past the end of the string. */
+#if defined(__SANITIZE_ADDRESS__) && !defined(PARSON_NO_SIMD)
+#define PARSON_NO_SIMD
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer) && !defined(PARSON_NO_SIMD)
+#define PARSON_NO_SIMD
+#endif
+#endif
+
+#if !defined(PARSON_NO_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define PARSON_SSE2
+#include <emmintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
 #define ERROR                      0
 #define SUCCESS                    1
 #define STARTING_CAPACITY         15
@@ -36,7 +58,8 @@
 #define MAX_NESTING               19
 #define sizeof_token(a)       (sizeof(a) - 1)
 #define skip_char(str)        ((*str)++)
-#define skip_whitespaces(str) while (isspace(**str)) { skip_char(str); }
+#define skip_whitespaces(str) (*(str) += scan_whitespaces(*(str)))
+#define is_space(c)           ((c) == ' ' || ((c) >= '\t' && (c) <= '\r'))
 #define MAX(a, b)             ((a) > (b) ? (a) : (b))
 
 #define parson_malloc(a)     malloc(a)
@@ -55,6 +78,7 @@ typedef union json_value_value {
 
 struct json_value_t {
     JSON_Value_Type     type;
+    int                 in_arena; /* freed with its arena, not json_value_free */
     JSON_Value_Value    value;
 };
 
@@ -74,53 +98,87 @@ struct json_array_t {
 /* Various */
 static char * read_file(const char *filename);
 static void   remove_comments(char *string, const char *start_token, const char *end_token);
-static int    try_realloc(void **ptr, size_t new_size);
+static int    try_realloc(void **ptr, size_t old_size, size_t new_size, arena *arena);
+static void * parson_alloc(size_t size, arena *arena);
+static void   parson_release(const void *ptr, arena *arena);
 static char * parson_strndup(const char *string, size_t n);
 static int    is_utf(const unsigned char *string);
 static int    is_decimal(const char *string, size_t length);
+static size_t scan_whitespaces(const char *string);
+static size_t scan_plain_chars(const char *string);
+#ifdef PARSON_SSE2
+static int    first_bit(unsigned int mask);
+#endif
 
 /* JSON Object */
-static JSON_Object * json_object_init(void);
-static int           json_object_add(JSON_Object *object, const char *name, JSON_Value *value);
-static int           json_object_resize(JSON_Object *object, size_t capacity);
+static JSON_Object * json_object_init(arena *arena);
+static int           json_object_add(JSON_Object *object, const char *name, JSON_Value *value, arena *arena);
+static int           json_object_resize(JSON_Object *object, size_t capacity, arena *arena);
 static JSON_Value  * json_object_nget_value(const JSON_Object *object, const char *name, size_t n);
 static void          json_object_free(JSON_Object *object);
 
 /* JSON Array */
-static JSON_Array * json_array_init(void);
-static int          json_array_add(JSON_Array *array, JSON_Value *value);
-static int          json_array_resize(JSON_Array *array, size_t capacity);
+static JSON_Array * json_array_init(arena *arena);
+static int          json_array_add(JSON_Array *array, JSON_Value *value, arena *arena);
+static int          json_array_resize(JSON_Array *array, size_t capacity, arena *arena);
 static void         json_array_free(JSON_Array *array);
 
 /* JSON Value */
-static JSON_Value * json_value_init_object(void);
-static JSON_Value * json_value_init_array(void);
+static JSON_Value * json_value_alloc(JSON_Value_Type type, arena *arena);
+static JSON_Value * json_value_init_object(arena *arena);
+static JSON_Value * json_value_init_array(arena *arena);
 static JSON_Value * json_value_init_string(const char *string);
-static JSON_Value * json_value_init_number(double number);
-static JSON_Value * json_value_init_boolean(int boolean);
-static JSON_Value * json_value_init_null(void);
+static JSON_Value * json_value_init_number(double number, arena *arena);
+static JSON_Value * json_value_init_boolean(int boolean, arena *arena);
+static JSON_Value * json_value_init_null(arena *arena);
 
 /* Parser */
-static void         skip_quotes(const char **string);
+static int          skip_quotes(const char **string);
 static int          parse_utf_16(char **processed, char **unprocessed);
+static int          process_string(char *output);
 static const char * get_processed_string(const char **string);
-static JSON_Value * parse_object_value(const char **string, size_t nesting);
-static JSON_Value * parse_array_value(const char **string, size_t nesting);
-static JSON_Value * parse_string_value(const char **string);
-static JSON_Value * parse_boolean_value(const char **string);
-static JSON_Value * parse_number_value(const char **string);
-static JSON_Value * parse_null_value(const char **string);
-static JSON_Value * parse_value(const char **string, size_t nesting);
+static char       * get_arena_string(const char **string, size_t offset, arena *arena);
+static JSON_Value * parse_object_value(const char **string, size_t nesting, arena *arena);
+static JSON_Value * parse_array_value(const char **string, size_t nesting, arena *arena);
+static JSON_Value * parse_string_value(const char **string, arena *arena);
+static JSON_Value * parse_boolean_value(const char **string, arena *arena);
+static int          parse_simple_number(const char **string, double *number);
+static JSON_Value * parse_number_value(const char **string, arena *arena);
+static JSON_Value * parse_null_value(const char **string, arena *arena);
+static JSON_Value * parse_value(const char **string, size_t nesting, arena *arena);
 
 /* Various */
-static int try_realloc(void **ptr, size_t new_size) {
-    void *reallocated_ptr = parson_realloc(*ptr, new_size);
+/* Arena memory can't be resized so growing it allocates a new block and
+   copies old_size bytes across, and shrinking it does nothing. */
+static int try_realloc(void **ptr, size_t old_size, size_t new_size, arena *arena) {
+    void *reallocated_ptr;
+    if (arena) {
+        if (new_size <= old_size)
+            return SUCCESS;
+        reallocated_ptr = arena_alloc(arena, new_size);
+        if (!reallocated_ptr)
+            return ERROR;
+        if (old_size)
+            memcpy(reallocated_ptr, *ptr, old_size);
+        *ptr = reallocated_ptr;
+        return SUCCESS;
+    }
+    reallocated_ptr = parson_realloc(*ptr, new_size);
     if (!reallocated_ptr)
         return ERROR;
     *ptr = reallocated_ptr;
     return SUCCESS;
 }
 
+static void * parson_alloc(size_t size, arena *arena) {
+    return arena ? arena_alloc(arena, size) : parson_malloc(size);
+}
+
+static void parson_release(const void *ptr, arena *arena) {
+    if (!arena)
+        parson_free(ptr);
+}
+
 static char * parson_strndup(const char *string, size_t n) {
     char *output_string = (char*)parson_malloc(n + 1);
     if (!output_string)
@@ -145,6 +203,87 @@ static int is_decimal(const char *string, size_t length) {
     return 1;
 }
 
+/* The SIMD scanners below use aligned loads, which can't cross into
+   another page, and always stop at the null terminator, so they never
+   read past the end of the 16 bytes holding it. That is still past the
+   end of the allocation, which AddressSanitizer reports, so its builds
+   use the scalar scanners instead. */
+
+/* Returns the number of whitespace characters at the start of string,
+   matching isspace in the C locale. */
+static size_t scan_whitespaces(const char *string) {
+#ifdef PARSON_SSE2
+    const char *block;
+    __m128i chars, spaces;
+    unsigned int mask;
+#endif
+    /* Most values are separated by a single space or none at all */
+    if (!is_space(*string))
+        return 0;
+#ifdef PARSON_SSE2
+    block = string - ((size_t)string & 15);
+    for (;;) {
+        chars = _mm_load_si128((const __m128i*)block);
+        spaces = _mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8(' ')),
+                              _mm_and_si128(_mm_cmpgt_epi8(chars, _mm_set1_epi8('\t' - 1)),
+                                            _mm_cmplt_epi8(chars, _mm_set1_epi8('\r' + 1))));
+        mask = ~_mm_movemask_epi8(spaces) & 0xffff;
+        if (block < string)
+            mask &= 0xffff << (string - block);
+        if (mask)
+            return block + first_bit(mask) - string;
+        block += 16;
+    }
+#else
+    {
+        const char *ptr = string + 1;
+        while (is_space(*ptr))
+            ptr++;
+        return ptr - string;
+    }
+#endif
+}
+
+/* Returns the number of characters at the start of string before a quote,
+   backslash, control character or the null terminator. */
+static size_t scan_plain_chars(const char *string) {
+#ifdef PARSON_SSE2
+    const char *block = string - ((size_t)string & 15);
+    __m128i chars, stops;
+    unsigned int mask;
+    for (;;) {
+        chars = _mm_load_si128((const __m128i*)block);
+        stops = _mm_or_si128(_mm_or_si128(_mm_cmpeq_epi8(chars, _mm_set1_epi8('\"')),
+                                          _mm_cmpeq_epi8(chars, _mm_set1_epi8('\\'))),
+                             /* Unsigned chars <= 0x1F */
+                             _mm_cmpeq_epi8(_mm_min_epu8(chars, _mm_set1_epi8(0x1F)), chars));
+        mask = _mm_movemask_epi8(stops);
+        if (block < string)
+            mask &= 0xffff << (string - block);
+        if (mask)
+            return block + first_bit(mask) - string;
+        block += 16;
+    }
+#else
+    const char *ptr = string;
+    while (*ptr != '\"' && *ptr != '\\' && (unsigned char)*ptr >= 0x20)
+        ptr++;
+    return ptr - string;
+#endif
+}
+
+#ifdef PARSON_SSE2
+static int first_bit(unsigned int mask) {
+#ifdef _MSC_VER
+    unsigned long index;
+    _BitScanForward(&index, mask);
+    return (int)index;
+#else
+    return __builtin_ctz(mask);
+#endif
+}
+#endif
+
 static char * read_file(const char * filename) {
     FILE *fp = fopen(filename, "r");
     size_t file_size;
@@ -203,8 +342,8 @@ static void remove_comments(char *string, const char *start_token, const char *e
 }
 
 /* JSON Object */
-static JSON_Object * json_object_init(void) {
-    JSON_Object *new_obj = (JSON_Object*)parson_malloc(sizeof(JSON_Object));
+static JSON_Object * json_object_init(arena *arena) {
+    JSON_Object *new_obj = (JSON_Object*)parson_alloc(sizeof(JSON_Object), arena);
     if (!new_obj)
         return NULL;
     new_obj->names = (const char**)NULL;
@@ -214,19 +353,21 @@ static JSON_Object * json_object_init(void) {
     return new_obj;
 }
 
-static int json_object_add(JSON_Object *object, const char *name, JSON_Value *value) {
+/* Names are copied unless the object is in an arena, in which case the
+   name must already be in the same arena. */
+static int json_object_add(JSON_Object *object, const char *name, JSON_Value *value, arena *arena) {
     size_t index;
     if (object->count >= object->capacity) {
         size_t new_capacity = MAX(object->capacity * 2, STARTING_CAPACITY);
         if (new_capacity > OBJECT_MAX_CAPACITY)
             return ERROR;
-        if (json_object_resize(object, new_capacity) == ERROR)
+        if (json_object_resize(object, new_capacity, arena) == ERROR)
             return ERROR;
     }
     if (json_object_get_value(object, name) != NULL)
         return ERROR;
     index = object->count;
-    object->names[index] = parson_strndup(name, strlen(name));
+    object->names[index] = arena ? name : parson_strndup(name, strlen(name));
     if (!object->names[index])
         return ERROR;
     object->values[index] = value;
@@ -234,10 +375,12 @@ static int json_object_add(JSON_Object *object, const char *name, JSON_Value *va
     return SUCCESS;
 }
 
-static int json_object_resize(JSON_Object *object, size_t capacity) {
-    if (try_realloc((void**)&object->names, capacity * sizeof(char*)) == ERROR)
+static int json_object_resize(JSON_Object *object, size_t capacity, arena *arena) {
+    if (try_realloc((void**)&object->names, object->count * sizeof(char*),
+                    capacity * sizeof(char*), arena) == ERROR)
         return ERROR;
-    if (try_realloc((void**)&object->values, capacity * sizeof(JSON_Value*)) == ERROR)
+    if (try_realloc((void**)&object->values, object->count * sizeof(JSON_Value*),
+                    capacity * sizeof(JSON_Value*), arena) == ERROR)
         return ERROR;
     object->capacity = capacity;
     return SUCCESS;
@@ -266,8 +409,8 @@ static void json_object_free(JSON_Object *object) {
 }
 
 /* JSON Array */
-static JSON_Array * json_array_init(void) {
-    JSON_Array *new_array = (JSON_Array*)parson_malloc(sizeof(JSON_Array));
+static JSON_Array * json_array_init(arena *arena) {
+    JSON_Array *new_array = (JSON_Array*)parson_alloc(sizeof(JSON_Array), arena);
     if (!new_array)
         return NULL;
     new_array->items = (JSON_Value**)NULL;
@@ -276,12 +419,12 @@ static JSON_Array * json_array_init(void) {
     return new_array;
 }
 
-static int json_array_add(JSON_Array *array, JSON_Value *value) {
+static int json_array_add(JSON_Array *array, JSON_Value *value, arena *arena) {
     if (array->count >= array->capacity) {
         size_t new_capacity = MAX(array->capacity * 2, STARTING_CAPACITY);
         if (new_capacity > ARRAY_MAX_CAPACITY)
             return ERROR;
-        if (!json_array_resize(array, new_capacity))
+        if (!json_array_resize(array, new_capacity, arena))
             return ERROR;
     }
     array->items[array->count] = value;
@@ -289,8 +432,9 @@ static int json_array_add(JSON_Array *array, JSON_Value *value) {
     return SUCCESS;
 }
 
-static int json_array_resize(JSON_Array *array, size_t capacity) {
-    if (try_realloc((void**)&array->items, capacity * sizeof(JSON_Value*)) == ERROR)
+static int json_array_resize(JSON_Array *array, size_t capacity, arena *arena) {
+    if (try_realloc((void**)&array->items, array->count * sizeof(JSON_Value*),
+                    capacity * sizeof(JSON_Value*), arena) == ERROR)
         return ERROR;
     array->capacity = capacity;
     return SUCCESS;
@@ -304,81 +448,89 @@ static void json_array_free(JSON_Array *array) {
 }
 
 /* JSON Value */
-static JSON_Value * json_value_init_object(void) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+static JSON_Value * json_value_alloc(JSON_Value_Type type, arena *arena) {
+    JSON_Value *new_value = (JSON_Value*)parson_alloc(sizeof(JSON_Value), arena);
+    if (!new_value)
+        return NULL;
+    new_value->type = type;
+    new_value->in_arena = arena != NULL;
+    return new_value;
+}
+
+static JSON_Value * json_value_init_object(arena *arena) {
+    JSON_Value *new_value = json_value_alloc(JSONObject, arena);
     if (!new_value)
         return NULL;
-    new_value->type = JSONObject;
-    new_value->value.object = json_object_init();
+    new_value->value.object = json_object_init(arena);
     if (!new_value->value.object) {
-        parson_free(new_value);
+        parson_release(new_value, arena);
         return NULL;
     }
     return new_value;
 }
 
-static JSON_Value * json_value_init_array(void) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+static JSON_Value * json_value_init_array(arena *arena) {
+    JSON_Value *new_value = json_value_alloc(JSONArray, arena);
     if (!new_value)
         return NULL;
-    new_value->type = JSONArray;
-    new_value->value.array = json_array_init();
+    new_value->value.array = json_array_init(arena);
     if (!new_value->value.array) {
-        parson_free(new_value);
+        parson_release(new_value, arena);
         return NULL;
     }
     return new_value;
 }
 
 static JSON_Value * json_value_init_string(const char *string) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+    JSON_Value *new_value = json_value_alloc(JSONString, NULL);
     if (!new_value)
         return NULL;
-    new_value->type = JSONString;
     new_value->value.string = string;
     return new_value;
 }
 
-static JSON_Value * json_value_init_number(double number) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+static JSON_Value * json_value_init_number(double number, arena *arena) {
+    JSON_Value *new_value = json_value_alloc(JSONNumber, arena);
     if (!new_value)
         return NULL;
-    new_value->type = JSONNumber;
     new_value->value.number = number;
     return new_value;
 }
 
-static JSON_Value * json_value_init_boolean(int boolean) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
+static JSON_Value * json_value_init_boolean(int boolean, arena *arena) {
+    JSON_Value *new_value = json_value_alloc(JSONBoolean, arena);
     if (!new_value)
         return NULL;
-    new_value->type = JSONBoolean;
     new_value->value.boolean = boolean;
     return new_value;
 }
 
-static JSON_Value * json_value_init_null(void) {
-    JSON_Value *new_value = (JSON_Value*)parson_malloc(sizeof(JSON_Value));
-    if (!new_value)
-        return NULL;
-    new_value->type = JSONNull;
-    return new_value;
+static JSON_Value * json_value_init_null(arena *arena) {
+    return json_value_alloc(JSONNull, arena);
 }
 
 /* Parser */
-static void skip_quotes(const char **string) {
+/* Returns SUCCESS if the string has no escapes or control characters, so
+   its contents can be used as they are. */
+static int skip_quotes(const char **string) {
+    int plain = SUCCESS;
     skip_char(string);
-    while (**string != '\"') {
+    for (;;) {
+        *string += scan_plain_chars(*string);
+        if (**string == '\"')
+            break;
         if (**string == '\0')
-            return;
+            return ERROR;
+        plain = ERROR;
         if (**string == '\\') {
             skip_char(string);
             if (**string == '\0')
-                return;
+                return ERROR;
         }
         skip_char(string);
     }
     skip_char(string);
+    return plain;
 }
 
 static int parse_utf_16(char **processed, char **unprocessed) {
@@ -420,19 +572,10 @@ static int parse_utf_16(char **processed, char **unprocessed) {
     return SUCCESS;
 }
 
-/* Returns contents of a string inside double quotes and parses escaped
- characters inside.
- Example: "\u006Corem ipsum" -> lorem ipsum */
-static const char * get_processed_string(const char **string) {
-    const char *string_start = *string;
-    char *output = NULL, *processed_ptr = NULL, *unprocessed_ptr = NULL;
-    skip_quotes(string);
-    if (**string == '\0')
-        return NULL;
-    output = parson_strndup(string_start + 1, *string - string_start - 2);
-    if (!output)
-        return NULL;
-    processed_ptr = unprocessed_ptr = output;
+/* Parses the escaped characters in the null terminated output in place.
+ Example: \u006Corem ipsum -> lorem ipsum */
+static int process_string(char *output) {
+    char *processed_ptr = output, *unprocessed_ptr = output;
     while (*unprocessed_ptr != '\0') {
         if (*unprocessed_ptr == '\\') {
             unprocessed_ptr++;
@@ -446,19 +589,15 @@ static const char * get_processed_string(const char **string) {
                 case 'r':  *processed_ptr = '\r'; break;
                 case 't':  *processed_ptr = '\t'; break;
                 case 'u':
-                    if (parse_utf_16(&processed_ptr, &unprocessed_ptr) == ERROR) {
-                        parson_free(output);
-                        return NULL;
-                    }
+                    if (parse_utf_16(&processed_ptr, &unprocessed_ptr) == ERROR)
+                        return ERROR;
                     break;
                 default:
-                    parson_free(output);
-                    return NULL;
+                    return ERROR;
                     break;
             }
         } else if ((unsigned char)*unprocessed_ptr < 0x20) {
-            parson_free(output); /* 0x00-0x19 are invalid characters for json string (http://www.ietf.org/rfc/rfc4627.txt) */
-            return NULL;
+            return ERROR; /* 0x00-0x19 are invalid characters for json string (http://www.ietf.org/rfc/rfc4627.txt) */
         } else {
             *processed_ptr = *unprocessed_ptr;
         }
@@ -466,37 +605,79 @@ static const char * get_processed_string(const char **string) {
         unprocessed_ptr++;
     }
     *processed_ptr = '\0';
-    if (try_realloc((void**)&output, strlen(output) + 1) == ERROR)
+    return SUCCESS;
+}
+
+/* Returns contents of a string inside double quotes and parses escaped
+ characters inside.
+ Example: "\u006Corem ipsum" -> lorem ipsum */
+static const char * get_processed_string(const char **string) {
+    const char *string_start = *string;
+    char *output = NULL;
+    size_t length;
+    int plain = skip_quotes(string);
+    if (**string == '\0')
+        return NULL;
+    length = *string - string_start - 2;
+    output = parson_strndup(string_start + 1, length);
+    if (!output || plain)
+        return output;
+    if (process_string(output) == ERROR) {
+        parson_free(output);
+        return NULL;
+    }
+    if (try_realloc((void**)&output, length + 1, strlen(output) + 1, NULL) == ERROR)
         return NULL;
     return output;
 }
 
-static JSON_Value * parse_value(const char **string, size_t nesting) {
+/* Like get_processed_string but the string is copied offset bytes into a
+ single arena allocation, so whatever owns it can share the allocation. */
+static char * get_arena_string(const char **string, size_t offset, arena *arena) {
+    const char *string_start = *string;
+    char *output = NULL;
+    size_t length;
+    int plain = skip_quotes(string);
+    if (**string == '\0')
+        return NULL;
+    length = *string - string_start - 2;
+    output = (char*)arena_alloc(arena, offset + length + 1);
+    if (!output)
+        return NULL;
+    output += offset;
+    memcpy(output, string_start + 1, length);
+    output[length] = '\0';
+    if (plain)
+        return output;
+    return process_string(output) == ERROR ? NULL : output;
+}
+
+static JSON_Value * parse_value(const char **string, size_t nesting, arena *arena) {
     if (nesting > MAX_NESTING)
         return NULL;
     skip_whitespaces(string);
     switch (**string) {
         case '{':
-            return parse_object_value(string, nesting + 1);
+            return parse_object_value(string, nesting + 1, arena);
         case '[':
-            return parse_array_value(string, nesting + 1);
+            return parse_array_value(string, nesting + 1, arena);
         case '\"':
-            return parse_string_value(string);
+            return parse_string_value(string, arena);
         case 'f': case 't':
-            return parse_boolean_value(string);
+            return parse_boolean_value(string, arena);
         case '-':
         case '0': case '1': case '2': case '3': case '4':
         case '5': case '6': case '7': case '8': case '9':
-            return parse_number_value(string);
+            return parse_number_value(string, arena);
         case 'n':
-            return parse_null_value(string);
+            return parse_null_value(string, arena);
         default:
             return NULL;
     }
 }
 
-static JSON_Value * parse_object_value(const char **string, size_t nesting) {
-    JSON_Value *output_value = json_value_init_object(), *new_value = NULL;
+static JSON_Value * parse_object_value(const char **string, size_t nesting, arena *arena) {
+    JSON_Value *output_value = json_value_init_object(arena), *new_value = NULL;
     JSON_Object *output_object = json_value_get_object(output_value);
     const char *new_key = NULL;
     if (!output_value)
@@ -508,26 +689,26 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
         return output_value;
     }
     while (**string != '\0') {
-        new_key = get_processed_string(string);
+        new_key = arena ? get_arena_string(string, 0, arena) : get_processed_string(string);
         skip_whitespaces(string);
         if (!new_key || **string != ':') {
             json_value_free(output_value);
             return NULL;
         }
         skip_char(string);
-        new_value = parse_value(string, nesting);
+        new_value = parse_value(string, nesting, arena);
         if (!new_value) {
-            parson_free(new_key);
+            parson_release(new_key, arena);
             json_value_free(output_value);
             return NULL;
         }
-        if(!json_object_add(output_object, new_key, new_value)) {
-            parson_free(new_key);
-            parson_free(new_value);
+        if(!json_object_add(output_object, new_key, new_value, arena)) {
+            parson_release(new_key, arena);
+            parson_release(new_value, arena);
             json_value_free(output_value);
             return NULL;
         }
-        parson_free(new_key);
+        parson_release(new_key, arena);
         skip_whitespaces(string);
         if (**string != ',')
             break;
@@ -536,7 +717,7 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
     }
     skip_whitespaces(string);
     if (**string != '}' || /* Trim object after parsing is over */
-         json_object_resize(output_object, json_object_get_count(output_object)) == ERROR) {
+         json_object_resize(output_object, json_object_get_count(output_object), arena) == ERROR) {
         json_value_free(output_value);
         return NULL;
     }
@@ -544,8 +725,8 @@ static JSON_Value * parse_object_value(const char **string, size_t nesting) {
     return output_value;
 }
 
-static JSON_Value * parse_array_value(const char **string, size_t nesting) {
-    JSON_Value *output_value = json_value_init_array(), *new_array_value = NULL;
+static JSON_Value * parse_array_value(const char **string, size_t nesting, arena *arena) {
+    JSON_Value *output_value = json_value_init_array(arena), *new_array_value = NULL;
     JSON_Array *output_array = json_value_get_array(output_value);
     if (!output_value)
         return NULL;
@@ -556,13 +737,13 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
         return output_value;
     }
     while (**string != '\0') {
-        new_array_value = parse_value(string, nesting);
+        new_array_value = parse_value(string, nesting, arena);
         if (!new_array_value) {
             json_value_free(output_value);
             return NULL;
         }
-        if(json_array_add(output_array, new_array_value) == ERROR) {
-            parson_free(new_array_value);
+        if(json_array_add(output_array, new_array_value, arena) == ERROR) {
+            parson_release(new_array_value, arena);
             json_value_free(output_value);
             return NULL;
         }
@@ -574,7 +755,7 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
     }
     skip_whitespaces(string);
     if (**string != ']' || /* Trim array after parsing is over */
-         json_array_resize(output_array, json_array_get_count(output_array)) == ERROR) {
+         json_array_resize(output_array, json_array_get_count(output_array), arena) == ERROR) {
         json_value_free(output_value);
         return NULL;
     }
@@ -582,44 +763,106 @@ static JSON_Value * parse_array_value(const char **string, size_t nesting) {
     return output_value;
 }
 
-static JSON_Value * parse_string_value(const char **string) {
-    const char *new_string = get_processed_string(string);
+static JSON_Value * parse_string_value(const char **string, arena *arena) {
+    const char *new_string = NULL;
+    JSON_Value *output_value = NULL;
+    if (arena) { /* Store the string inline after its value */
+        new_string = get_arena_string(string, sizeof(JSON_Value), arena);
+        if (!new_string)
+            return NULL;
+        output_value = (JSON_Value*)(new_string - sizeof(JSON_Value));
+        output_value->type = JSONString;
+        output_value->in_arena = 1;
+        output_value->value.string = new_string;
+        return output_value;
+    }
+    new_string = get_processed_string(string);
     if (!new_string)
         return NULL;
-    return json_value_init_string(new_string);
+    output_value = json_value_init_string(new_string);
+    if (!output_value)
+        parson_free(new_string);
+    return output_value;
 }
 
-static JSON_Value * parse_boolean_value(const char **string) {
+static JSON_Value * parse_boolean_value(const char **string, arena *arena) {
     size_t true_token_size = sizeof_token("true");
     size_t false_token_size = sizeof_token("false");
     if (strncmp("true", *string, true_token_size) == 0) {
         *string += true_token_size;
-        return json_value_init_boolean(1);
+        return json_value_init_boolean(1, arena);
     } else if (strncmp("false", *string, false_token_size) == 0) {
         *string += false_token_size;
-        return json_value_init_boolean(0);
+        return json_value_init_boolean(0, arena);
     }
     return NULL;
 }
 
-static JSON_Value * parse_number_value(const char **string) {
+/* Parses numbers of at most 15 digits with an optional fraction, which
+   is most of them, without strtod. These are exact in a double and so is
+   dividing them by a power of ten, so the result is the same.
+   Returns ERROR if the number needs strtod. */
+static int parse_simple_number(const char **string, double *number) {
+    static const double powers_of_ten[] = {
+        1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7,
+        1e8, 1e9, 1e10, 1e11, 1e12, 1e13, 1e14, 1e15
+    };
+    const char *ptr = *string;
+    unsigned long long mantissa = 0;
+    int negative = 0, digits = 0, decimals = 0;
+    if (*ptr == '-') {
+        negative = 1;
+        ptr++;
+    }
+    if (*ptr == '0' && ptr[1] >= '0' && ptr[1] <= '9')
+        return ERROR;
+    while (*ptr >= '0' && *ptr <= '9') {
+        mantissa = mantissa * 10 + (*ptr - '0');
+        digits++;
+        ptr++;
+    }
+    if (digits == 0)
+        return ERROR;
+    if (*ptr == '.') {
+        ptr++;
+        while (*ptr >= '0' && *ptr <= '9') {
+            mantissa = mantissa * 10 + (*ptr - '0');
+            decimals++;
+            ptr++;
+        }
+        if (decimals == 0)
+            return ERROR;
+    }
+    if (digits + decimals > 15 || (*ptr != '\0' && strchr(".eExX", *ptr)))
+        return ERROR;
+    *number = (double)mantissa / powers_of_ten[decimals];
+    if (negative)
+        *number = -*number;
+    *string = ptr;
+    return SUCCESS;
+}
+
+static JSON_Value * parse_number_value(const char **string, arena *arena) {
     char *end;
-    double number = strtod(*string, &end);
+    double number;
     JSON_Value *output_value;
+    if (parse_simple_number(string, &number) == SUCCESS)
+        return json_value_init_number(number, arena);
+    number = strtod(*string, &end);
     if (is_decimal(*string, end - *string)) {
         *string = end;
-        output_value = json_value_init_number(number);
+        output_value = json_value_init_number(number, arena);
     } else {
         output_value = NULL;
     }
     return output_value;
 }
 
-static JSON_Value * parse_null_value(const char **string) {
+static JSON_Value * parse_null_value(const char **string, arena *arena) {
     size_t token_size = sizeof_token("null");
     if (strncmp("null", *string, token_size) == 0) {
         *string += token_size;
-        return json_value_init_null();
+        return json_value_init_null(arena);
     }
     return NULL;
 }
@@ -651,7 +894,7 @@ JSON_Value * json_parse_string(const char *string) {
     skip_whitespaces(&string);
     if (*string != '{' && *string != '[')
         return NULL;
-    return parse_value((const char**)&string, 0);
+    return parse_value((const char**)&string, 0, NULL);
 }
 
 JSON_Value * json_parse_string_with_comments(const char *string) {
@@ -668,11 +911,29 @@ JSON_Value * json_parse_string_with_comments(const char *string) {
         parson_free(string_mutable_copy);
         return NULL;
     }
-    result = parse_value((const char**)&string_mutable_copy_ptr, 0);
+    result = parse_value((const char**)&string_mutable_copy_ptr, 0, NULL);
     parson_free(string_mutable_copy);
     return result;
 }
 
+JSON_Value * json_parse_file_arena(const char *filename, arena *arena) {
+    char *file_contents = read_file(filename);
+    JSON_Value *output_value = NULL;
+    if (!file_contents)
+        return NULL;
+    output_value = json_parse_string_arena(file_contents, arena);
+    parson_free(file_contents);
+    return output_value;
+}
+
+JSON_Value * json_parse_string_arena(const char *string, arena *arena) {
+    if (!string || !arena)
+        return NULL;
+    skip_whitespaces(&string);
+    if (*string != '{' && *string != '[')
+        return NULL;
+    return parse_value((const char**)&string, 0, arena);
+}
 
 /* JSON Object API */
 
@@ -795,6 +1056,8 @@ int json_value_get_boolean(const JSON_Value *value) {
 }
 
 void json_value_free(JSON_Value *value) {
+    if (value && value->in_arena)
+        return;
     switch (json_value_get_type(value)) {
         case JSONObject:
             json_object_free(value->value.object);
@@ -32,6 +32,7 @@ extern "C"
 #include <stddef.h>   /* size_t */    
     
 /* Types and enums */
+struct arena;
 typedef struct json_object_t JSON_Object;
 typedef struct json_array_t  JSON_Array;
 typedef struct json_value_t  JSON_Value;
@@ -60,6 +61,17 @@ JSON_Value  * json_parse_string(const char *string);
 /*  Parses first JSON value in a string and ignores comments (/ * * / and //),
     returns NULL in case of error */
 JSON_Value  * json_parse_string_with_comments(const char *string);
+
+/* Parses like json_parse_file but allocates every value, object, array
+   and string from the arena, with strings stored after their value. The
+   whole document is freed at once by resetting or freeing the arena and
+   json_value_free does nothing to it. Returns NULL in case of error,
+   leaving whatever was allocated in the arena. */
+JSON_Value  * json_parse_file_arena(const char *filename, struct arena *arena);
+
+/*  Parses first JSON value in a string into the arena like
+    json_parse_file_arena, returns NULL in case of error */
+JSON_Value  * json_parse_string_arena(const char *string, struct arena *arena);
     
 /* JSON Object */
 JSON_Value  * json_object_get_value  (const JSON_Object *object, const char *name);
@@ -0,0 +1,34 @@
+#include "atomic.h"
+
+#ifdef _WIN32
+
+#include <assert.h>
+
+#include <Windows.h>
+
+int32_t atomic_load_i32(volatile int32_t* p)
+{
+        assert(p);
+        return InterlockedCompareExchange((volatile LONG*)p, 0, 0);
+}
+
+void atomic_store_i32(volatile int32_t* p, int32_t value)
+{
+        assert(p);
+        InterlockedExchange((volatile LONG*)p, value);
+}
+
+int32_t atomic_add_i32(volatile int32_t* p, int32_t value)
+{
+        assert(p);
+        return InterlockedExchangeAdd((volatile LONG*)p, value) + value;
+}
+
+bool atomic_cas_i32(volatile int32_t* p, int32_t expected, int32_t desired)
+{
+        assert(p);
+        return InterlockedCompareExchange((volatile LONG*)p,
+                                          desired, expected) == expected;
+}
+
+#endif
\ No newline at end of file
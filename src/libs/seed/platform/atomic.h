@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdbool.h>
+#include <stdint.h>
+
+// Atomic operations on 32 bit values shared between threads.
+// All operations act as full memory barriers.
+
+// Returns the value.
+int32_t atomic_load_i32(volatile int32_t* p);
+
+// Sets the value.
+void atomic_store_i32(volatile int32_t* p, int32_t value);
+
+// Adds to the value and returns the result.
+int32_t atomic_add_i32(volatile int32_t* p, int32_t value);
+
+// Sets the value to desired if it is currently expected.
+// Returns true if the value was set.
+bool atomic_cas_i32(volatile int32_t* p, int32_t expected, int32_t desired);
\ No newline at end of file
@@ -0,0 +1,35 @@
+#include "atomic.h"
+
+#ifndef _WIN32
+
+#include <assert.h>
+
+// Uses the GCC and Clang __atomic builtins. Sequentially consistent
+// ordering matches the full barriers of the Interlocked functions.
+
+int32_t atomic_load_i32(volatile int32_t* p)
+{
+        assert(p);
+        return __atomic_load_n(p, __ATOMIC_SEQ_CST);
+}
+
+void atomic_store_i32(volatile int32_t* p, int32_t value)
+{
+        assert(p);
+        __atomic_store_n(p, value, __ATOMIC_SEQ_CST);
+}
+
+int32_t atomic_add_i32(volatile int32_t* p, int32_t value)
+{
+        assert(p);
+        return __atomic_add_fetch(p, value, __ATOMIC_SEQ_CST);
+}
+
+bool atomic_cas_i32(volatile int32_t* p, int32_t expected, int32_t desired)
+{
+        assert(p);
+        return __atomic_compare_exchange_n(p, &expected, desired, false,
+                                           __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+#endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "condition_var.h"
 
+#ifdef _WIN32
+
 #include <assert.h>
 #include <stdlib.h>
 
@@ -46,4 +48,6 @@ void condition_var_notify_all(condition_var* c)
 {
         assert(c);
         WakeAllConditionVariable(&c->condition_variable);
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
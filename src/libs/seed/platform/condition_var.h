@@ -1,5 +1,7 @@
 #pragma once
 
+struct mutex;
+
 typedef struct condition_var condition_var;
 
 // Creats a new condition variable.
@@ -0,0 +1,59 @@
+#include "condition_var.h"
+
+#ifndef _WIN32
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../log.h"
+
+#include "types.h"
+
+condition_var* condition_var_create()
+{
+        condition_var* c = malloc(sizeof(*c));
+        if (!c) {
+                return NULL;
+        }
+
+        int err = pthread_cond_init(&c->cond, NULL);
+        if (err) {
+                LOGERR("Failed to initialize condition variable: %s", strerror(err));
+                free(c);
+                return NULL;
+        }
+
+        return c;
+}
+
+void condition_var_free(condition_var* c)
+{
+        assert(c);
+
+        pthread_cond_destroy(&c->cond);
+        free(c);
+}
+
+void condition_var_wait(condition_var* c, struct mutex* m)
+{
+        assert(c);
+        assert(m);
+
+        pthread_cond_wait(&c->cond, &m->mutex);
+}
+
+void condition_var_notify(condition_var* c)
+{
+        assert(c);
+        pthread_cond_signal(&c->cond);
+}
+
+void condition_var_notify_all(condition_var* c)
+{
+        assert(c);
+        pthread_cond_broadcast(&c->cond);
+}
+
+#endif
\ No newline at end of file
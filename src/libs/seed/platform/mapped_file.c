@@ -0,0 +1,85 @@
+#include "mapped_file.h"
+
+#ifdef _WIN32
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include <Windows.h>
+
+#include "../log.h"
+
+#include "types.h"
+#include "win_error.h"
+
+mapped_file* mapped_file_open(const char* path)
+{
+        mapped_file* f = malloc(sizeof(*f));
+        if (!f) {
+                LOGERR("Failed to allocate mapped file %s", path);
+                return NULL;
+        }
+
+        f->file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL,
+                              OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+        if (f->file == INVALID_HANDLE_VALUE) {
+                LOGERR("Failed to open %s for mapping: %s",
+                       path, win_error_string());
+                goto cleanup_mapped_file;
+        }
+
+        LARGE_INTEGER size;
+        if (!GetFileSizeEx(f->file, &size) || size.QuadPart == 0) {
+                LOGERR("Failed to get size of %s for mapping", path);
+                goto cleanup_file;
+        }
+        f->size = (size_t)size.QuadPart;
+
+        f->mapping = CreateFileMappingA(f->file, NULL, PAGE_READONLY, 0, 0, NULL);
+        if (!f->mapping) {
+                LOGERR("Failed to create file mapping for %s: %s",
+                       path, win_error_string());
+                goto cleanup_file;
+        }
+
+        f->data = MapViewOfFile(f->mapping, FILE_MAP_READ, 0, 0, 0);
+        if (!f->data) {
+                LOGERR("Failed to map view of %s: %s",
+                       path, win_error_string());
+                goto cleanup_mapping;
+        }
+
+        return f;
+
+cleanup_mapping:
+        CloseHandle(f->mapping);
+cleanup_file:
+        CloseHandle(f->file);
+cleanup_mapped_file:
+        free(f);
+        return NULL;
+}
+
+void mapped_file_close(mapped_file* f)
+{
+        assert(f);
+
+        UnmapViewOfFile(f->data);
+        CloseHandle(f->mapping);
+        CloseHandle(f->file);
+        free(f);
+}
+
+const void* mapped_file_data(mapped_file* f)
+{
+        assert(f);
+        return f->data;
+}
+
+size_t mapped_file_size(mapped_file* f)
+{
+        assert(f);
+        return f->size;
+}
+
+#endif
\ No newline at end of file
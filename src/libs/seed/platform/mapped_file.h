@@ -0,0 +1,18 @@
+#pragma once
+
+#include <stddef.h>
+
+typedef struct mapped_file mapped_file;
+
+// Maps the specified file read only into memory.
+// Returns NULL if the file could not be opened or mapped.
+mapped_file* mapped_file_open(const char* path);
+
+// Unmaps the file and frees the mapped_file.
+void mapped_file_close(mapped_file*);
+
+// Returns a pointer to the start of the file's contents.
+const void* mapped_file_data(mapped_file*);
+
+// Returns the size of the file in bytes.
+size_t mapped_file_size(mapped_file*);
\ No newline at end of file
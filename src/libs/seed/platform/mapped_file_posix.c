@@ -0,0 +1,76 @@
+#include "mapped_file.h"
+
+#ifndef _WIN32
+
+#include <assert.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "../log.h"
+
+#include "types.h"
+
+mapped_file* mapped_file_open(const char* path)
+{
+        mapped_file* f = malloc(sizeof(*f));
+        if (!f) {
+                LOGERR("Failed to allocate mapped file %s", path);
+                return NULL;
+        }
+
+        f->fd = open(path, O_RDONLY);
+        if (f->fd == -1) {
+                LOGERR("Failed to open %s for mapping: %s",
+                       path, strerror(errno));
+                goto cleanup_mapped_file;
+        }
+
+        struct stat st;
+        if (fstat(f->fd, &st) == -1 || st.st_size == 0) {
+                LOGERR("Failed to get size of %s for mapping", path);
+                goto cleanup_file;
+        }
+        f->size = (size_t)st.st_size;
+
+        f->data = mmap(NULL, f->size, PROT_READ, MAP_PRIVATE, f->fd, 0);
+        if (f->data == MAP_FAILED) {
+                LOGERR("Failed to map %s: %s", path, strerror(errno));
+                goto cleanup_file;
+        }
+
+        return f;
+
+cleanup_file:
+        close(f->fd);
+cleanup_mapped_file:
+        free(f);
+        return NULL;
+}
+
+void mapped_file_close(mapped_file* f)
+{
+        assert(f);
+
+        munmap((void*)f->data, f->size);
+        close(f->fd);
+        free(f);
+}
+
+const void* mapped_file_data(mapped_file* f)
+{
+        assert(f);
+        return f->data;
+}
+
+size_t mapped_file_size(mapped_file* f)
+{
+        assert(f);
+        return f->size;
+}
+
+#endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "mutex.h"
 
+#ifdef _WIN32
+
 #include <assert.h>
 #include <Windows.h>
 
@@ -37,4 +39,6 @@ void mutex_unlock(mutex* m)
 {
         assert(m);
         LeaveCriticalSection(&m->critical_section);
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,51 @@
+#include "mutex.h"
+
+#ifndef _WIN32
+
+#include <assert.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "../log.h"
+
+#include "types.h"
+
+mutex* mutex_create()
+{
+        mutex* m = malloc(sizeof(*m));
+        if (!m) {
+                return NULL;
+        }
+
+        int err = pthread_mutex_init(&m->mutex, NULL);
+        if (err) {
+                LOGERR("Failed to initialize mutex: %s", strerror(err));
+                free(m);
+                return NULL;
+        }
+
+        return m;
+}
+
+void mutex_free(mutex* m)
+{
+        assert(m);
+
+        pthread_mutex_destroy(&m->mutex);
+        free(m);
+}
+
+void mutex_lock(mutex* m)
+{
+        assert(m);
+        pthread_mutex_lock(&m->mutex);
+}
+
+void mutex_unlock(mutex* m)
+{
+        assert(m);
+        pthread_mutex_unlock(&m->mutex);
+}
+
+#endif
\ No newline at end of file
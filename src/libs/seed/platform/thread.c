@@ -1,5 +1,7 @@
 #include "thread.h"
 
+#ifdef _WIN32
+
 #include <assert.h>
 #include <stddef.h>
 
@@ -48,6 +50,41 @@ void thread_free(thread* t)
         free(t);
 }
 
+bool thread_set_affinity(thread* t, uint32_t cpu)
+{
+        assert(t);
+
+        if (cpu >= sizeof(DWORD_PTR) * 8) {
+                LOGERR("Can't set thread affinity to CPU %u", cpu);
+                return false;
+        }
+
+        if (!SetThreadAffinityMask(t->handle, (DWORD_PTR)1 << cpu)) {
+                LOGERR("Failed to set thread affinity to CPU %u: %s",
+                       cpu, win_error_string());
+                return false;
+        }
+
+        return true;
+}
+
+void thread_sleep(uint32_t ms)
+{
+        Sleep(ms);
+}
+
+void thread_yield()
+{
+        SwitchToThread();
+}
+
+uint32_t thread_cpu_count()
+{
+        SYSTEM_INFO info;
+        GetSystemInfo(&info);
+        return info.dwNumberOfProcessors;
+}
+
 const DWORD MS_VC_EXCEPTION = 0x406D1388;
 
 #pragma pack(push,8)
@@ -72,4 +109,6 @@ void set_thread_name(uint32_t thread_id, const char* name)
         }
         __except (EXCEPTION_EXECUTE_HANDLER)
         {}
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
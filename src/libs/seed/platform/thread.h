@@ -3,6 +3,12 @@
 #include <stdbool.h>
 #include <stdint.h>
 
+// Thread functions are declared __stdcall for _beginthreadex on Win32.
+// The calling convention doesn't exist anywhere else.
+#ifndef _WIN32
+#define __stdcall
+#endif
+
 typedef struct thread thread;
 typedef uint32_t(__stdcall *thread_fn)(void*);
 
@@ -14,4 +20,19 @@ thread* thread_create(const char* thread_name, thread_fn fn, void* fn_arg);
 void thread_join(thread* t);
 
 // Terminates the thread if its running and frees it's memory.
-void thread_free(thread* t);
\ No newline at end of file
+void thread_free(thread* t);
+
+// Restricts the specified thread to running on the specified CPU.
+// Returns false if the affinity could not be set or setting it is not
+// supported on this platform.
+bool thread_set_affinity(thread* t, uint32_t cpu);
+
+// Suspends the calling thread for at least the specified number of
+// milliseconds.
+void thread_sleep(uint32_t ms);
+
+// Gives up the rest of the calling thread's time slice.
+void thread_yield();
+
+// Returns the number of CPUs available to run threads on.
+uint32_t thread_cpu_count();
\ No newline at end of file
@@ -0,0 +1,154 @@
+// For pthread_setaffinity_np. Must come before any system header.
+#define _GNU_SOURCE
+
+#include "thread.h"
+
+#ifndef _WIN32
+
+#include <assert.h>
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "../log.h"
+
+#include "types.h"
+
+// Linux limits thread names to 16 bytes including the terminator.
+#define THREAD_NAME_LEN 16
+
+// Everything the new thread needs to get going. Owned by the new
+// thread so it doesn't matter if the thread is freed straight away.
+typedef struct thread_start {
+        thread_fn fn;
+        void* fn_arg;
+        char name[THREAD_NAME_LEN];
+} thread_start;
+
+void* thread_main(void* data);
+void set_thread_name(const char* name);
+
+thread* thread_create(const char* thread_name,
+                      thread_fn fn, void* fn_arg)
+{
+        thread* t = malloc(sizeof(*t));
+        if (!t) {
+                LOGERR("Failed to allocate thread %s", thread_name);
+                return NULL;
+        }
+
+        thread_start* start = malloc(sizeof(*start));
+        if (!start) {
+                LOGERR("Failed to allocate thread start for thread %s", thread_name);
+                goto cleanup_thread;
+        }
+        start->fn = fn;
+        start->fn_arg = fn_arg;
+        strncpy(start->name, thread_name, THREAD_NAME_LEN - 1);
+        start->name[THREAD_NAME_LEN - 1] = '\0';
+
+        int err = pthread_create(&t->handle, NULL, thread_main, start);
+        if (err) {
+                LOGERR("Failed to create thread %s: %s",
+                       thread_name, strerror(err));
+                goto cleanup_start;
+        }
+
+        return t;
+
+cleanup_start:
+        free(start);
+cleanup_thread:
+        free(t);
+        return NULL;
+}
+
+void thread_join(thread* t)
+{
+        assert(t);
+        pthread_join(t->handle, NULL);
+}
+
+void thread_free(thread* t)
+{
+        assert(t);
+        free(t);
+}
+
+bool thread_set_affinity(thread* t, uint32_t cpu)
+{
+        assert(t);
+
+#ifdef __linux__
+        if (cpu >= CPU_SETSIZE) {
+                LOGERR("Can't set thread affinity to CPU %u", cpu);
+                return false;
+        }
+
+        cpu_set_t cpus;
+        CPU_ZERO(&cpus);
+        CPU_SET(cpu, &cpus);
+        int err = pthread_setaffinity_np(t->handle, sizeof(cpus), &cpus);
+        if (err) {
+                LOGERR("Failed to set thread affinity to CPU %u: %s",
+                       cpu, strerror(err));
+                return false;
+        }
+
+        return true;
+#else
+        LOGWARN("Thread affinity is not supported, ignoring CPU %u", cpu);
+        return false;
+#endif
+}
+
+void thread_sleep(uint32_t ms)
+{
+        struct timespec ts;
+        ts.tv_sec = ms / 1000;
+        ts.tv_nsec = (long)(ms % 1000) * 1000000;
+
+        // Keep sleeping for whatever is left if a signal wakes us early.
+        while (nanosleep(&ts, &ts) == -1 && errno == EINTR) {
+        }
+}
+
+void thread_yield()
+{
+        sched_yield();
+}
+
+uint32_t thread_cpu_count()
+{
+        long count = sysconf(_SC_NPROCESSORS_ONLN);
+        return count > 0 ? (uint32_t)count : 1;
+}
+
+void* thread_main(void* data)
+{
+        thread_start start = *(thread_start*)data;
+        free(data);
+
+        set_thread_name(start.name);
+        start.fn(start.fn_arg);
+
+        return NULL;
+}
+
+// Names the calling thread so it shows up in debuggers and profilers.
+void set_thread_name(const char* name)
+{
+#if defined(__APPLE__)
+        pthread_setname_np(name);
+#elif defined(__linux__)
+        pthread_setname_np(pthread_self(), name);
+#else
+        (void)name;
+#endif
+}
+
+#endif
\ No newline at end of file
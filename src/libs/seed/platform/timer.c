@@ -0,0 +1,25 @@
+#include "timer.h"
+
+#ifdef _WIN32
+
+#include <Windows.h>
+
+int64_t timer_now_us()
+{
+        static LARGE_INTEGER frequency;
+        if (frequency.QuadPart == 0) {
+                // The frequency is fixed at boot so racing to set it is
+                // harmless.
+                QueryPerformanceFrequency(&frequency);
+        }
+
+        LARGE_INTEGER counter;
+        QueryPerformanceCounter(&counter);
+
+        // Split the conversion so large counts don't overflow.
+        int64_t seconds = counter.QuadPart / frequency.QuadPart;
+        int64_t rest = counter.QuadPart % frequency.QuadPart;
+        return seconds * 1000000 + rest * 1000000 / frequency.QuadPart;
+}
+
+#endif
\ No newline at end of file
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <stdint.h>
+
+// Returns the time in microseconds from an arbitrary fixed point. Only
+// the difference between two times means anything. Safe to call from
+// any thread.
+int64_t timer_now_us();
\ No newline at end of file
@@ -0,0 +1,14 @@
+#include "timer.h"
+
+#ifndef _WIN32
+
+#include <time.h>
+
+int64_t timer_now_us()
+{
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+#endif
\ No newline at end of file
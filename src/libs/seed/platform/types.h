@@ -1,7 +1,10 @@
 #pragma once
 
+#include <stddef.h>
 #include <stdint.h>
 
+#ifdef _WIN32
+
 #include <synchapi.h>
 
 typedef struct thread {
@@ -15,4 +18,35 @@ typedef struct mutex {
 
 typedef struct condition_var {
         CONDITION_VARIABLE condition_variable;
-} condition_var;
\ No newline at end of file
+} condition_var;
+
+typedef struct mapped_file {
+        HANDLE file;
+        HANDLE mapping;
+        const void* data;
+        size_t size;
+} mapped_file;
+
+#else
+
+#include <pthread.h>
+
+typedef struct thread {
+        pthread_t handle;
+} thread;
+
+typedef struct mutex {
+        pthread_mutex_t mutex;
+} mutex;
+
+typedef struct condition_var {
+        pthread_cond_t cond;
+} condition_var;
+
+typedef struct mapped_file {
+        int fd;
+        const void* data;
+        size_t size;
+} mapped_file;
+
+#endif
\ No newline at end of file
@@ -1,5 +1,7 @@
 #include "win_error.h"
 
+#ifdef _WIN32
+
 #include <Windows.h>
 
 #define MAX_MSG_LEN 512
@@ -32,4 +34,6 @@ const char* win_error_string()
         }
 
         return NULL;
-}
\ No newline at end of file
+}
+
+#endif
\ No newline at end of file
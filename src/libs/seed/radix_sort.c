@@ -0,0 +1,51 @@
+#include "radix_sort.h"
+
+#include <assert.h>
+#include <string.h>
+
+uint64_t* radix_sort_u64(uint64_t* keys, uint64_t* scratch,
+                         uint32_t count, uint32_t first_byte)
+{
+        assert(first_byte < 8);
+        assert(count == 0 || (keys && scratch));
+
+        // Build the histograms for every byte in a single pass.
+        uint32_t counts[8][256];
+        memset(counts, 0, sizeof(counts));
+        for (uint32_t i = 0; i < count; ++i) {
+                uint64_t key = keys[i];
+                for (uint32_t b = first_byte; b < 8; ++b) {
+                        counts[b][(key >> (b * 8)) & 0xff]++;
+                }
+        }
+
+        uint64_t* src = keys;
+        uint64_t* dst = scratch;
+        for (uint32_t b = first_byte; b < 8; ++b) {
+                uint32_t shift = b * 8;
+
+                // Skip the pass if every key has the same value for this byte.
+                if (count == 0 || counts[b][(src[0] >> shift) & 0xff] == count) {
+                        continue;
+                }
+
+                // Turn the counts into starting offsets.
+                uint32_t offsets[256];
+                uint32_t total = 0;
+                for (uint32_t i = 0; i < 256; ++i) {
+                        offsets[i] = total;
+                        total += counts[b][i];
+                }
+
+                for (uint32_t i = 0; i < count; ++i) {
+                        uint64_t key = src[i];
+                        dst[offsets[(key >> shift) & 0xff]++] = key;
+                }
+
+                uint64_t* tmp = src;
+                src = dst;
+                dst = tmp;
+        }
+
+        return src;
+}
@@ -0,0 +1,12 @@
+#pragma once
+
+#include <inttypes.h>
+
+// Sorts the keys in ascending order using an LSD radix sort.
+// Only bytes first_byte to 7 of each key are sorted on. The sort is
+// stable so keys that are equal in those bytes keep their relative
+// order, which makes it cheap to carry an index in the low bytes.
+// scratch must have space for count keys.
+// Returns whichever of keys or scratch holds the sorted result.
+uint64_t* radix_sort_u64(uint64_t* keys, uint64_t* scratch,
+                         uint32_t count, uint32_t first_byte);
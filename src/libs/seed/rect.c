@@ -6,4 +6,12 @@ bool rect_empty(rect* r)
 {
         assert(r);
         return r->x == 0 && r->y == 0 && r->w == 0 && r->h;
+}
+
+bool rect_intersects(const rect* a, const rect* b)
+{
+        assert(a);
+        assert(b);
+        return a->x < b->x + b->w && b->x < a->x + a->w &&
+               a->y < b->y + b->h && b->y < a->y + a->h;
 }
\ No newline at end of file
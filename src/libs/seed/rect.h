@@ -9,4 +9,7 @@ typedef struct rect {
 static const rect rect_zero = {0.0f, 0.0f, 0.0f, 0.0f};
 
 // Returns true if the specified rect is empty (that is 0.0f,0.0f,0.0f,0.0f).
-bool rect_empty(rect*);
\ No newline at end of file
+bool rect_empty(rect*);
+
+// Returns true if the specified rects overlap.
+bool rect_intersects(const rect* a, const rect* b);
\ No newline at end of file
@@ -1,80 +1,403 @@
 #include "render.h"
 
+#include <stddef.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "platform/atomic.h"
 #include "platform/condition_var.h"
 #include "platform/mutex.h"
 #include "platform/thread.h"
+#include "platform/timer.h"
 
 
 #include <glew/glew.h>
 #include <glfw/glfw3.h>
 #include <kazmath/kazmath.h>
 
+#include "arena.h"
 #include "camera.h"
 #include "gl_utils.h"
+#include "jobs.h"
 #include "khash.h"
 #include "log.h"
+#include "radix_sort.h"
 #include "sprite.h"
+#include "sprite_buffer.h"
+#include "sprite_quads.h"
+#include "stream_buffer.h"
 #include "stretchy_buffer.h"
 #include "texture.h"
 
+typedef enum {
+        command_set_blend,
+        command_set_shader,
+        command_set_scissor,
+        command_set_target,
+        command_draw_quads,
+        command_draw_static_batch
+} command_type;
+
+// A command recorded for the render thread. Commands are sorted along
+// with the sprites by their key and run in that order.
+typedef struct render_command {
+        command_type type;
+        uint64_t key;
+        union {
+                render_blend blend;
+                struct render_shader* shader;
+                struct {
+                        bool enabled;
+                        rect area;
+                } scissor;
+                struct {
+                        struct render_target* target;
+                        bool clear;
+                } target;
+                struct {
+                        texture* tex;
+                        const quad_vertex* verts; // In the frame's arena.
+                        uint32_t count;
+                } quads;
+                struct static_batch* batch;
+        };
+} render_command;
+
+// A texture handed to render_release_texture, given back to release
+// once the frame it was released in has been drawn.
+typedef struct released_texture {
+        texture* tex;
+        render_release_fn release;
+} released_texture;
+
+// Everything gameplay adds for a frame. Frames are handed to the render
+// thread through the frame queue.
+typedef struct render_frame {
+        sprite_buffer sprites;
+        struct static_batch** static_batch_sb;
+        render_command* command_sb;
+
+        // Transient allocations for the frame, such as the vertices of
+        // draw quads commands and the sort keys. Reset once the frame
+        // has been drawn.
+        arena arena;
+
+        // GL objects released while the frame was being built. Frames
+        // still in flight may draw with them so they are only deleted
+        // once this frame has been drawn.
+        GLuint* deleted_texture_sb;
+        struct static_batch** freed_batch_sb;
+        struct render_shader** freed_shader_sb;
+        struct render_target** freed_target_sb;
+
+        // Textures released while the frame was being built. Unlike the
+        // lists above these belong to gameplay, which hands them back
+        // when it next finds the frame free to add to.
+        released_texture* released_texture_sb;
+
+        // Stats of the last frame the render thread finished before this
+        // frame was freed for gameplay to add to.
+        render_stats stats;
+
+        // The camera transform when the frame was submitted. Gameplay
+        // keeps moving the camera while the frame waits in the queue.
+        kmMat4 cam;
+
+        // Set by render_resize. The viewport is updated before the
+        // frame is drawn.
+        bool resized;
+        uint32_t width;
+        uint32_t height;
+} render_frame;
+
+// Where a program's projection, camera and texture uniforms are and
+// the uniform serial of the values last uploaded to them.
+typedef struct program_uniforms {
+        GLint projection;
+        GLint cam;
+        GLint texture;
+        uint32_t serial;
+} program_uniforms;
+
+// A program that draws quads built on the CPU and where its attributes
+// and uniforms are.
+typedef struct quad_program {
+        GLuint program;
+        GLuint vert_attrib;
+        GLuint tex_coord_attrib;
+        program_uniforms uniforms;
+} quad_program;
+
+typedef struct render_shader {
+        char* vert_shader_path;
+        char* frag_shader_path;
+
+        // Shaders are compiled by the render thread the first time they
+        // are used.
+        quad_program quads;
+        bool compiled;
+        bool failed;
+} render_shader;
+
+typedef struct render_target {
+        texture tex; // Drawn to while the target is set.
+        GLuint fbo;
+
+        // The framebuffer is created by the render thread the first time
+        // the target is set.
+        bool created;
+        bool failed;
+} render_target;
+
+// GPU timer queries in the ring. Results are read back once they are
+// available so there has to be one per frame the GPU can lag behind.
+#define GPU_QUERY_COUNT 4
+
 typedef struct renderer {
         GLFWwindow* window;
 
+        // Headless renderers have no window or GL context. They do all
+        // the CPU side work of a frame and throw away the draw calls.
+        bool headless;
+        uint8_t* headless_vertices; // Stands in for the vertex stream.
+
         uint16_t width;
         uint16_t height;
         uint16_t virtual_width;
         uint16_t virtual_height;
 
-        GLuint shader_program;
-        GLuint vert_attrib;
-        GLuint tex_coord_attrib;
+        render_mode mode;
+        GLuint shader_program; // Draws the sprites.
         uint32_t tex_unit;
 
-        // Rendering is double buffered. So while gameplay thread writes new
-        // data the rendering thread can render from the other buffer.
-        sprite* sprite_sb[2];
-        uint8_t current_buffer; // The buffer new sprites can be added to.
-
+        // Draws the quads of render_mode_batched and of draw quads
+        // commands. Shares the sprite program in render_mode_batched.
+        quad_program default_quads;
+
+        // Attributes for render_mode_instanced.
+        GLuint corner_attrib;
+        GLuint position_attrib;
+        GLuint scale_rotation_attrib;
+        GLuint tex_rect_attrib;
+        GLint tex_size_uniform;
+        GLuint quad_corner_buffer;
+        program_uniforms sprite_uniforms;
+
+        // The GL state the render thread last set, so state that
+        // wouldn't change is never set again. quads is the program quads
+        // are drawn with, which set shader commands can change.
+        GLuint bound_program;
+        GLuint bound_texture; // Bound to tex_unit.
+        GLuint array_buffer;
+        GLuint element_buffer;
+        uint32_t enabled_attribs; // A bit per enabled attribute array.
+        uint32_t instanced_attribs; // A bit per attribute with a divisor.
+        bool corner_pointer_set; // corner_attrib points at the corners.
+        GLuint tex_size_texture; // Whose size tex_size_uniform holds.
+        render_blend blend;
+        quad_program* quads;
+        render_shader* shader;
+        render_target* target;
+        bool scissor_enabled;
+        rect scissor;
+        kmMat4 projection;
+        kmMat4 cam;
+        int32_t viewport[4];
+
+        // Bumped whenever the projection or camera changes so programs
+        // know to upload them again.
+        uint32_t uniform_serial;
+
+        // Stats of the frame being drawn, vertex_us and the times in
+        // it being filled in once the frame is done, and of the last
+        // complete frame.
+        render_stats stats;
+        render_stats last_stats;
+        int64_t vertex_us;
+
+        // GL_TIME_ELAPSED queries around each frame's draw calls and the
+        // frame each is timing.
+        bool gpu_timing;
+        GLuint gpu_queries[GPU_QUERY_COUNT];
+        uint32_t gpu_query_frames[GPU_QUERY_COUNT];
+        bool gpu_query_pending[GPU_QUERY_COUNT];
+        bool gpu_query_active;
+
+        // Render target textures are given ids counting down from
+        // TEXTURE_MAX_ID so they don't batch with loaded textures.
+        uint32_t next_target_id;
+
+        // Vertex data for every batch is written into this ring rather
+        // than into a new GL buffer per batch.
+        stream_buffer* vertex_stream;
+        GLuint quad_index_buffer;
+
+        // A single producer, single consumer queue of frames. Gameplay
+        // fills frames[submitted % frames_in_flight] while the render
+        // thread draws frames[rendered % frames_in_flight]. Each counter
+        // is only written by one of the threads so no locks are needed.
+        render_frame frames[RENDER_MAX_FRAMES_IN_FLIGHT];
+        uint32_t frames_in_flight;
+        volatile int32_t submitted;
+        volatile int32_t rendered;
+
+        // Static runs in the sort keys of the frame being drawn, in its
+        // arena.
+        struct static_run** static_runs;
+
+        // A thread that can't make progress on the queue sleeps on the
+        // condition var. waiting counts the sleepers so the other thread
+        // only takes the mutex to wake them when someone is asleep.
         thread* render_thread;
         mutex* render_mutex;
         condition_var* render_condition;
-        bool rendering;
-        bool done;
+        volatile int32_t waiting;
+        volatile int32_t done;
 } renderer;
 
 #define CHECG_GL
 
-int compare_sprites(const void* lhs, const void* rhs);
+// Bytes per region of the vertex stream. Each frame gets its own region.
+#define VERTEX_STREAM_REGION_SIZE (4 * 1024 * 1024)
+// Quads are drawn with 16 bit indices so a single draw call can
+// reference at most this many quads.
+#define MAX_QUADS_PER_DRAW (65536 / 4)
+// Times a thread checks the frame queue before going to sleep on it.
+#define QUEUE_SPIN_COUNT 64
+// Batches are split into ranges of at least this many sprites when
+// their vertices are generated on the job system.
+#define MIN_SPRITES_PER_JOB 1024
+
+// Sprites are drawn in order of a 64 bit key made up of
+// | 8 bits depth | 24 bits texture id | 32 bits sprite index |
+// so sorting the keys groups sprites by depth then texture and keeps
+// sprites in the order they were added otherwise.
+// Static batch runs and commands are sorted along with the sprites with
+// the top bits of the index set and the rest of it indexing
+// static_runs or the frame's command_sb. Commands are keyed before
+// sprites so they run first when their keys are equal.
+#define SORT_KEY_INDEX(key) ((uint32_t)(key))
+#define SORT_KEY_TEXTURE(key) ((uint32_t)((key) >> 32) & 0xffffff)
+#define SORT_KEY_STATIC 0x80000000
+#define SORT_KEY_COMMAND 0x40000000
+#define SORT_KEY_TAGS (SORT_KEY_STATIC | SORT_KEY_COMMAND)
+#define SORT_KEY_IS_STATIC(key) ((SORT_KEY_INDEX(key) & SORT_KEY_STATIC) != 0)
+#define SORT_KEY_IS_COMMAND(key) ((SORT_KEY_INDEX(key) & SORT_KEY_COMMAND) != 0)
+#define SORT_KEY_IS_SPRITE(key) ((SORT_KEY_INDEX(key) & SORT_KEY_TAGS) == 0)
+
+// Per instance data for render_mode_instanced, 32 bytes per sprite.
+// tex_rect is in whole texels with the width negated when flipped. To
+// fit in 16 bits tex rects, offset into their page, must lie within
+// texels -32768 to 32767, so textures and pages drawn instanced can be
+// at most 32767 texels across. calc_instance asserts they fit.
+typedef struct sprite_instance {
+        float x_pos;
+        float y_pos;
+        float x_anchor;
+        float y_anchor;
+        float scale;
+        float rotation;
+        int16_t tex_rect[4];
+} sprite_instance;
+
+// The sprites of a batch and where their vertex data is written.
+// Each job generates the vertices for a range of the keys.
+typedef struct vertex_job {
+        const sprite_buffer* sprites;
+        const uint64_t* keys;
+        void* out; // quad_vertex or sprite_instance depending on mode.
+} vertex_job;
+
+// A run of sprites in a static batch sharing depth and texture.
+typedef struct static_run {
+        struct static_batch* batch;
+        texture* tex;
+        uint64_t key; // Sort key with the index left as 0.
+        uint32_t first; // First quad or instance of the run in the batch.
+        uint32_t count;
+} static_run;
+
+typedef struct static_batch {
+        static_run* run_sb;
+
+        // Vertex data in the format of the renderer's mode. Freed once
+        // it is uploaded.
+        void* data;
+        uint32_t data_size;
+        GLuint gl_id;
+        bool uploaded;
+} static_batch;
+
+uint64_t make_sort_key(const sprite_buffer* sprites, uint32_t index);
 uint32_t __stdcall render_func(void* renderer);
-void swap_sprite_sb(renderer* r);
-sprite* prepare_back_buffer(renderer*);
-void render_sprites(renderer* r, sprite* sprites_sb);
-float* calc_verts(sprite* s, float* vert_buffer);
-float* calc_tex_coords(sprite* s, float* tex_coord_buffer);
-void draw_buffers(renderer*, float* vert_buffer, float* tex_coord_buffer);
+render_frame* building_frame(renderer* r);
+bool frame_ready(renderer* r);
+bool frame_free(renderer* r);
+void wait_for_queue(renderer* r, bool (*ready)(renderer*));
+void wake_queue(renderer* r);
+void release_frame(renderer* r, render_frame* f);
+void release_textures(renderer* r, render_frame* f);
+bool frame_idle(renderer* r);
+void begin_gpu_timer(renderer* r, uint32_t frame);
+void end_gpu_timer(renderer* r);
+void read_gpu_timers(renderer* r);
+void finish_stats(renderer* r);
+float us_to_ms(int64_t us);
+void free_static_batch(renderer* r, static_batch* b);
+void free_shader(renderer* r, render_shader* sh);
+void free_target(renderer* r, render_target* rt);
+void resize_viewport(renderer* r, uint32_t screen_width, uint32_t screen_height);
+uint32_t prepare_frame(renderer*, render_frame* f, uint64_t** sorted_keys);
+void draw_frame(renderer* r, render_frame* f,
+                uint64_t* keys, uint32_t keys_len);
+render_command* add_command(renderer* r, command_type type, uint64_t key);
+void run_command(renderer* r, render_frame* f, const render_command* c);
+void reset_state(renderer* r);
+void set_blend(renderer* r, render_blend blend);
+void set_shader(renderer* r, render_shader* sh);
+void set_scissor(renderer* r, bool enabled, const rect* area);
+void set_target(renderer* r, render_target* rt, bool clear);
+void set_viewport(renderer* r);
+void bind_program(renderer* r, GLuint program, program_uniforms* u);
+void bind_sprite_program(renderer* r);
+void bind_quad_program(renderer* r);
+void bind_gl_texture(renderer* r, GLuint gl_id);
+void bind_buffer(renderer* r, GLenum target, GLuint buffer);
+void set_attribs(renderer* r, uint32_t enabled, uint32_t instanced);
+uint32_t attrib_bit(GLuint attrib);
+void forget_texture(renderer* r, GLuint gl_id);
+void draw_quads(renderer* r, const quad_vertex* verts, uint32_t quad_count);
+bool make_quad_program(quad_program* qp, const char* vert_shader_path,
+                       const char* frag_shader_path);
+void init_quad_program(quad_program* qp, GLuint program);
+void init_uniforms(program_uniforms* u, GLuint program);
+bool create_target(renderer* r, render_target* rt);
+char* copy_string(const char* str);
+bool bind_texture(renderer* r, texture* t);
+void draw_static_run(renderer* r, static_run* run);
+bool upload_static_batch(renderer* r, static_batch* b);
+void draw_batch(renderer* r, sprite_buffer* sprites,
+                const uint64_t* keys, int32_t keys_len);
+void draw_buffers(renderer*, GLuint buffer, uint32_t vert_offset,
+                  int32_t quad_count);
+void draw_instanced_batch(renderer* r, sprite_buffer* sprites,
+                          const uint64_t* keys, int32_t keys_len);
+void calc_instance(const sprite_buffer* sprites, uint32_t index,
+                   sprite_instance* inst);
+int16_t texel_coord(float v);
+void calc_verts_range(void* data, uint32_t begin, uint32_t end);
+void calc_instances_range(void* data, uint32_t begin, uint32_t end);
+void draw_instances(renderer*, GLuint buffer, uint32_t inst_offset,
+                    int32_t inst_count);
+GLuint make_quad_index_buffer();
+GLuint make_quad_corner_buffer();
+bool instancing_supported();
 bool upload_texture(renderer* r, texture* t);
-
-void bindTextureUnit(uint32_t shader_prog,
-                     uint32_t tex_unit,
-                     const char* uniform_name)
-{
-        GLuint tex_uniform = glGetUniformLocation(shader_prog, uniform_name);
-        glUseProgram(shader_prog);
-        glUniform1i(tex_uniform, tex_unit);
-        glUseProgram(0);
-}
-
-void switchTexture(renderer* r, texture* t)
-{
-        assert(t);
-
-        glActiveTexture(GL_TEXTURE0 + r->tex_unit);
-        glBindTexture(GL_TEXTURE_2D, t->gl_id);
-}
+void init_renderer(renderer* r, uint32_t virtual_width, uint32_t virtual_height,
+                   render_mode mode, uint32_t frames_in_flight);
+void* alloc_vertices(renderer* r, uint32_t size, uint32_t* offset);
+void commit_vertices(renderer* r, uint32_t offset, uint32_t size);
 
 void bindSampler(uint32_t tex_unit)
 {
@@ -101,7 +424,10 @@ bool check_gl_error()
 
 renderer* render_create(GLFWwindow* window,
                         uint32_t virtual_width, uint32_t virtual_height,
-                        const char* vert_shader_path, const char* frag_shader_path)
+                        render_mode mode, uint32_t frames_in_flight,
+                        const char* vert_shader_path,
+                        const char* instanced_vert_shader_path,
+                        const char* frag_shader_path)
 {
         assert(window);
 
@@ -111,6 +437,17 @@ renderer* render_create(GLFWwindow* window,
                 goto return_failed;
         }
 
+        const char* quad_vert_shader_path = vert_shader_path;
+        if (mode == render_mode_instanced) {
+                if (instancing_supported()) {
+                        vert_shader_path = instanced_vert_shader_path;
+                } else {
+                        LOGWARN("%s", "Instancing not supported, falling back to batched rendering");
+                        mode = render_mode_batched;
+                }
+        }
+        init_renderer(r, virtual_width, virtual_height, mode, frames_in_flight);
+
         GLuint vert_shader = make_shader(GL_VERTEX_SHADER, vert_shader_path);
         if (vert_shader == 0) {
                 LOGERR("%s", "Error making vertex shader");
@@ -141,24 +478,59 @@ renderer* render_create(GLFWwindow* window,
                 goto cleanup_render_mutex;
         }
 
+        r->vertex_stream = stream_buffer_create(GL_ARRAY_BUFFER,
+                                                VERTEX_STREAM_REGION_SIZE);
+        if (!r->vertex_stream) {
+                LOGERR("%s", "Failed to create vertex stream buffer");
+                goto cleanup_condition_var;
+        }
+
+        r->quad_index_buffer = make_quad_index_buffer();
+        if (r->quad_index_buffer == 0) {
+                LOGERR("%s", "Failed to create quad index buffer");
+                goto cleanup_vertex_stream;
+        }
+
+        if (r->mode == render_mode_instanced) {
+                r->quad_corner_buffer = make_quad_corner_buffer();
+                if (r->quad_corner_buffer == 0) {
+                        LOGERR("%s", "Failed to create quad corner buffer");
+                        goto cleanup_quad_index_buffer;
+                }
+        }
+
+        // Quads from commands are always built on the CPU so instanced
+        // renderers need the batched program as well.
+        if (r->mode == render_mode_instanced) {
+                if (!make_quad_program(&r->default_quads, quad_vert_shader_path,
+                                       frag_shader_path)) {
+                        LOGERR("%s", "Error making quad shader program");
+                        goto cleanup_quad_corner_buffer;
+                }
+        } else {
+                init_quad_program(&r->default_quads, r->shader_program);
+        }
+
         r->window = window;
 
-        r->sprite_sb[0] = NULL;
-        r->sprite_sb[1] = NULL;
-        r->rendering = false;
-        r->done = false;
-        r->vert_attrib = glGetAttribLocation(r->shader_program, "vertex");
-        r->tex_coord_attrib = glGetAttribLocation(r->shader_program, "tex_coord");
-        r->virtual_width = virtual_width;
-        r->virtual_height = virtual_height;
-        r->tex_unit = 0;
-        r->current_buffer = 0;
+        r->corner_attrib = glGetAttribLocation(r->shader_program, "corner");
+        r->position_attrib = glGetAttribLocation(r->shader_program, "position");
+        r->scale_rotation_attrib = glGetAttribLocation(r->shader_program, "scale_rotation");
+        r->tex_rect_attrib = glGetAttribLocation(r->shader_program, "tex_rect");
+        r->tex_size_uniform = glGetUniformLocation(r->shader_program, "tex_size");
+        init_uniforms(&r->sprite_uniforms, r->shader_program);
+
+        r->gpu_timing = GLEW_VERSION_3_3 || GLEW_ARB_timer_query;
+        if (r->gpu_timing) {
+                glGenQueries(GPU_QUERY_COUNT, r->gpu_queries);
+        }
 
-        bindTextureUnit(r->shader_program, r->tex_unit, "sprite_texture");
+        // Only tex_unit is ever used so it stays the active unit.
+        glActiveTexture(GL_TEXTURE0 + r->tex_unit);
         bindSampler(r->tex_unit);
         uint32_t width, height;
         glfwGetWindowSize(window, &width, &height);
-        render_resize(r, width, height);
+        resize_viewport(r, width, height);
 
         glEnable(GL_BLEND);
         glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
@@ -168,25 +540,34 @@ renderer* render_create(GLFWwindow* window,
         glEnable(GL_DEPTH_TEST);
         glDepthFunc(GL_LEQUAL);
 
+        if (check_gl_error()) {
+                goto cleanup_gpu_queries;
+        }
+
+        // The render thread owns the context from here on.
+        glfwMakeContextCurrent(NULL);
         r->render_thread = thread_create("render_thread", render_func, r);
         if (!r->render_thread) {
                 LOGERR("%s", "Failed to create render_thread");
-                goto cleanup_condition_var;
-        }
-
-        if (check_gl_error()) {
-                goto cleanup_render_thread;
+                glfwMakeContextCurrent(window);
+                goto cleanup_gpu_queries;
         }
 
         return r;
 
-cleanup_render_thread:
-        mutex_lock(r->render_mutex);
-        r->done = true;
-        condition_var_notify(r->render_condition);
-        mutex_unlock(r->render_mutex);
-        thread_join(r->render_thread);
-        thread_free(r->render_thread);
+cleanup_gpu_queries:
+        if (r->gpu_timing) {
+                glDeleteQueries(GPU_QUERY_COUNT, r->gpu_queries);
+        }
+        if (r->mode == render_mode_instanced) {
+                glDeleteProgram(r->default_quads.program);
+        }
+cleanup_quad_corner_buffer:
+        glDeleteBuffers(1, &r->quad_corner_buffer);
+cleanup_quad_index_buffer:
+        glDeleteBuffers(1, &r->quad_index_buffer);
+cleanup_vertex_stream:
+        stream_buffer_free(r->vertex_stream);
 cleanup_condition_var:
         condition_var_free(r->render_condition);
 cleanup_render_mutex:
@@ -203,30 +584,160 @@ return_failed:
         return NULL;
 }
 
+renderer* render_create_headless(uint32_t virtual_width, uint32_t virtual_height,
+                                 render_mode mode, uint32_t frames_in_flight)
+{
+        renderer* r = malloc(sizeof(*r));
+        if (!r) {
+                LOGERR("%s", "Failed to allocate renderer");
+                goto return_failed;
+        }
+
+        init_renderer(r, virtual_width, virtual_height, mode, frames_in_flight);
+        r->headless = true;
+        r->width = virtual_width;
+        r->height = virtual_height;
+
+        // Vertices are generated into the same amount of memory a region
+        // of the vertex stream has.
+        r->headless_vertices = malloc(VERTEX_STREAM_REGION_SIZE);
+        if (!r->headless_vertices) {
+                LOGERR("%s", "Failed to allocate headless vertices");
+                goto cleanup_renderer;
+        }
+
+        r->render_mutex = mutex_create();
+        if (!r->render_mutex) {
+                LOGERR("%s", "Failed to allocate render mutex");
+                goto cleanup_headless_vertices;
+        }
+
+        r->render_condition = condition_var_create();
+        if (!r->render_condition) {
+                LOGERR("%s", "Failed to allocate condition variable");
+                goto cleanup_render_mutex;
+        }
+
+        r->render_thread = thread_create("render_thread", render_func, r);
+        if (!r->render_thread) {
+                LOGERR("%s", "Failed to create render_thread");
+                goto cleanup_condition_var;
+        }
+
+        LOGINFO("%s", "Created headless renderer");
+        return r;
+
+cleanup_condition_var:
+        condition_var_free(r->render_condition);
+cleanup_render_mutex:
+        mutex_free(r->render_mutex);
+cleanup_headless_vertices:
+        free(r->headless_vertices);
+cleanup_renderer:
+        free(r);
+return_failed:
+        return NULL;
+}
+
 void render_free(renderer* r)
 {
         assert(r);
 
-        // Stop the thread
-        mutex_lock(r->render_mutex);
-        r->done = true;
-        condition_var_notify(r->render_condition);
-        mutex_unlock(r->render_mutex);
+        // Stop the thread. Frames it hasn't drawn yet are dropped.
+        atomic_store_i32(&r->done, 1);
+        wake_queue(r);
         thread_join(r->render_thread);
         thread_free(r->render_thread);
 
         condition_var_free(r->render_condition);
         mutex_free(r->render_mutex);
 
-        glfwMakeContextCurrent(r->window);
+        if (!r->headless) {
+                glfwMakeContextCurrent(r->window);
+        }
+
+        // Textures released in frames that were never drawn are handed
+        // back first as that can delete their texture objects.
+        for (uint32_t i = 0; i < RENDER_MAX_FRAMES_IN_FLIGHT; ++i) {
+                release_textures(r, &r->frames[i]);
+        }
+
+        // Anything released in frames that were never drawn is freed now
+        // that nothing can draw with it.
+        for (uint32_t i = 0; i < RENDER_MAX_FRAMES_IN_FLIGHT; ++i) {
+                render_frame* f = &r->frames[i];
+                release_frame(r, f);
+                sprite_buffer_free(&f->sprites);
+                sb_free(f->static_batch_sb);
+                sb_free(f->command_sb);
+                arena_free(&f->arena);
+                sb_free(f->deleted_texture_sb);
+                sb_free(f->freed_batch_sb);
+                sb_free(f->freed_shader_sb);
+                sb_free(f->freed_target_sb);
+                sb_free(f->released_texture_sb);
+        }
+
+        if (r->headless) {
+                free(r->headless_vertices);
+                free(r);
+                return;
+        }
+
+        if (r->gpu_timing) {
+                glDeleteQueries(GPU_QUERY_COUNT, r->gpu_queries);
+        }
+        stream_buffer_free(r->vertex_stream);
+        glDeleteBuffers(1, &r->quad_index_buffer);
+        glDeleteBuffers(1, &r->quad_corner_buffer);
+        if (r->mode == render_mode_instanced) {
+                glDeleteProgram(r->default_quads.program);
+        }
         glDeleteProgram(r->shader_program);
         free(r);
 }
 
+render_mode render_get_mode(renderer* r)
+{
+        assert(r);
+        return r->mode;
+}
+
+bool render_set_thread_affinity(renderer* r, uint32_t cpu)
+{
+        assert(r);
+        return thread_set_affinity(r->render_thread, cpu);
+}
+
+arena* render_frame_arena(renderer* r)
+{
+        assert(r);
+        return &building_frame(r)->arena;
+}
+
+void render_get_stats(renderer* r, render_stats* stats)
+{
+        assert(r);
+        assert(stats);
+
+        // The render thread wrote them before it freed the frame.
+        *stats = building_frame(r)->stats;
+}
+
 void render_resize(renderer* r, uint32_t screen_width, uint32_t screen_height)
 {
         assert(r);
 
+        render_frame* f = building_frame(r);
+        f->resized = true;
+        f->width = screen_width;
+        f->height = screen_height;
+}
+
+// Sets the viewport and projection for the screen size. Must be called
+// on the thread the GL context is current on.
+void resize_viewport(renderer* r, uint32_t screen_width, uint32_t screen_height)
+{
         r->width = screen_width;
         r->height = screen_height;
         float aspect_ratio = ((float)r->virtual_width) / ((float)r->virtual_height);
@@ -239,20 +750,24 @@ void render_resize(renderer* r, uint32_t screen_width, uint32_t screen_height)
                 width = (uint32_t)(height * aspect_ratio + 0.5f);
         }
 
-        uint32_t viewport_x = (screen_width / 2) - (width / 2);
-        uint32_t viewport_y = (screen_height / 2) - (height / 2);
+        r->viewport[0] = (screen_width / 2) - (width / 2);
+        r->viewport[1] = (screen_height / 2) - (height / 2);
+        r->viewport[2] = width;
+        r->viewport[3] = height;
 
-        glViewport(viewport_x, viewport_y, width, height);
+        if (r->headless) {
+                return;
+        }
 
-        GLint proj_uniform = glGetUniformLocation(r->shader_program, "projection");
-        kmMat4 proj_matrix;
-        kmMat4OrthographicProjection(&proj_matrix,
+        // The projection is uploaded to each program as it is bound.
+        kmMat4OrthographicProjection(&r->projection,
                                      0, (float)r->virtual_width,
                                      0, (float)r->virtual_height,
                                      -1, 1);
-        glUseProgram(r->shader_program);
-        glUniformMatrix4fv(proj_uniform, 1, GL_FALSE, proj_matrix.mat);
-        glUseProgram(0);
+        r->uniform_serial++;
+        if (!r->target) {
+                set_viewport(r);
+        }
 
         if (check_gl_error()) {
                 LOGERR("%s", "An GL error occurred when resizing renderer");
@@ -262,289 +777,1699 @@ void render_resize(renderer* r, uint32_t screen_width, uint32_t screen_height)
 void render_add_sprite(renderer* r, const sprite* s)
 {
         assert(s);
-        sb_push(r->sprite_sb[r->current_buffer], *s);
+        sprite_buffer_add_sprites(&building_frame(r)->sprites, s, 1);
 }
 
 void render_add_sprites(renderer* r, const sprite* sprites, 
                         int32_t sprites_len)
 {
         assert(r);
-        sprite* begin = sb_add(r->sprite_sb[r->current_buffer], sprites_len);
-        memcpy(begin, sprites, sprites_len * sizeof(sprite));
+        sprite_buffer_add_sprites(&building_frame(r)->sprites,
+                                  sprites, sprites_len);
 }
 
-void render_delete_texture(renderer* r, texture* t)
+void render_add_sprite_streams(renderer* r, const sprite_streams* streams)
 {
         assert(r);
-        assert(t);
-
-        glfwMakeContextCurrent(r->window);
-        glDeleteTextures(1, &t->gl_id);
+        sprite_buffer_add_streams(&building_frame(r)->sprites, streams);
 }
 
-void render_submit(renderer* r)
+static_batch* render_create_static_batch(renderer* r, const sprite* sprites,
+                                         int32_t sprites_len)
 {
         assert(r);
+        assert(sprites || sprites_len == 0);
 
-        mutex_lock(r->render_mutex);
-        while (r->rendering) {
-                condition_var_wait(r->render_condition, r->render_mutex);
+        static_batch* b = malloc(sizeof(*b));
+        if (!b) {
+                LOGERR("%s", "Failed to allocate static batch");
+                return NULL;
         }
-        mutex_unlock(r->render_mutex);
 
-        glfwMakeContextCurrent(NULL);
-        swap_sprite_sb(r);
+        b->run_sb = NULL;
+        b->gl_id = 0;
+        b->uploaded = false;
+        b->data_size = sprites_len * (r->mode == render_mode_instanced ?
+                                      sizeof(sprite_instance) :
+                                      4 * sizeof(quad_vertex));
+        b->data = malloc(b->data_size);
+        uint64_t* keys = malloc(sprites_len * sizeof(uint64_t));
+        uint64_t* scratch = malloc(sprites_len * sizeof(uint64_t));
+        if (sprites_len > 0 && (!b->data || !keys || !scratch)) {
+                LOGERR("%s", "Failed to allocate static batch data");
+                free(keys);
+                free(scratch);
+                free(b->data);
+                free(b);
+                return NULL;
+        }
+
+        // The sprites go through the same layout as sprites added each
+        // frame so the batch is built by the same code.
+        sprite_buffer buffer;
+        sprite_buffer_init(&buffer);
+        sprite_buffer_add_sprites(&buffer, sprites, sprites_len);
+        sprite_buffer_resolve(&buffer, NULL);
+
+        // Sort the sprites once up front the same way sprites are sorted
+        // each frame. Each run of equal depth and texture can then be
+        // drawn in a single call.
+        for (int32_t i = 0; i < sprites_len; ++i) {
+                keys[i] = make_sort_key(&buffer, i);
+        }
+        uint64_t* sorted = radix_sort_u64(keys, scratch, sprites_len, 4);
+
+        sprite_instance* insts = b->data;
+        for (int32_t i = 0; i < sprites_len; ++i) {
+                uint32_t index = SORT_KEY_INDEX(sorted[i]);
+                uint64_t run_key = sorted[i] & 0xffffffff00000000ULL;
+                if (i == 0 || sb_last(b->run_sb).key != run_key) {
+                        static_run* run = sb_add(b->run_sb, 1);
+                        run->batch = b;
+                        run->tex = texture_get_page(
+                                buffer.textures_sb[buffer.tex_sb[index]]);
+                        run->key = run_key;
+                        run->first = i;
+                        run->count = 0;
+                }
+                sb_last(b->run_sb).count++;
+
+                if (r->mode == render_mode_instanced) {
+                        calc_instance(&buffer, index, &insts[i]);
+                }
+        }
+        if (r->mode != render_mode_instanced) {
+                sprite_quads_calc(&buffer, sorted, sprites_len, b->data);
+        }
+
+        sprite_buffer_free(&buffer);
+        free(keys);
+        free(scratch);
 
-        // Tell the rendering thread to go.
-        condition_var_notify(r->render_condition);
+        return b;
 }
 
-int compare_sprites(const void* lhs, const void* rhs)
+void render_free_static_batch(renderer* r, static_batch* b)
 {
-        const sprite* a = lhs;
-        const sprite* b = rhs;
+        assert(r);
+        assert(b);
+
+        // Frames in flight may still draw the batch.
+        sb_push(building_frame(r)->freed_batch_sb, b);
+}
+
+void render_add_static_batch(renderer* r, static_batch* b)
+{
+        assert(r);
+        assert(b);
+        sb_push(building_frame(r)->static_batch_sb, b);
+}
+
+void render_delete_texture(renderer* r, texture* t)
+{
+        assert(r);
+        assert(t);
 
-        if (a->depth == b->depth) {
-                return b->tex->id - a->tex->id;
+        if (r->headless) {
+                return;
         }
-        
-        return b->depth - a->depth;
+
+        // The render thread owns the context and frames in flight may
+        // still draw with the texture.
+        sb_push(building_frame(r)->deleted_texture_sb, t->gl_id);
 }
 
-uint32_t __stdcall render_func(void* data)
+void render_release_texture(renderer* r, texture* t, render_release_fn release)
 {
-        renderer* r = (renderer*)data;
+        assert(r);
+        assert(t);
+        assert(release);
 
-        while (!r->done) {
-                mutex_lock(r->render_mutex);
-                // Tell the game play thread rendering done.
-                r->rendering = false;
-                condition_var_notify(r->render_condition);
+        // Frames in flight may still draw the texture or upload its data.
+        released_texture* rt = sb_add(building_frame(r)->released_texture_sb, 1);
+        rt->tex = t;
+        rt->release = release;
+}
 
-                // Wait for the game play thread to kick off rendering.
-                condition_var_wait(r->render_condition, r->render_mutex);
-                if (r->done) {
-                        return 0;
-                }
-                r->rendering = true;
-                glfwMakeContextCurrent(r->window);
-                mutex_unlock(r->render_mutex);
+void render_wait_idle(renderer* r)
+{
+        assert(r);
+        wait_for_queue(r, frame_idle);
+}
 
-                sprite* sprites = prepare_back_buffer(r);
-                render_sprites(r, sprites);
-                glfwSwapBuffers(r->window);
-                sb_reset(sprites);
+void render_flush_textures(renderer* r)
+{
+        assert(r);
 
-                if (check_gl_error()) {
-                        LOGERR("%s", "An GL error occurred when rendering");
-                }
+        render_wait_idle(r);
+        for (uint32_t i = 0; i < RENDER_MAX_FRAMES_IN_FLIGHT; ++i) {
+                release_textures(r, &r->frames[i]);
         }
+}
 
-        return 0;
+uint64_t render_make_key(int8_t depth, uint32_t order)
+{
+        // Higher depths are drawn first.
+        uint64_t inv_depth = (uint8_t)(INT8_MAX - depth);
+        return (inv_depth << 56) | ((uint64_t)(order & TEXTURE_MAX_ID) << 32);
 }
 
-void swap_sprite_sb(renderer* r)
+void render_cmd_set_blend(renderer* r, uint64_t key, render_blend blend)
 {
-        r->current_buffer = ++r->current_buffer % 2;
+        assert(r);
+        add_command(r, command_set_blend, key)->blend = blend;
 }
 
-// Gets the back buffer and sorts it. Returns a 
-// pointer to the sorted buffer.
-sprite* prepare_back_buffer(renderer* r)
+void render_cmd_set_shader(renderer* r, uint64_t key, render_shader* sh)
 {
-        // Find the buffer to read from.
-        uint8_t back_buffer = (r->current_buffer + 1) % 2;
-        sprite* sprites = r->sprite_sb[back_buffer];
+        assert(r);
+        add_command(r, command_set_shader, key)->shader = sh;
+}
 
-        // Sort the sprites by texture ID to minimize the number of
-        // texture switches we have to do.
-        qsort(sprites, sb_count(sprites), sizeof(sprite), compare_sprites);
+void render_cmd_set_scissor(renderer* r, uint64_t key, const rect* area)
+{
+        assert(r);
 
-        return sprites;
+        render_command* c = add_command(r, command_set_scissor, key);
+        c->scissor.enabled = area != NULL;
+        c->scissor.area = area ? *area : rect_zero;
 }
 
-void render_sprites(renderer* r, sprite* sprites_sb)
+void render_cmd_set_target(renderer* r, uint64_t key, render_target* rt,
+                           bool clear)
 {
-        glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+        assert(r);
+
+        render_command* c = add_command(r, command_set_target, key);
+        c->target.target = rt;
+        c->target.clear = clear;
+}
 
-        glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+void render_cmd_draw_quads(renderer* r, uint64_t key, texture* t,
+                           const quad_vertex* verts, uint32_t quad_count)
+{
+        assert(r);
+        assert(t);
+        assert(verts || quad_count == 0);
 
-        int num_sprites = sb_count(sprites_sb);
-        if (num_sprites == 0) {
+        if (quad_count == 0) {
                 return;
         }
 
-        glUseProgram(r->shader_program);
+        quad_vertex* dst = ARENA_ALLOC(&building_frame(r)->arena, quad_vertex,
+                                       quad_count * 4);
+        if (!dst) {
+                return;
+        }
+        memcpy(dst, verts, quad_count * 4 * sizeof(quad_vertex));
+
+        // Move the tex coords onto the atlas page now so the render
+        // thread can draw the quads as they are.
+        texture* page = texture_get_page(t);
+        if (page != t) {
+                float scale_u = (float)t->width / page->width;
+                float scale_v = (float)t->height / page->height;
+                float offset_u = (float)t->page_x / page->width;
+                float offset_v = (float)t->page_y / page->height;
+                for (uint32_t i = 0; i < quad_count * 4; ++i) {
+                        dst[i].u = offset_u + dst[i].u * scale_u;
+                        dst[i].v = offset_v + dst[i].v * scale_v;
+                }
+        }
 
-        // Set the camera transfrom
-        GLint cam_uniform = glGetUniformLocation(r->shader_program, "cam");
-        kmMat4* cam_mat = cam_transform();
-        glUniformMatrix4fv(cam_uniform, 1, GL_FALSE, cam_mat->mat);
+        render_command* c = add_command(r, command_draw_quads, key);
+        c->quads.tex = page;
+        c->quads.verts = dst;
+        c->quads.count = quad_count;
+}
 
-        // Sprites are sorted by texture ID so render until texture 
-        // switch then render some more. Kick off the first sprite.
-        float* vert_sb = NULL;
-        float* tex_coord_sb = NULL; // todo hoist up to renderer to avoid allocs
-        for (int i = 0; i < num_sprites; ++i) {
-                sprite* s = &sprites_sb[i];
-                sprite* next = NULL;
-                if (i < num_sprites - 1) {
-                        next = &sprites_sb[i + 1];
-                }
+void render_cmd_draw_static_batch(renderer* r, uint64_t key, static_batch* b)
+{
+        assert(r);
+        assert(b);
+        add_command(r, command_draw_static_batch, key)->batch = b;
+}
 
-                vert_sb = calc_verts(s, vert_sb);
-                tex_coord_sb = calc_tex_coords(s, tex_coord_sb);
+render_shader* render_create_shader(renderer* r, const char* vert_shader_path,
+                                    const char* frag_shader_path)
+{
+        assert(r);
+        assert(vert_shader_path);
+        assert(frag_shader_path);
 
-                if (next == NULL || s->tex->id != next->tex->id) {
-                        // switch to new texture and draw
-                        if (!s->tex->uploaded) {
-                                upload_texture(r, s->tex);
-                        }
-                        switchTexture(r, s->tex);
-                        draw_buffers(r, vert_sb, tex_coord_sb);
-                        sb_reset(vert_sb);
-                        sb_reset(tex_coord_sb);
-                }
+        render_shader* sh = malloc(sizeof(*sh));
+        if (!sh) {
+                LOGERR("%s", "Failed to allocate shader");
+                return NULL;
         }
 
-        sb_free(vert_sb);
-        sb_free(tex_coord_sb);
+        sh->vert_shader_path = copy_string(vert_shader_path);
+        if (!sh->vert_shader_path) {
+                LOGERR("%s", "Failed to copy vertex shader path");
+                goto cleanup_shader;
+        }
 
-        glUseProgram(0);
-}
+        sh->frag_shader_path = copy_string(frag_shader_path);
+        if (!sh->frag_shader_path) {
+                LOGERR("%s", "Failed to copy fragment shader path");
+                goto cleanup_vert_path;
+        }
 
-float* calc_verts(sprite* s, float* vert_buffer)
-{
-        float tex_width = s->tex_rect.w == 0.0f ? s->tex->width : s->tex_rect.w;
-        float width = tex_width * s->scale;
+        // Only the render thread has a context so the shaders are
+        // compiled there the first time the shader is set.
+        sh->quads.program = 0;
+        sh->compiled = false;
+        sh->failed = false;
 
-        float tex_height = s->tex_rect.h == 0.0f ? s->tex->height : s->tex_rect.h;
-        float height = tex_height * s->scale;
+        return sh;
 
-        kmVec2 bl; // bottom left
-        bl.x = s->x_pos;
-        bl.y = s->y_pos;
+cleanup_vert_path:
+        free(sh->vert_shader_path);
+cleanup_shader:
+        free(sh);
+        return NULL;
+}
 
-        kmVec2 br; // bottom right
-        br.x = s->x_pos + width;
-        br.y = s->y_pos;
+void render_free_shader(renderer* r, render_shader* sh)
+{
+        assert(r);
+        assert(sh);
 
-        kmVec2 tl; // top left
-        tl.x = s->x_pos;
-        tl.y = s->y_pos + height;
+        // Frames in flight may still draw with the shader.
+        sb_push(building_frame(r)->freed_shader_sb, sh);
+}
 
-        kmVec2 tr; // top right
-        tr.x = s->x_pos + width;
-        tr.y = s->y_pos + height;
+render_target* render_create_target(renderer* r, int32_t width, int32_t height)
+{
+        assert(r);
+        assert(width > 0 && height > 0);
 
-        if (s->rotation != 0.0f) {
-                kmVec2 anchor;
-                anchor.x = s->x_anchor;
-                anchor.y = s->y_anchor;
-                kmVec2RotateBy(&bl, &bl, s->rotation, &anchor);
-                kmVec2RotateBy(&br, &br, s->rotation, &anchor);
-                kmVec2RotateBy(&tl, &tl, s->rotation, &anchor);
-                kmVec2RotateBy(&tr, &tr, s->rotation, &anchor);
+        render_target* rt = malloc(sizeof(*rt));
+        if (!rt) {
+                LOGERR("%s", "Failed to allocate render target");
+                return NULL;
         }
-        sb_push(vert_buffer, bl.x);
-        sb_push(vert_buffer, bl.y);
-        sb_push(vert_buffer, tl.x);
-        sb_push(vert_buffer, tl.y);
-        sb_push(vert_buffer, tr.x);
-        sb_push(vert_buffer, tr.y);
-        sb_push(vert_buffer, bl.x);
-        sb_push(vert_buffer, bl.y);
-        sb_push(vert_buffer, tr.x);
-        sb_push(vert_buffer, tr.y);
-        sb_push(vert_buffer, br.x);
-        sb_push(vert_buffer, br.y);
 
-        return vert_buffer;
+        // Targets take IDs from the top of the range so they never share
+        // one with a texture loaded from a file.
+        texture* t = &rt->tex;
+        memset(t, 0, sizeof(*t));
+        t->id = r->next_target_id--;
+        t->width = width;
+        t->height = height;
+        t->channels = 4;
+        t->state = texture_loaded;
+
+        // The framebuffer is created on the render thread the first
+        // time the target is set.
+        rt->fbo = 0;
+        rt->created = false;
+        rt->failed = false;
+
+        return rt;
 }
 
-float* calc_tex_coords(sprite* s, float* tex_coord_buffer)
+void render_free_target(renderer* r, render_target* rt)
 {
-        float tex_width = (float)s->tex->width;
-        float tex_height = (float)s->tex->height;
-        float x = s->tex_rect.x;
-        float y = s->tex_rect.y;
-        float w = s->tex_rect.w == 0.0f ? tex_width : s->tex_rect.w;
-        float h = s->tex_rect.h == 0.0f ? tex_height : s->tex_rect.h;
-
-        float tex_bot = (y + h) / tex_height;
-        float tex_top = y / tex_height;
-        float tex_left = s->flip_x ? ((x + w) / tex_width) : (x / tex_width);
-        float tex_right = s->flip_x ? (x / tex_width) : ((x + w) / tex_width);
+        assert(r);
+        assert(rt);
 
-        sb_push(tex_coord_buffer, tex_left);
-        sb_push(tex_coord_buffer, tex_bot);
-        sb_push(tex_coord_buffer, tex_left);
-        sb_push(tex_coord_buffer, tex_top);
-        sb_push(tex_coord_buffer, tex_right);
-        sb_push(tex_coord_buffer, tex_top);
-        sb_push(tex_coord_buffer, tex_left);
-        sb_push(tex_coord_buffer, tex_bot);
-        sb_push(tex_coord_buffer, tex_right);
-        sb_push(tex_coord_buffer, tex_top);
-        sb_push(tex_coord_buffer, tex_right);
-        sb_push(tex_coord_buffer, tex_bot);
+        // Frames in flight may still draw into or with the target.
+        sb_push(building_frame(r)->freed_target_sb, rt);
+}
 
-        return tex_coord_buffer;
+texture* render_target_texture(render_target* rt)
+{
+        assert(rt);
+        return &rt->tex;
 }
 
-void draw_buffers(renderer* r, float* vert_sb, float* tex_coord_sb)
+void render_submit(renderer* r)
 {
-        int vert_count = sb_count(vert_sb);
-        uint32_t vert_data_size = vert_count * sizeof(float);
-        GLuint gl_vert_buffer = make_buffer(GL_ARRAY_BUFFER,
-                                            vert_sb, vert_data_size);
+        assert(r);
 
-        glBindBuffer(GL_ARRAY_BUFFER, gl_vert_buffer);
-        glEnableVertexAttribArray(r->vert_attrib);
-        glVertexAttribPointer(r->vert_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // The render thread draws the frame with the camera as it is
+        // now rather than reading it while gameplay moves it.
+        building_frame(r)->cam = *cam_transform();
 
-        uint32_t tex_data_size = sb_count(tex_coord_sb) * sizeof(float);
-        GLuint gl_tex_buffer = make_buffer(GL_ARRAY_BUFFER,
-                                           tex_coord_sb, tex_data_size);
+        // Hand the frame over and move on to the next one.
+        atomic_add_i32(&r->submitted, 1);
+        wake_queue(r);
 
-        glBindBuffer(GL_ARRAY_BUFFER, gl_tex_buffer);
-        glEnableVertexAttribArray(r->tex_coord_attrib);
-        glVertexAttribPointer(r->tex_coord_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
-        glBindBuffer(GL_ARRAY_BUFFER, 0);
+        // Only blocks when the render thread is still working through
+        // every other frame in the queue.
+        wait_for_queue(r, frame_free);
 
-        glDrawArrays(GL_TRIANGLES, 0, vert_count / 2);
+        // Nothing can draw the textures released while the frame now
+        // being added to was last built.
+        release_textures(r, building_frame(r));
+}
 
-        glDeleteBuffers(1, &gl_vert_buffer);
-        glDeleteBuffers(1, &gl_tex_buffer);
-        glDisableVertexAttribArray(r->vert_attrib);
-        glDisableVertexAttribArray(r->tex_coord_attrib);
+uint64_t make_sort_key(const sprite_buffer* sprites, uint32_t index)
+{
+        return render_make_key(sprites->depth_sb[index],
+                               sprites->page_id_sb[index]) | index;
 }
 
-bool upload_texture(renderer* r, texture* t)
+uint32_t __stdcall render_func(void* data)
 {
-        assert(t);
+        renderer* r = (renderer*)data;
 
-        if (t->uploaded) {
-                return true;
+        if (!r->headless) {
+                glfwMakeContextCurrent(r->window);
         }
 
-        glGenTextures(1, &t->gl_id);
-        glBindTexture(GL_TEXTURE_2D, t->gl_id);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, t->width, t->height, 0,
-                     GL_RGBA, GL_UNSIGNED_BYTE, t->data);
-        glBindTexture(GL_TEXTURE_2D, 0);
+        for (;;) {
+                wait_for_queue(r, frame_ready);
+                if (atomic_load_i32(&r->done)) {
+                        break;
+                }
 
-        if (check_gl_error()) {
-                LOGERR("%s", "A GL error occurred when loading texture");
-                return false;
+                uint32_t rendered = (uint32_t)atomic_load_i32(&r->rendered);
+                render_frame* f = &r->frames[rendered % r->frames_in_flight];
+                if (f->resized && !r->headless) {
+                        resize_viewport(r, f->width, f->height);
+                }
+
+                int64_t start = timer_now_us();
+                r->stats.frame = rendered;
+                r->stats.sprites = sprite_buffer_count(&f->sprites);
+                r->stats.commands = sb_count(f->command_sb);
+
+                uint64_t* keys;
+                uint32_t keys_len = prepare_frame(r, f, &keys);
+                int64_t sorted = timer_now_us();
+
+                begin_gpu_timer(r, rendered);
+                draw_frame(r, f, keys, keys_len);
+                end_gpu_timer(r);
+                int64_t drawn = timer_now_us();
+
+                r->stats.sort_ms = us_to_ms(sorted - start);
+                r->stats.vertex_ms = us_to_ms(r->vertex_us);
+                r->stats.submit_ms = us_to_ms(drawn - sorted - r->vertex_us);
+
+                // The frame can be reused by gameplay as soon as it has
+                // been drawn, before waiting on the swap. It takes the
+                // stats of the last complete frame with it.
+                f->stats = r->last_stats;
+                release_frame(r, f);
+                atomic_store_i32(&r->rendered, (int32_t)(rendered + 1));
+                wake_queue(r);
+
+                if (!r->headless) {
+                        int64_t swap_start = timer_now_us();
+                        glfwSwapBuffers(r->window);
+                        r->stats.swap_ms = us_to_ms(timer_now_us() - swap_start);
+
+                        if (check_gl_error()) {
+                                LOGERR("%s", "An GL error occurred when rendering");
+                        }
+                }
+
+                finish_stats(r);
         }
 
-        t->uploaded = true;
+        if (!r->headless) {
+                glfwMakeContextCurrent(NULL);
+        }
 
-        return true;
+        return 0;
+}
+
+// Returns the frame gameplay is currently adding to.
+render_frame* building_frame(renderer* r)
+{
+        uint32_t submitted = (uint32_t)atomic_load_i32(&r->submitted);
+        return &r->frames[submitted % r->frames_in_flight];
+}
+
+// Returns true if a submitted frame is waiting to be drawn or the
+// render thread should stop.
+bool frame_ready(renderer* r)
+{
+        return atomic_load_i32(&r->done) ||
+               atomic_load_i32(&r->submitted) != atomic_load_i32(&r->rendered);
+}
+
+// Returns true if the frame gameplay is adding to isn't still queued
+// up for the render thread.
+bool frame_free(renderer* r)
+{
+        uint32_t submitted = (uint32_t)atomic_load_i32(&r->submitted);
+        uint32_t rendered = (uint32_t)atomic_load_i32(&r->rendered);
+        return submitted - rendered < r->frames_in_flight;
+}
+
+// Returns true if the render thread has drawn every submitted frame.
+bool frame_idle(renderer* r)
+{
+        return atomic_load_i32(&r->submitted) == atomic_load_i32(&r->rendered);
+}
+
+// Blocks until ready returns true. The other side of the queue usually
+// catches up quickly so it spins for a bit before going to sleep.
+void wait_for_queue(renderer* r, bool (*ready)(renderer*))
+{
+        for (uint32_t i = 0; i < QUEUE_SPIN_COUNT; ++i) {
+                if (ready(r)) {
+                        return;
+                }
+                thread_yield();
+        }
+
+        // Anyone changing the queue checks waiting after changing it so
+        // either they see this thread waiting or it sees their change.
+        atomic_add_i32(&r->waiting, 1);
+        mutex_lock(r->render_mutex);
+        while (!ready(r)) {
+                condition_var_wait(r->render_condition, r->render_mutex);
+        }
+        mutex_unlock(r->render_mutex);
+        atomic_add_i32(&r->waiting, -1);
+}
+
+// Wakes the other side of the queue if it is asleep in wait_for_queue.
+void wake_queue(renderer* r)
+{
+        if (atomic_load_i32(&r->waiting) > 0) {
+                mutex_lock(r->render_mutex);
+                condition_var_notify_all(r->render_condition);
+                mutex_unlock(r->render_mutex);
+        }
+}
+
+// Deletes the GL objects released while the frame was being built and
+// empties it so gameplay can start adding to it again.
+void release_frame(renderer* r, render_frame* f)
+{
+        if (!r->headless && sb_count(f->deleted_texture_sb) > 0) {
+                glDeleteTextures(sb_count(f->deleted_texture_sb),
+                                 f->deleted_texture_sb);
+                for (int32_t i = 0; i < sb_count(f->deleted_texture_sb); ++i) {
+                        forget_texture(r, f->deleted_texture_sb[i]);
+                }
+        }
+        for (int32_t i = 0; i < sb_count(f->freed_batch_sb); ++i) {
+                free_static_batch(r, f->freed_batch_sb[i]);
+        }
+        for (int32_t i = 0; i < sb_count(f->freed_shader_sb); ++i) {
+                free_shader(r, f->freed_shader_sb[i]);
+        }
+        for (int32_t i = 0; i < sb_count(f->freed_target_sb); ++i) {
+                free_target(r, f->freed_target_sb[i]);
+        }
+
+        sprite_buffer_reset(&f->sprites);
+        sb_reset(f->static_batch_sb);
+        sb_reset(f->command_sb);
+        arena_reset(&f->arena);
+        sb_reset(f->deleted_texture_sb);
+        sb_reset(f->freed_batch_sb);
+        sb_reset(f->freed_shader_sb);
+        sb_reset(f->freed_target_sb);
+        f->resized = false;
+}
+
+// Hands back the textures released while the frame was being built.
+// Only called by gameplay, once the frame has been drawn.
+void release_textures(renderer* r, render_frame* f)
+{
+        for (int32_t i = 0; i < sb_count(f->released_texture_sb); ++i) {
+                released_texture rt = f->released_texture_sb[i];
+                rt.release(rt.tex, r);
+        }
+        sb_reset(f->released_texture_sb);
+}
+
+// Starts timing the GL commands of the frame on the GPU. Frames are
+// left untimed rather than waiting on a query the GPU hasn't finished.
+void begin_gpu_timer(renderer* r, uint32_t frame)
+{
+        if (!r->gpu_timing || r->headless) {
+                return;
+        }
+
+        read_gpu_timers(r);
+
+        uint32_t i = frame % GPU_QUERY_COUNT;
+        if (r->gpu_query_pending[i]) {
+                return;
+        }
+
+        glBeginQuery(GL_TIME_ELAPSED, r->gpu_queries[i]);
+        r->gpu_query_frames[i] = frame;
+        r->gpu_query_pending[i] = true;
+        r->gpu_query_active = true;
+}
+
+void end_gpu_timer(renderer* r)
+{
+        if (r->gpu_query_active) {
+                glEndQuery(GL_TIME_ELAPSED);
+                r->gpu_query_active = false;
+        }
+}
+
+// Takes the GPU time of the latest frame whose query has finished.
+void read_gpu_timers(renderer* r)
+{
+        for (uint32_t i = 0; i < GPU_QUERY_COUNT; ++i) {
+                if (!r->gpu_query_pending[i]) {
+                        continue;
+                }
+
+                GLint available = 0;
+                glGetQueryObjectiv(r->gpu_queries[i], GL_QUERY_RESULT_AVAILABLE,
+                                   &available);
+                if (!available) {
+                        continue;
+                }
+
+                GLuint64 ns = 0;
+                glGetQueryObjectui64v(r->gpu_queries[i], GL_QUERY_RESULT, &ns);
+                r->gpu_query_pending[i] = false;
+
+                // Queries can finish out of the order they are checked in.
+                uint32_t frame = r->gpu_query_frames[i];
+                if (r->stats.gpu_ms < 0.0f || frame > r->stats.gpu_frame) {
+                        r->stats.gpu_ms = (float)((double)ns / 1000000.0);
+                        r->stats.gpu_frame = frame;
+                }
+        }
+}
+
+// Makes the stats of the frame just drawn the last complete stats and
+// starts counting the next frame from zero. The GPU time is kept until
+// a newer one comes in.
+void finish_stats(renderer* r)
+{
+        r->last_stats = r->stats;
+
+        float gpu_ms = r->stats.gpu_ms;
+        uint32_t gpu_frame = r->stats.gpu_frame;
+        memset(&r->stats, 0, sizeof(r->stats));
+        r->stats.gpu_ms = gpu_ms;
+        r->stats.gpu_frame = gpu_frame;
+        r->vertex_us = 0;
+}
+
+float us_to_ms(int64_t us)
+{
+        return (float)((double)us / 1000.0);
+}
+
+// Frees the static batch and its GL buffer.
+void free_static_batch(renderer* r, static_batch* b)
+{
+        if (b->uploaded && !r->headless) {
+                glDeleteBuffers(1, &b->gl_id);
+                if (r->array_buffer == b->gl_id) {
+                        r->array_buffer = 0;
+                }
+        }
+
+        sb_free(b->run_sb);
+        free(b->data);
+        free(b);
+}
+
+// Frees the shader and its program.
+void free_shader(renderer* r, render_shader* sh)
+{
+        if (sh->compiled && !r->headless) {
+                if (r->bound_program == sh->quads.program) {
+                        glUseProgram(0);
+                        r->bound_program = 0;
+                }
+                glDeleteProgram(sh->quads.program);
+        }
+
+        free(sh->vert_shader_path);
+        free(sh->frag_shader_path);
+        free(sh);
+}
+
+// Frees the render target, its framebuffer and its texture.
+void free_target(renderer* r, render_target* rt)
+{
+        if (!r->headless) {
+                if (rt->created) {
+                        glDeleteFramebuffers(1, &rt->fbo);
+                }
+                if (rt->tex.uploaded) {
+                        glDeleteTextures(1, &rt->tex.gl_id);
+                        forget_texture(r, rt->tex.gl_id);
+                }
+        }
+
+        free(rt);
+}
+
+// Works out the order to draw the frame in.
+// Sets sorted_keys to the sort keys for each sprite and static batch run
+// in draw order.
+// Returns the number of sort keys.
+uint32_t prepare_frame(renderer* r, render_frame* f, uint64_t** sorted_keys)
+{
+        sprite_buffer* sprites = &f->sprites;
+        uint32_t num_sprites = sprite_buffer_count(sprites);
+        uint32_t num_commands = sb_count(f->command_sb);
+        static_batch** batches = f->static_batch_sb;
+
+        uint32_t num_runs = 0;
+        for (int32_t i = 0; i < sb_count(batches); ++i) {
+                num_runs += sb_count(batches[i]->run_sb);
+        }
+
+        *sorted_keys = NULL;
+        uint32_t num_keys = num_commands + num_sprites + num_runs;
+        if (num_keys == 0) {
+                return 0;
+        }
+
+        // Everything is counted up front so the keys come straight out
+        // of the frame's arena.
+        uint64_t* keys = ARENA_ALLOC(&f->arena, uint64_t, num_keys);
+        uint64_t* scratch = ARENA_ALLOC(&f->arena, uint64_t, num_keys);
+        r->static_runs = ARENA_ALLOC(&f->arena, static_run*, num_runs);
+        if (!keys || !scratch || (num_runs > 0 && !r->static_runs)) {
+                return 0;
+        }
+
+        // Commands go in first so they run before sprites and static
+        // batches with the same key.
+        uint64_t* key = keys;
+        for (uint32_t i = 0; i < num_commands; ++i) {
+                uint64_t cmd_key = f->command_sb[i].key & 0xffffffff00000000ULL;
+                *key++ = cmd_key | i | SORT_KEY_COMMAND;
+        }
+
+        for (uint32_t i = 0; i < num_sprites; ++i) {
+                *key++ = make_sort_key(sprites, i);
+        }
+
+        // Static batches are sorted in by run after all the sprites.
+        uint32_t run = 0;
+        for (int32_t i = 0; i < sb_count(batches); ++i) {
+                static_batch* b = batches[i];
+                for (int32_t j = 0; j < sb_count(b->run_sb); ++j) {
+                        r->static_runs[run] = &b->run_sb[j];
+                        *key++ = b->run_sb[j].key | run | SORT_KEY_STATIC;
+                        ++run;
+                }
+        }
+
+        // Sort by depth and then texture ID to minimize the number of
+        // texture switches we have to do. Keys are already in index
+        // order so the low 4 bytes don't need sorting.
+        *sorted_keys = radix_sort_u64(keys, scratch, num_keys, 4);
+
+        return num_keys;
+}
+
+void draw_frame(renderer* r, render_frame* f,
+                uint64_t* keys, uint32_t keys_len)
+{
+        if (!r->headless) {
+                glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+
+                glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+
+                // Programs pick up the camera as they are bound.
+                if (memcmp(&r->cam, &f->cam, sizeof(kmMat4)) != 0) {
+                        r->cam = f->cam;
+                        r->uniform_serial++;
+                }
+        }
+
+        if (keys_len == 0) {
+                return;
+        }
+
+        // Sprites are sorted by texture ID so find each run of sprites
+        // sharing a texture and draw it as a single batch. Static batch
+        // runs are already on the GPU and are drawn as they come up, as
+        // are commands.
+        sprite_buffer* sprites = &f->sprites;
+        uint32_t batch_start = 0;
+        for (uint32_t i = 0; i < keys_len; ++i) {
+                if (SORT_KEY_IS_STATIC(keys[i])) {
+                        uint32_t run = SORT_KEY_INDEX(keys[i]) & ~SORT_KEY_TAGS;
+                        draw_static_run(r, r->static_runs[run]);
+                        batch_start = i + 1;
+                        continue;
+                }
+                if (SORT_KEY_IS_COMMAND(keys[i])) {
+                        uint32_t command = SORT_KEY_INDEX(keys[i]) & ~SORT_KEY_TAGS;
+                        run_command(r, f, &f->command_sb[command]);
+                        batch_start = i + 1;
+                        continue;
+                }
+
+                if (i < keys_len - 1 && SORT_KEY_IS_SPRITE(keys[i + 1]) &&
+                    SORT_KEY_TEXTURE(keys[i]) == SORT_KEY_TEXTURE(keys[i + 1])) {
+                        continue;
+                }
+
+                // switch to new texture and draw
+                bind_sprite_program(r);
+                uint32_t index = SORT_KEY_INDEX(keys[i]);
+                texture* page = texture_get_page(
+                        sprites->textures_sb[sprites->tex_sb[index]]);
+                if (!bind_texture(r, page)) {
+                        batch_start = i + 1;
+                        continue;
+                }
+                // The batch's textures are looked up once here rather
+                // than for each of its sprites.
+                sprite_buffer_resolve(sprites, page);
+                r->stats.batches++;
+                if (r->mode == render_mode_instanced) {
+                        draw_instanced_batch(r, sprites, &keys[batch_start],
+                                             i + 1 - batch_start);
+                } else {
+                        draw_batch(r, sprites, &keys[batch_start],
+                                   i + 1 - batch_start);
+                }
+                batch_start = i + 1;
+        }
+
+        // Commands only last for the frame. This also makes sure the
+        // frame ends up on the screen.
+        reset_state(r);
+
+        // Everything else is left bound for the next frame.
+        if (!r->headless) {
+                stream_buffer_end_frame(r->vertex_stream);
+                if (!stream_buffer_persistent(r->vertex_stream)) {
+                        r->array_buffer = stream_buffer_id(r->vertex_stream);
+                }
+        }
+}
+
+// Adds a command to the frame being built.
+render_command* add_command(renderer* r, command_type type, uint64_t key)
+{
+        render_command* c = sb_add(building_frame(r)->command_sb, 1);
+        c->type = type;
+        c->key = key;
+        return c;
+}
+
+// Runs a command on the render thread.
+void run_command(renderer* r, render_frame* f, const render_command* c)
+{
+        switch (c->type) {
+        case command_set_blend:
+                set_blend(r, c->blend);
+                break;
+        case command_set_shader:
+                set_shader(r, c->shader);
+                break;
+        case command_set_scissor:
+                set_scissor(r, c->scissor.enabled, &c->scissor.area);
+                break;
+        case command_set_target:
+                set_target(r, c->target.target, c->target.clear);
+                break;
+        case command_draw_quads:
+                bind_quad_program(r);
+                if (bind_texture(r, c->quads.tex)) {
+                        r->stats.batches++;
+                        draw_quads(r, c->quads.verts, c->quads.count);
+                }
+                break;
+        case command_draw_static_batch:
+                for (int32_t i = 0; i < sb_count(c->batch->run_sb); ++i) {
+                        draw_static_run(r, &c->batch->run_sb[i]);
+                }
+                break;
+        }
+}
+
+// Puts back the state every frame starts with.
+void reset_state(renderer* r)
+{
+        set_blend(r, render_blend_alpha);
+        set_shader(r, NULL);
+        set_scissor(r, false, NULL);
+        set_target(r, NULL, false);
+}
+
+void set_blend(renderer* r, render_blend blend)
+{
+        if (r->blend == blend) {
+                return;
+        }
+        r->blend = blend;
+
+        if (r->headless) {
+                return;
+        }
+
+        if (blend == render_blend_opaque) {
+                glDisable(GL_BLEND);
+                return;
+        }
+
+        glEnable(GL_BLEND);
+        switch (blend) {
+        case render_blend_additive:
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE);
+                break;
+        case render_blend_premultiplied:
+                glBlendFunc(GL_ONE, GL_ONE_MINUS_SRC_ALPHA);
+                break;
+        default:
+                glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+                break;
+        }
+}
+
+// Makes quads draw with the shader, compiling it if this is the first
+// time it is used. Shaders that fail to compile draw with the default.
+void set_shader(renderer* r, render_shader* sh)
+{
+        if (r->shader == sh) {
+                return;
+        }
+        r->shader = sh;
+        r->quads = &r->default_quads;
+
+        if (!sh || sh->failed || r->headless) {
+                return;
+        }
+
+        if (!sh->compiled) {
+                if (!make_quad_program(&sh->quads, sh->vert_shader_path,
+                                       sh->frag_shader_path)) {
+                        LOGERR("Failed to compile shader %s %s",
+                               sh->vert_shader_path, sh->frag_shader_path);
+                        sh->failed = true;
+                        return;
+                }
+                sh->compiled = true;
+        }
+        r->quads = &sh->quads;
+}
+
+// Clips drawing to area, which is in virtual coordinates, if enabled.
+void set_scissor(renderer* r, bool enabled, const rect* area)
+{
+        if (!enabled) {
+                if (r->scissor_enabled) {
+                        r->scissor_enabled = false;
+                        if (!r->headless) {
+                                glDisable(GL_SCISSOR_TEST);
+                        }
+                }
+                return;
+        }
+
+        if (r->scissor_enabled &&
+            memcmp(&r->scissor, area, sizeof(rect)) == 0) {
+                return;
+        }
+        if (!r->scissor_enabled && !r->headless) {
+                glEnable(GL_SCISSOR_TEST);
+        }
+        r->scissor_enabled = true;
+        r->scissor = *area;
+        if (!r->headless) {
+                set_viewport(r);
+        }
+}
+
+// Makes everything draw into the target, or the screen if it is NULL,
+// creating the target's framebuffer if this is the first time it is set.
+void set_target(renderer* r, render_target* rt, bool clear)
+{
+        if (rt && !rt->created) {
+                if (rt->failed || !create_target(r, rt)) {
+                        rt->failed = true;
+                        return;
+                }
+        }
+
+        if (r->target != rt) {
+                r->target = rt;
+                if (!r->headless) {
+                        glBindFramebuffer(GL_FRAMEBUFFER, rt ? rt->fbo : 0);
+                        set_viewport(r);
+                }
+        }
+
+        if (clear && !r->headless) {
+                glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+                glClear(GL_COLOR_BUFFER_BIT);
+        }
+}
+
+// Sets the viewport and scissor box for the current target. Targets are
+// drawn to as a whole while the screen is letterboxed.
+void set_viewport(renderer* r)
+{
+        int32_t x = r->viewport[0];
+        int32_t y = r->viewport[1];
+        int32_t w = r->viewport[2];
+        int32_t h = r->viewport[3];
+        if (r->target) {
+                x = 0;
+                y = 0;
+                w = r->target->tex.width;
+                h = r->target->tex.height;
+        }
+        glViewport(x, y, w, h);
+
+        if (r->scissor_enabled) {
+                float scale_x = (float)w / r->virtual_width;
+                float scale_y = (float)h / r->virtual_height;
+                glScissor(x + (GLint)(r->scissor.x * scale_x),
+                          y + (GLint)(r->scissor.y * scale_y),
+                          (GLsizei)(r->scissor.w * scale_x),
+                          (GLsizei)(r->scissor.h * scale_y));
+        }
+}
+
+// Makes the program current and uploads the projection and camera to
+// it if they have changed since it was last bound.
+void bind_program(renderer* r, GLuint program, program_uniforms* u)
+{
+        if (r->headless) {
+                return;
+        }
+
+        if (r->bound_program != program) {
+                glUseProgram(program);
+                r->bound_program = program;
+        }
+
+        // Uniforms keep their values while other programs are in use.
+        if (u->serial == r->uniform_serial) {
+                return;
+        }
+        if (u->serial == 0) {
+                glUniform1i(u->texture, r->tex_unit);
+        }
+        glUniformMatrix4fv(u->projection, 1, GL_FALSE, r->projection.mat);
+        glUniformMatrix4fv(u->cam, 1, GL_FALSE, r->cam.mat);
+        u->serial = r->uniform_serial;
+}
+
+// Binds the program sprites are drawn with.
+void bind_sprite_program(renderer* r)
+{
+        if (r->mode == render_mode_instanced) {
+                bind_program(r, r->shader_program, &r->sprite_uniforms);
+                return;
+        }
+        bind_quad_program(r);
+}
+
+// Binds the program quads are drawn with.
+void bind_quad_program(renderer* r)
+{
+        bind_program(r, r->quads->program, &r->quads->uniforms);
+}
+
+// Binds the GL texture to tex_unit.
+void bind_gl_texture(renderer* r, GLuint gl_id)
+{
+        if (r->bound_texture != gl_id) {
+                glBindTexture(GL_TEXTURE_2D, gl_id);
+                r->bound_texture = gl_id;
+        }
+}
+
+// Binds the buffer to GL_ARRAY_BUFFER or GL_ELEMENT_ARRAY_BUFFER.
+void bind_buffer(renderer* r, GLenum target, GLuint buffer)
+{
+        GLuint* bound = target == GL_ARRAY_BUFFER ?
+                        &r->array_buffer : &r->element_buffer;
+        if (*bound != buffer) {
+                glBindBuffer(target, buffer);
+                *bound = buffer;
+        }
+}
+
+// Enables exactly the attribute arrays in enabled and gives those in
+// instanced a divisor of 1 and the rest of enabled a divisor of 0.
+// Divisors of disabled attributes are left as they are.
+void set_attribs(renderer* r, uint32_t enabled, uint32_t instanced)
+{
+        uint32_t changed = r->enabled_attribs ^ enabled;
+        uint32_t divisors = (r->instanced_attribs & ~enabled) | (instanced & enabled);
+        uint32_t changed_divisors = r->instanced_attribs ^ divisors;
+
+        for (GLuint i = 0; changed | changed_divisors; ++i) {
+                uint32_t bit = 1u << i;
+                if (changed & bit) {
+                        if (enabled & bit) {
+                                glEnableVertexAttribArray(i);
+                        } else {
+                                glDisableVertexAttribArray(i);
+                        }
+                }
+                if (changed_divisors & bit) {
+                        glVertexAttribDivisor(i, (divisors & bit) ? 1 : 0);
+                }
+                changed &= ~bit;
+                changed_divisors &= ~bit;
+        }
+
+        r->enabled_attribs = enabled;
+        r->instanced_attribs = divisors;
+}
+
+// Returns the bit for the attribute in an attribute mask, or 0 if the
+// program doesn't use it.
+uint32_t attrib_bit(GLuint attrib)
+{
+        return attrib < 32 ? 1u << attrib : 0;
+}
+
+// Drops a deleted texture from the state cache as GL may give its name
+// to a new texture.
+void forget_texture(renderer* r, GLuint gl_id)
+{
+        if (r->bound_texture == gl_id) {
+                r->bound_texture = 0;
+        }
+        if (r->tex_size_texture == gl_id) {
+                r->tex_size_texture = 0;
+        }
+}
+
+// Copies the quads into the vertex stream and draws them.
+void draw_quads(renderer* r, const quad_vertex* verts, uint32_t quad_count)
+{
+        uint32_t quad_size = 4 * sizeof(quad_vertex);
+        uint32_t max_quads = VERTEX_STREAM_REGION_SIZE / quad_size;
+        if (max_quads > MAX_QUADS_PER_DRAW) {
+                max_quads = MAX_QUADS_PER_DRAW;
+        }
+
+        while (quad_count > 0) {
+                uint32_t count = quad_count < max_quads ? quad_count : max_quads;
+                uint32_t size = count * quad_size;
+
+                uint32_t offset;
+                void* dst = alloc_vertices(r, size, &offset);
+                if (!dst) {
+                        return;
+                }
+                memcpy(dst, verts, size);
+
+                if (!r->headless) {
+                        commit_vertices(r, offset, size);
+                        draw_buffers(r, stream_buffer_id(r->vertex_stream),
+                                     offset, count);
+                }
+
+                verts += count * 4;
+                quad_count -= count;
+        }
+}
+
+// Compiles and links a program that draws quads built on the CPU.
+// Returns false if the shaders fail to compile or link.
+bool make_quad_program(quad_program* qp, const char* vert_shader_path,
+                       const char* frag_shader_path)
+{
+        GLuint vert_shader = make_shader(GL_VERTEX_SHADER, vert_shader_path);
+        if (vert_shader == 0) {
+                return false;
+        }
+
+        GLuint frag_shader = make_shader(GL_FRAGMENT_SHADER, frag_shader_path);
+        if (frag_shader == 0) {
+                glDeleteShader(vert_shader);
+                return false;
+        }
+
+        // The shaders are only needed until the program is linked.
+        GLuint program = make_program(vert_shader, frag_shader);
+        glDeleteShader(vert_shader);
+        glDeleteShader(frag_shader);
+        if (program == 0) {
+                return false;
+        }
+
+        init_quad_program(qp, program);
+        return true;
+}
+
+// Looks up the attributes of a program that draws quads built on the CPU.
+void init_quad_program(quad_program* qp, GLuint program)
+{
+        qp->program = program;
+        qp->vert_attrib = glGetAttribLocation(program, "vertex");
+        qp->tex_coord_attrib = glGetAttribLocation(program, "tex_coord");
+        init_uniforms(&qp->uniforms, program);
+}
+
+// Looks up the uniforms every program that draws sprites or quads has.
+void init_uniforms(program_uniforms* u, GLuint program)
+{
+        u->projection = glGetUniformLocation(program, "projection");
+        u->cam = glGetUniformLocation(program, "cam");
+        u->texture = glGetUniformLocation(program, "sprite_texture");
+        u->serial = 0;
+}
+
+// Creates the target's texture and framebuffer.
+// Returns false if the framebuffer isn't complete.
+bool create_target(renderer* r, render_target* rt)
+{
+        if (r->headless) {
+                rt->tex.uploaded = true;
+                rt->created = true;
+                return true;
+        }
+
+        // The texture has no data so this just allocates it.
+        if (!upload_texture(r, &rt->tex)) {
+                return false;
+        }
+
+        glGenFramebuffers(1, &rt->fbo);
+        glBindFramebuffer(GL_FRAMEBUFFER, rt->fbo);
+        glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0,
+                               GL_TEXTURE_2D, rt->tex.gl_id, 0);
+        GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+        glBindFramebuffer(GL_FRAMEBUFFER, r->target ? r->target->fbo : 0);
+
+        if (status != GL_FRAMEBUFFER_COMPLETE) {
+                LOGERR("Render target framebuffer is incomplete: %d", status);
+                glDeleteFramebuffers(1, &rt->fbo);
+                rt->fbo = 0;
+                return false;
+        }
+
+        rt->created = true;
+        return true;
+}
+
+// Uploads the texture if needed and makes it the current texture.
+// Returns false if the texture can't be drawn with yet because it is
+// still loading or failed to load.
+bool bind_texture(renderer* r, texture* t)
+{
+        // Uploading binds the texture too, so switches are counted
+        // against what was drawn with last.
+        GLuint drawn_texture = r->bound_texture;
+        if (!t->uploaded) {
+                if (texture_get_state(t) != texture_loaded ||
+                    !upload_texture(r, t)) {
+                        return false;
+                }
+        }
+
+        if (r->headless) {
+                return true;
+        }
+        bind_gl_texture(r, t->gl_id);
+        if (t->gl_id != drawn_texture) {
+                r->stats.texture_switches++;
+        }
+
+        if (r->mode == render_mode_instanced &&
+            r->bound_program == r->shader_program &&
+            r->tex_size_texture != t->gl_id) {
+                glUniform2f(r->tex_size_uniform,
+                            (float)t->width, (float)t->height);
+                r->tex_size_texture = t->gl_id;
+        }
+
+        return true;
+}
+
+// Draws a run of a static batch straight from its GPU buffer,
+// uploading the batch first if this is the first time it is drawn.
+void draw_static_run(renderer* r, static_run* run)
+{
+        static_batch* b = run->batch;
+        if (!b->uploaded && !upload_static_batch(r, b)) {
+                return;
+        }
+
+        bind_sprite_program(r);
+        if (!bind_texture(r, run->tex)) {
+                return;
+        }
+        r->stats.batches++;
+        r->stats.static_sprites += run->count;
+
+        if (r->headless) {
+                return;
+        }
+
+        if (r->mode == render_mode_instanced) {
+                draw_instances(r, b->gl_id, run->first * sizeof(sprite_instance),
+                               run->count);
+                return;
+        }
+
+        // Quads are limited per draw by the 16 bit quad indices.
+        uint32_t drawn = 0;
+        while (drawn < run->count) {
+                uint32_t count = run->count - drawn;
+                if (count > MAX_QUADS_PER_DRAW) {
+                        count = MAX_QUADS_PER_DRAW;
+                }
+
+                uint32_t offset = (run->first + drawn) * 4 * sizeof(quad_vertex);
+                draw_buffers(r, b->gl_id, offset, count);
+                drawn += count;
+        }
+}
+
+// Copies the static batch's vertex data into a GL buffer and frees
+// the CPU copy.
+// Returns false if a GL error occurred.
+bool upload_static_batch(renderer* r, static_batch* b)
+{
+        if (r->headless) {
+                goto uploaded;
+        }
+
+        glGenBuffers(1, &b->gl_id);
+        bind_buffer(r, GL_ARRAY_BUFFER, b->gl_id);
+        glBufferData(GL_ARRAY_BUFFER, b->data_size, b->data, GL_STATIC_DRAW);
+        r->stats.bytes_uploaded += b->data_size;
+
+        if (check_gl_error()) {
+                LOGERR("%s", "A GL error occurred when uploading static batch");
+                glDeleteBuffers(1, &b->gl_id);
+                r->array_buffer = 0;
+                return false;
+        }
+
+uploaded:
+        free(b->data);
+        b->data = NULL;
+        b->uploaded = true;
+
+        return true;
+}
+
+// Writes the vertices for the sprites referenced by keys directly into
+// the vertex stream and draws them.
+void draw_batch(renderer* r, sprite_buffer* sprites,
+                const uint64_t* keys, int32_t keys_len)
+{
+        uint32_t sprite_size = 4 * sizeof(quad_vertex);
+        int32_t max_sprites = VERTEX_STREAM_REGION_SIZE / sprite_size;
+        if (max_sprites > MAX_QUADS_PER_DRAW) {
+                max_sprites = MAX_QUADS_PER_DRAW;
+        }
+
+        // Batches too big for a single draw are split up.
+        while (keys_len > 0) {
+                int32_t count = keys_len < max_sprites ? keys_len : max_sprites;
+                uint32_t verts_size = count * sprite_size;
+
+                uint32_t offset;
+                quad_vertex* verts = alloc_vertices(r, verts_size, &offset);
+                if (!verts) {
+                        return;
+                }
+
+                // Each sprite's vertices have a fixed place in the
+                // allocation so ranges can be filled in on any thread.
+                int64_t start = timer_now_us();
+                vertex_job job = { sprites, keys, verts };
+                jobs_parallel_for(calc_verts_range, &job,
+                                  count, MIN_SPRITES_PER_JOB);
+                r->vertex_us += timer_now_us() - start;
+
+                if (!r->headless) {
+                        commit_vertices(r, offset, verts_size);
+                        draw_buffers(r, stream_buffer_id(r->vertex_stream),
+                                     offset, count);
+                }
+
+                keys += count;
+                keys_len -= count;
+        }
+}
+
+// Reserves size bytes of vertex data from the vertex stream. Headless
+// renderers write every batch to the start of a scratch buffer instead.
+// Returns NULL if size is too big for the stream.
+void* alloc_vertices(renderer* r, uint32_t size, uint32_t* offset)
+{
+        if (!r->headless) {
+                void* data = stream_buffer_alloc(r->vertex_stream, size, offset);
+                if (!stream_buffer_persistent(r->vertex_stream)) {
+                        r->array_buffer = stream_buffer_id(r->vertex_stream);
+                }
+                return data;
+        }
+
+        assert(size <= VERTEX_STREAM_REGION_SIZE);
+        *offset = 0;
+        return r->headless_vertices;
+}
+
+// Makes the vertex data written to an allocation from alloc_vertices
+// visible to GL.
+void commit_vertices(renderer* r, uint32_t offset, uint32_t size)
+{
+        bind_buffer(r, GL_ARRAY_BUFFER, stream_buffer_id(r->vertex_stream));
+        stream_buffer_commit(r->vertex_stream, offset, size);
+        r->stats.bytes_uploaded += size;
+}
+
+// Writes the vertices for sprites begin to end of a vertex_job.
+void calc_verts_range(void* data, uint32_t begin, uint32_t end)
+{
+        vertex_job* job = (vertex_job*)data;
+        quad_vertex* verts = (quad_vertex*)job->out + begin * 4;
+        sprite_quads_calc(job->sprites, job->keys + begin, end - begin, verts);
+}
+
+// Writes the instances for sprites begin to end of a vertex_job.
+void calc_instances_range(void* data, uint32_t begin, uint32_t end)
+{
+        vertex_job* job = (vertex_job*)data;
+        sprite_instance* insts = (sprite_instance*)job->out;
+        for (uint32_t i = begin; i < end; ++i) {
+                calc_instance(job->sprites, SORT_KEY_INDEX(job->keys[i]), &insts[i]);
+        }
+}
+
+// Draws quad_count quads starting at vert_offset in the buffer.
+void draw_buffers(renderer* r, GLuint buffer, uint32_t vert_offset,
+                  int32_t quad_count)
+{
+        GLsizei stride = sizeof(quad_vertex);
+        const uint8_t* base = (const uint8_t*)(uintptr_t)vert_offset;
+
+        const quad_program* qp = r->quads;
+        uint32_t attribs = attrib_bit(qp->vert_attrib) |
+                           attrib_bit(qp->tex_coord_attrib);
+        set_attribs(r, attribs, 0);
+
+        bind_buffer(r, GL_ARRAY_BUFFER, buffer);
+        glVertexAttribPointer(qp->vert_attrib, 2, GL_FLOAT, GL_FALSE, stride,
+                              base + offsetof(quad_vertex, x));
+        glVertexAttribPointer(qp->tex_coord_attrib, 2, GL_FLOAT, GL_FALSE, stride,
+                              base + offsetof(quad_vertex, u));
+        if (attribs & attrib_bit(r->corner_attrib)) {
+                r->corner_pointer_set = false;
+        }
+
+        bind_buffer(r, GL_ELEMENT_ARRAY_BUFFER, r->quad_index_buffer);
+        glDrawElements(GL_TRIANGLES, quad_count * 6, GL_UNSIGNED_SHORT, 0);
+}
+
+// Writes an instance for each of the sprites referenced by keys into
+// the vertex stream and draws them.
+void draw_instanced_batch(renderer* r, sprite_buffer* sprites,
+                          const uint64_t* keys, int32_t keys_len)
+{
+        uint32_t inst_size = sizeof(sprite_instance);
+        int32_t max_insts = VERTEX_STREAM_REGION_SIZE / inst_size;
+
+        // Batches too big for a single region of the stream are split up.
+        while (keys_len > 0) {
+                int32_t count = keys_len < max_insts ? keys_len : max_insts;
+                uint32_t insts_size = count * inst_size;
+
+                uint32_t offset;
+                sprite_instance* insts = alloc_vertices(r, insts_size, &offset);
+                if (!insts) {
+                        return;
+                }
+
+                int64_t start = timer_now_us();
+                vertex_job job = { sprites, keys, insts };
+                jobs_parallel_for(calc_instances_range, &job,
+                                  count, MIN_SPRITES_PER_JOB);
+                r->vertex_us += timer_now_us() - start;
+
+                if (!r->headless) {
+                        commit_vertices(r, offset, insts_size);
+                        draw_instances(r, stream_buffer_id(r->vertex_stream),
+                                       offset, count);
+                }
+
+                keys += count;
+                keys_len -= count;
+        }
+}
+
+// Fills in the instance data for the sprite. Rotation and scaling
+// is left to the vertex shader.
+void calc_instance(const sprite_buffer* sprites, uint32_t index,
+                   sprite_instance* inst)
+{
+        inst->x_pos = sprites->x_pos_sb[index];
+        inst->y_pos = sprites->y_pos_sb[index];
+        inst->x_anchor = sprites->x_anchor_sb[index];
+        inst->y_anchor = sprites->y_anchor_sb[index];
+        inst->scale = sprites->scale_sb[index];
+        inst->rotation = sprites->rotation_sb[index];
+
+        const sprite_texture* t = &sprites->resolved_sb[sprites->tex_sb[index]];
+        const rect* tex_rect = &sprites->tex_rects_sb[sprites->tex_rect_sb[index]];
+        bool flip_x = sprites->flip_x_sb[index];
+        float w = tex_rect->w == 0.0f ? t->width : tex_rect->w;
+        float h = tex_rect->h == 0.0f ? t->height : tex_rect->h;
+        float x = tex_rect->x + t->page_x;
+        float y = tex_rect->y + t->page_y;
+        inst->tex_rect[0] = texel_coord(flip_x ? x + w : x);
+        inst->tex_rect[1] = texel_coord(y);
+        inst->tex_rect[2] = texel_coord(flip_x ? -w : w);
+        inst->tex_rect[3] = texel_coord(h);
+}
+
+// Returns v as a coordinate in a sprite_instance tex_rect.
+int16_t texel_coord(float v)
+{
+        // Fractions and anything beyond 16 bits would be lost.
+        assert(v >= INT16_MIN && v <= INT16_MAX && v == (float)(int16_t)v);
+        return (int16_t)v;
+}
+
+// Draws inst_count sprite instances starting at inst_offset in the
+// buffer.
+void draw_instances(renderer* r, GLuint buffer, uint32_t inst_offset,
+                    int32_t inst_count)
+{
+        GLsizei stride = sizeof(sprite_instance);
+        const uint8_t* base = (const uint8_t*)(uintptr_t)inst_offset;
+
+        uint32_t instanced = attrib_bit(r->position_attrib) |
+                             attrib_bit(r->scale_rotation_attrib) |
+                             attrib_bit(r->tex_rect_attrib);
+        set_attribs(r, instanced | attrib_bit(r->corner_attrib), instanced);
+
+        // The corners never move so only need pointing at once.
+        if (!r->corner_pointer_set) {
+                bind_buffer(r, GL_ARRAY_BUFFER, r->quad_corner_buffer);
+                glVertexAttribPointer(r->corner_attrib, 2, GL_FLOAT, GL_FALSE, 0, 0);
+                r->corner_pointer_set = true;
+        }
+
+        bind_buffer(r, GL_ARRAY_BUFFER, buffer);
+        glVertexAttribPointer(r->position_attrib, 4, GL_FLOAT, GL_FALSE, stride,
+                              base + offsetof(sprite_instance, x_pos));
+        glVertexAttribPointer(r->scale_rotation_attrib, 2, GL_FLOAT, GL_FALSE, stride,
+                              base + offsetof(sprite_instance, scale));
+        glVertexAttribPointer(r->tex_rect_attrib, 4, GL_SHORT, GL_FALSE, stride,
+                              base + offsetof(sprite_instance, tex_rect));
+
+        bind_buffer(r, GL_ELEMENT_ARRAY_BUFFER, r->quad_index_buffer);
+        glDrawElementsInstanced(GL_TRIANGLES, 6, GL_UNSIGNED_SHORT, 0, inst_count);
+}
+
+// Creates the static index buffer shared by all quads. Vertices are in
+// the order bottom left, top left, top right, bottom right.
+// Returns 0 if creation fails.
+GLuint make_quad_index_buffer()
+{
+        uint32_t index_count = MAX_QUADS_PER_DRAW * 6;
+        uint16_t* indices = malloc(index_count * sizeof(uint16_t));
+        if (!indices) {
+                return 0;
+        }
+
+        for (uint32_t i = 0; i < MAX_QUADS_PER_DRAW; ++i) {
+                uint16_t v = (uint16_t)(i * 4);
+                uint16_t* quad = &indices[i * 6];
+                quad[0] = v;
+                quad[1] = v + 1;
+                quad[2] = v + 2;
+                quad[3] = v;
+                quad[4] = v + 2;
+                quad[5] = v + 3;
+        }
+
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ELEMENT_ARRAY_BUFFER, index_count * sizeof(uint16_t),
+                     indices, GL_STATIC_DRAW);
+        glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+        free(indices);
+
+        return buffer;
+}
+
+// Creates the static vertex buffer of unit quad corners that the
+// instanced vertex shader expands each sprite from. Corners are in
+// the same order as the quad index buffer.
+// Returns 0 if creation fails.
+GLuint make_quad_corner_buffer()
+{
+        static const float corners[] = {
+                0.0f, 0.0f, // bottom left
+                0.0f, 1.0f, // top left
+                1.0f, 1.0f, // top right
+                1.0f, 0.0f  // bottom right
+        };
+
+        GLuint buffer;
+        glGenBuffers(1, &buffer);
+        glBindBuffer(GL_ARRAY_BUFFER, buffer);
+        glBufferData(GL_ARRAY_BUFFER, sizeof(corners), corners, GL_STATIC_DRAW);
+        glBindBuffer(GL_ARRAY_BUFFER, 0);
+
+        return buffer;
+}
+
+// Sets the fields shared by all renderers to their defaults.
+void init_renderer(renderer* r, uint32_t virtual_width, uint32_t virtual_height,
+                   render_mode mode, uint32_t frames_in_flight)
+{
+        r->mode = mode;
+        r->virtual_width = virtual_width;
+        r->virtual_height = virtual_height;
+        r->tex_unit = 0;
+        r->headless = false;
+        r->headless_vertices = NULL;
+        r->quad_corner_buffer = 0;
+
+        if (frames_in_flight < 2) {
+                frames_in_flight = 2;
+        } else if (frames_in_flight > RENDER_MAX_FRAMES_IN_FLIGHT) {
+                frames_in_flight = RENDER_MAX_FRAMES_IN_FLIGHT;
+        }
+        r->frames_in_flight = frames_in_flight;
+        r->submitted = 0;
+        r->rendered = 0;
+
+        // Nothing has been drawn or timed on the GPU yet.
+        render_stats no_stats;
+        memset(&no_stats, 0, sizeof(no_stats));
+        no_stats.gpu_ms = -1.0f;
+        r->stats = no_stats;
+        r->last_stats = no_stats;
+        r->vertex_us = 0;
+
+        r->gpu_timing = false;
+        r->gpu_query_active = false;
+        for (uint32_t i = 0; i < GPU_QUERY_COUNT; ++i) {
+                r->gpu_queries[i] = 0;
+                r->gpu_query_frames[i] = 0;
+                r->gpu_query_pending[i] = false;
+        }
+
+        for (uint32_t i = 0; i < RENDER_MAX_FRAMES_IN_FLIGHT; ++i) {
+                render_frame* f = &r->frames[i];
+                sprite_buffer_init(&f->sprites);
+                f->static_batch_sb = NULL;
+                f->command_sb = NULL;
+                arena_init(&f->arena, 0); // Sized by the first few frames.
+                f->deleted_texture_sb = NULL;
+                f->freed_batch_sb = NULL;
+                f->freed_shader_sb = NULL;
+                f->freed_target_sb = NULL;
+                f->released_texture_sb = NULL;
+                f->stats = no_stats;
+                kmMat4Identity(&f->cam);
+                f->resized = false;
+        }
+        r->static_runs = NULL;
+        r->waiting = 0;
+        r->done = 0;
+
+        // Matches the GL state set up in render_create.
+        r->default_quads.program = 0;
+        r->bound_program = 0;
+        r->bound_texture = 0;
+        r->array_buffer = 0;
+        r->element_buffer = 0;
+        r->enabled_attribs = 0;
+        r->instanced_attribs = 0;
+        r->corner_pointer_set = false;
+        r->tex_size_texture = 0;
+        r->blend = render_blend_alpha;
+        r->quads = &r->default_quads;
+        r->shader = NULL;
+        r->target = NULL;
+        r->scissor_enabled = false;
+        r->scissor = rect_zero;
+        kmMat4Identity(&r->projection);
+        kmMat4Identity(&r->cam);
+        r->uniform_serial = 1;
+        r->next_target_id = TEXTURE_MAX_ID;
+}
+
+// Returns true if the GL context supports instanced arrays.
+bool instancing_supported()
+{
+        return GLEW_VERSION_3_3 ? true : false;
+}
+
+bool upload_texture(renderer* r, texture* t)
+{
+        assert(t);
+
+        if (t->uploaded) {
+                return true;
+        }
+
+        // Headless renderers have nowhere to upload to but still keep
+        // track of which textures would have been uploaded.
+        if (r->headless) {
+                t->uploaded = true;
+                return true;
+        }
+
+        glGenTextures(1, &t->gl_id);
+        bind_gl_texture(r, t->gl_id);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+        glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+        glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, t->width, t->height, 0,
+                     GL_RGBA, GL_UNSIGNED_BYTE, t->data);
+        if (t->data) {
+                r->stats.bytes_uploaded += t->width * t->height * 4;
+        }
+
+        if (check_gl_error()) {
+                LOGERR("%s", "A GL error occurred when loading texture");
+                return false;
+        }
+
+        t->uploaded = true;
+
+        return true;
+}
+
+// Returns a copy of the string that must be freed, or NULL if it couldn't
+// be allocated.
+char* copy_string(const char* str)
+{
+        size_t len = strlen(str) + 1;
+        char* copy = malloc(len);
+        if (copy) {
+                memcpy(copy, str, len);
+        }
+        return copy;
 }
\ No newline at end of file
@@ -5,17 +5,112 @@
 
 typedef struct renderer renderer;
 
+// A static batch is a set of sprites that never change, uploaded to
+// the GPU once and then drawn each frame without being re-sorted or
+// re-built.
+typedef struct static_batch static_batch;
+
+// A vertex and fragment shader pair that quads can be drawn with in
+// place of the renderer's own. The vertex shader gets the same vertex
+// and tex_coord attributes and projection and cam uniforms as the
+// renderer's batched vertex shader.
+typedef struct render_shader render_shader;
+
+// An offscreen texture that can be drawn into instead of the screen and
+// then drawn like any other texture.
+typedef struct render_target render_target;
+
+// Counts and timings for a frame drawn by the render thread. Times are
+// in milliseconds.
+typedef struct render_stats {
+        uint32_t frame; // Number of frames drawn before this one.
+        uint32_t sprites; // Sprites added to the frame.
+        uint32_t static_sprites; // Sprites drawn from static batches.
+        uint32_t commands;
+        uint32_t batches; // Runs of sprites or quads drawn together.
+        uint32_t texture_switches; // Changes of texture between draws.
+        uint32_t bytes_uploaded; // Vertex, static batch and texture data.
+        float sort_ms; // Building and sorting the sort keys.
+        float vertex_ms; // Building sprite vertices or instances.
+        float submit_ms; // Issuing GL calls, not counting the above.
+        float swap_ms;
+
+        // GPU time of frame gpu_frame, an earlier frame as timer queries
+        // take a few frames to finish. -1 if timer queries aren't
+        // supported or none has finished yet.
+        float gpu_ms;
+        uint32_t gpu_frame;
+} render_stats;
+
+typedef enum {
+        // Blends with the source alpha. The default.
+        render_blend_alpha,
+        // Adds the source, scaled by its alpha, to what is there.
+        render_blend_additive,
+        // Blends source colors that are already multiplied by alpha.
+        render_blend_premultiplied,
+        // Overwrites what is there.
+        render_blend_opaque
+} render_blend;
+
+// Most frames that can be queued up for the render thread, counting
+// the one gameplay is adding sprites to.
+#define RENDER_MAX_FRAMES_IN_FLIGHT 3
+
+typedef enum {
+        // Quads for each sprite are built on the CPU.
+        render_mode_batched,
+        // Each sprite is uploaded as a single instance and the quad is
+        // built by the vertex shader. Requires GL 3.3.
+        render_mode_instanced
+} render_mode;
+
 // Creates a renderer with the on the specified GLFW window
 // and the specified vertex and fragment shaders.
+// instanced_vert_shader_path is only used for render_mode_instanced and
+// may be NULL otherwise. If instancing is not supported the renderer
+// falls back to render_mode_batched.
+// frames_in_flight is how many frames, 2 to RENDER_MAX_FRAMES_IN_FLIGHT,
+// gameplay can have queued up for the render thread before
+// render_submit blocks. More frames smooth out uneven frame times at
+// the cost of latency.
+// The GL context must be current on the calling thread. It is handed
+// to the render thread and is not current on any other thread after.
 // Returns null if renderer creation fails.
 renderer* render_create(struct GLFWwindow* window,
                         uint32_t virtual_width, uint32_t virtual_height,
-                        const char* vert_shader_path, const char* frag_shader_path);
+                        render_mode mode, uint32_t frames_in_flight,
+                        const char* vert_shader_path,
+                        const char* instanced_vert_shader_path,
+                        const char* frag_shader_path);
+
+// Creates a renderer that needs no window or GL context. Frames are
+// sorted, batched and have their vertices generated exactly as they
+// would be for the specified mode, and textures and static batches are
+// marked as uploaded, but nothing is drawn. Useful for measuring the
+// render thread on machines without a GPU.
+// Returns null if renderer creation fails.
+renderer* render_create_headless(uint32_t virtual_width, uint32_t virtual_height,
+                                 render_mode mode, uint32_t frames_in_flight);
+
+// Returns the mode the renderer is actually drawing with.
+render_mode render_get_mode(renderer*);
+
+// Pins the render thread to the specified CPU so it isn't migrated
+// between cores. Useful for stable profiling and benchmarks.
+// Returns false if the affinity could not be set.
+bool render_set_thread_affinity(renderer*, uint32_t cpu);
+
+// Copies the stats of the last frame the render thread had finished
+// drawing when the frame being added to became free, so they lag a frame
+// or two behind. Never blocks or locks.
+void render_get_stats(renderer*, render_stats* stats);
 
 // Stops rendering and frees the renderer.
 void render_free(renderer*);
 
 // Updates the viewport for rendering whenever the window is resized.
+// Takes effect from the next frame submitted.
 void render_resize(renderer*, uint32_t screen_width, uint32_t screen_height);
 
 // Adds the sprite to the renderer for drawing at the next render_submit call.
@@ -24,9 +119,127 @@ void render_add_sprite(renderer*, const struct sprite*);
 // Adds the sprites to the renderer for drawing at the next render_submit call.
 // Note that each sprite's data is copied into the renderer.
 void render_add_sprites(renderer*, const struct sprite*, int32_t sprites_len);
+// Adds the sprites laid out as streams to the renderer for drawing at
+// the next render_submit call. The renderer stores sprites as streams
+// too so this copies each stream across rather than a sprite at a time.
+// A frame can use at most 65536 different tex rects and 65536 different
+// textures, past that sprites are drawn with the first ones.
+void render_add_sprite_streams(renderer*, const struct sprite_streams*);
+
+// Creates a static batch from the sprites. The sprite data is copied
+// and uploaded to the GPU the first time the batch is drawn so the
+// textures must stay alive for as long as the batch does. The textures
+// must have finished loading.
+// Returns NULL if creation fails.
+static_batch* render_create_static_batch(renderer*, const struct sprite*,
+                                         int32_t sprites_len);
+
+// Frees the static batch and its GPU buffer once every frame submitted
+// so far, and the one being added to, has been drawn.
+void render_free_static_batch(renderer*, static_batch*);
+
+// Adds the static batch to the renderer for drawing at the next
+// render_submit call. It is drawn with the camera transform and sorted
+// by depth along with the other sprites.
+void render_add_static_batch(renderer*, static_batch*);
+
+// Returns a sort key for a command. Everything in a frame is drawn in
+// order of a 64 bit key made up of
+// | 8 bits depth | 24 bits order | 32 bits reserved for the renderer |
+// Higher depths are drawn first, like sprites, whose order is their
+// texture id. The renderer uses the low 32 bits to keep things with
+// equal keys in the order they were added, commands first, so the low
+// 32 bits of keys passed to commands are ignored.
+uint64_t render_make_key(int8_t depth, uint32_t order);
 
-// Deletes the texture object and unbinds it.
+// Commands are recorded into the frame being built and run by the render
+// thread in order of their keys along with the sprites. State set by a
+// command stays set for everything drawn after it in key order until
+// another command changes it, and is reset at the start of each frame.
+// State commands that wouldn't change anything are skipped.
+
+// Sets how everything drawn after key is blended.
+void render_cmd_set_blend(renderer*, uint64_t key, render_blend);
+
+// Draws every quad after key, including the sprites in
+// render_mode_batched, with the shader. NULL goes back to the renderer's
+// own shader.
+void render_cmd_set_shader(renderer*, uint64_t key, render_shader*);
+
+// Clips everything drawn after key to area, in virtual coordinates.
+// NULL turns clipping off.
+void render_cmd_set_scissor(renderer*, uint64_t key, const struct rect* area);
+
+// Draws everything after key into the target, clearing it first if
+// clear is set. NULL goes back to drawing to the screen.
+void render_cmd_set_target(renderer*, uint64_t key, render_target*, bool clear);
+
+// Draws quad_count quads, 4 vertices each in the order bottom left, top
+// left, top right, bottom right, textured with the texture. Tex coords
+// are from 0 to 1 across the texture and are moved onto its atlas page
+// if it was packed. The vertices are copied.
+void render_cmd_draw_quads(renderer*, uint64_t key, struct texture*,
+                           const struct quad_vertex* verts, uint32_t quad_count);
+
+// Draws every run of the static batch at key rather than at the depth of
+// each run.
+void render_cmd_draw_static_batch(renderer*, uint64_t key, static_batch*);
+
+// Creates a shader from the specified vertex and fragment shaders. They
+// are compiled the first time the shader is used and quads are drawn
+// with the renderer's own shader if compiling fails.
+// Returns NULL if creation fails.
+render_shader* render_create_shader(renderer*, const char* vert_shader_path,
+                                    const char* frag_shader_path);
+
+// Frees the shader once every frame submitted so far, and the one being
+// added to, has been drawn.
+void render_free_shader(renderer*, render_shader*);
+
+// Creates a render target of the specified size in pixels.
+// Returns NULL if creation fails.
+render_target* render_create_target(renderer*, int32_t width, int32_t height);
+
+// Frees the render target and its texture once every frame submitted so
+// far, and the one being added to, has been drawn.
+void render_free_target(renderer*, render_target*);
+
+// Returns the texture that is drawn into while the target is set.
+struct texture* render_target_texture(render_target*);
+
+// Deletes the texture object once every frame submitted so far, and
+// the one being added to, has been drawn.
 void render_delete_texture(renderer*, struct texture*);
 
-// Draws all the sprites added to the renderer and then removes them.
+// Called with a texture passed to render_release_texture once no frame
+// can draw it any more.
+typedef void (*render_release_fn)(struct texture*, renderer*);
+
+// Hands the texture back to release once every frame submitted so far,
+// and the one being added to, has been drawn, so its owner can free it.
+// release is called on the thread adding frames, from render_submit,
+// render_flush_textures or render_free.
+void render_release_texture(renderer*, struct texture*,
+                            render_release_fn release);
+
+// Blocks until the render thread has drawn every submitted frame, after
+// which it doesn't touch any texture until the next render_submit.
+void render_wait_idle(renderer*);
+
+// Waits for every submitted frame to be drawn and then hands back all
+// the textures passed to render_release_texture straight away,
+// including those released in the frame being added to, which must not
+// draw them.
+void render_flush_textures(renderer*);
+
+// Returns an arena for transient arrays that only need to last until
+// the next render_submit, such as the streams passed to
+// render_add_sprite_streams. It belongs to the frame being added to and
+// is reset once that frame has been drawn, so gameplay and the renderer
+// stop allocating once frames settle down to a steady size.
+struct arena* render_frame_arena(renderer*);
+
+// Queues up everything added since the last call as a frame for the
+// render thread to draw. Only blocks while the queue is full, that is
+// while frames_in_flight submitted frames have yet to be drawn.
 void render_submit(renderer*);
@@ -1,5 +1,6 @@
 #pragma once
 
+#include <inttypes.h>
 #include <stdbool.h>
 
 #include "rect.h"
@@ -18,3 +19,32 @@ typedef struct sprite {
         struct texture* tex;
 } sprite;
 
+// Sprites laid out as one array per field instead of an array of
+// sprite structs. Every array has count elements. Each sprite's tex rect
+// and texture are indices into the tex_rects and textures tables so
+// sprites that share them only store a small index.
+// x_anchor, y_anchor, scale, rotation, depth and flip_x may be NULL in
+// which case every sprite rotates around its position, has a scale of
+// 1, no rotation, a depth of 0 and isn't flipped. tex_rect may be NULL
+// to draw the whole of every sprite's texture.
+// tex_rects_len and textures_len are the number of entries in the
+// tables, each of which can hold at most 65536.
+typedef struct sprite_streams {
+        int32_t count;
+        const float* x_pos;
+        const float* y_pos;
+        const float* x_anchor;
+        const float* y_anchor;
+        const float* scale;
+        const float* rotation;
+        const int8_t* depth;
+        const bool* flip_x;
+        const uint16_t* tex_rect;
+        const uint16_t* tex;
+
+        const rect* tex_rects;
+        int32_t tex_rects_len;
+        struct texture* const* textures;
+        int32_t textures_len;
+} sprite_streams;
+
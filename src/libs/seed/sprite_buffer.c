@@ -0,0 +1,380 @@
+#include "sprite_buffer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "khash.h"
+#include "log.h"
+#include "sprite.h"
+#include "stretchy_buffer.h"
+#include "texture.h"
+
+khint_t hash_rect(rect r);
+bool rects_equal(rect a, rect b);
+
+// Map a tex rect or texture to its index in the buffer's tables.
+KHASH_INIT(tex_rect_map, rect, uint16_t, 1, hash_rect, rects_equal);
+KHASH_MAP_INIT_INT64(texture_map, uint16_t);
+
+typedef struct sprite_buffer_maps {
+        khash_t(tex_rect_map)* tex_rects;
+        khash_t(texture_map)* textures;
+} sprite_buffer_maps;
+
+bool create_maps(sprite_buffer* b);
+uint16_t add_tex_rect(sprite_buffer* b, rect r);
+uint16_t add_texture(sprite_buffer* b, texture* t);
+void log_table_full(sprite_buffer* b);
+
+void sprite_buffer_init(sprite_buffer* b)
+{
+        assert(b);
+        memset(b, 0, sizeof(*b));
+}
+
+void sprite_buffer_free(sprite_buffer* b)
+{
+        assert(b);
+
+        sb_free(b->x_pos_sb);
+        sb_free(b->y_pos_sb);
+        sb_free(b->x_anchor_sb);
+        sb_free(b->y_anchor_sb);
+        sb_free(b->scale_sb);
+        sb_free(b->rotation_sb);
+        sb_free(b->depth_sb);
+        sb_free(b->flip_x_sb);
+        sb_free(b->tex_rect_sb);
+        sb_free(b->tex_sb);
+        sb_free(b->page_id_sb);
+        sb_free(b->tex_rects_sb);
+        sb_free(b->textures_sb);
+        sb_free(b->page_ids_sb);
+        sb_free(b->resolved_sb);
+        if (b->maps) {
+                kh_destroy(tex_rect_map, b->maps->tex_rects);
+                kh_destroy(texture_map, b->maps->textures);
+                free(b->maps);
+        }
+        sb_free(b->remap_sb);
+        sprite_buffer_init(b);
+}
+
+void sprite_buffer_reset(sprite_buffer* b)
+{
+        assert(b);
+
+        sb_reset(b->x_pos_sb);
+        sb_reset(b->y_pos_sb);
+        sb_reset(b->x_anchor_sb);
+        sb_reset(b->y_anchor_sb);
+        sb_reset(b->scale_sb);
+        sb_reset(b->rotation_sb);
+        sb_reset(b->depth_sb);
+        sb_reset(b->flip_x_sb);
+        sb_reset(b->tex_rect_sb);
+        sb_reset(b->tex_sb);
+        sb_reset(b->page_id_sb);
+        sb_reset(b->tex_rects_sb);
+        sb_reset(b->textures_sb);
+        sb_reset(b->page_ids_sb);
+        sb_reset(b->resolved_sb);
+        if (b->maps) {
+                kh_clear(tex_rect_map, b->maps->tex_rects);
+                kh_clear(texture_map, b->maps->textures);
+        }
+        b->table_full = false;
+}
+
+uint32_t sprite_buffer_count(const sprite_buffer* b)
+{
+        assert(b);
+        return sb_count(b->x_pos_sb);
+}
+
+void sprite_buffer_add_sprites(sprite_buffer* b, const sprite* sprites,
+                               int32_t sprites_len)
+{
+        assert(b);
+        assert(sprites || sprites_len <= 0);
+
+        if (sprites_len <= 0) {
+                return;
+        }
+
+        float* x_pos = sb_add(b->x_pos_sb, sprites_len);
+        float* y_pos = sb_add(b->y_pos_sb, sprites_len);
+        float* x_anchor = sb_add(b->x_anchor_sb, sprites_len);
+        float* y_anchor = sb_add(b->y_anchor_sb, sprites_len);
+        float* scale = sb_add(b->scale_sb, sprites_len);
+        float* rotation = sb_add(b->rotation_sb, sprites_len);
+        int8_t* depth = sb_add(b->depth_sb, sprites_len);
+        bool* flip_x = sb_add(b->flip_x_sb, sprites_len);
+        uint16_t* tex_rect = sb_add(b->tex_rect_sb, sprites_len);
+        uint16_t* tex = sb_add(b->tex_sb, sprites_len);
+        uint32_t* page_id = sb_add(b->page_id_sb, sprites_len);
+
+        for (int32_t i = 0; i < sprites_len; ++i) {
+                const sprite* s = &sprites[i];
+                x_pos[i] = s->x_pos;
+                y_pos[i] = s->y_pos;
+                x_anchor[i] = s->x_anchor;
+                y_anchor[i] = s->y_anchor;
+                scale[i] = s->scale;
+                rotation[i] = s->rotation;
+                depth[i] = s->depth;
+                flip_x[i] = s->flip_x;
+
+                // Neighbouring sprites often share a texture and rect so
+                // those skip the maps.
+                if (i > 0 && rects_equal(s->tex_rect, sprites[i - 1].tex_rect)) {
+                        tex_rect[i] = tex_rect[i - 1];
+                } else {
+                        tex_rect[i] = add_tex_rect(b, s->tex_rect);
+                }
+                if (i > 0 && s->tex == sprites[i - 1].tex) {
+                        tex[i] = tex[i - 1];
+                } else {
+                        tex[i] = add_texture(b, s->tex);
+                }
+                page_id[i] = b->page_ids_sb[tex[i]];
+        }
+}
+
+void sprite_buffer_add_streams(sprite_buffer* b, const sprite_streams* s)
+{
+        assert(b);
+        assert(s);
+        assert(s->count <= 0 || (s->x_pos && s->y_pos && s->tex &&
+                                 s->textures && s->textures_len > 0));
+        assert(!s->tex_rect || (s->tex_rects && s->tex_rects_len > 0));
+
+        int32_t count = s->count;
+        if (count <= 0) {
+                return;
+        }
+
+        float* x_pos = sb_add(b->x_pos_sb, count);
+        float* y_pos = sb_add(b->y_pos_sb, count);
+        float* x_anchor = sb_add(b->x_anchor_sb, count);
+        float* y_anchor = sb_add(b->y_anchor_sb, count);
+        float* scale = sb_add(b->scale_sb, count);
+        float* rotation = sb_add(b->rotation_sb, count);
+        int8_t* depth = sb_add(b->depth_sb, count);
+        bool* flip_x = sb_add(b->flip_x_sb, count);
+        uint16_t* tex_rect = sb_add(b->tex_rect_sb, count);
+        uint16_t* tex = sb_add(b->tex_sb, count);
+        uint32_t* page_id = sb_add(b->page_id_sb, count);
+
+        // The streams are copied straight across, missing ones are
+        // filled in with their defaults.
+        memcpy(x_pos, s->x_pos, count * sizeof(float));
+        memcpy(y_pos, s->y_pos, count * sizeof(float));
+        memcpy(x_anchor, s->x_anchor ? s->x_anchor : s->x_pos, count * sizeof(float));
+        memcpy(y_anchor, s->y_anchor ? s->y_anchor : s->y_pos, count * sizeof(float));
+        if (s->scale) {
+                memcpy(scale, s->scale, count * sizeof(float));
+        } else {
+                for (int32_t i = 0; i < count; ++i) {
+                        scale[i] = 1.0f;
+                }
+        }
+        if (s->rotation) {
+                memcpy(rotation, s->rotation, count * sizeof(float));
+        } else {
+                memset(rotation, 0, count * sizeof(float));
+        }
+        if (s->depth) {
+                memcpy(depth, s->depth, count * sizeof(int8_t));
+        } else {
+                memset(depth, 0, count * sizeof(int8_t));
+        }
+        if (s->flip_x) {
+                memcpy(flip_x, s->flip_x, count * sizeof(bool));
+        } else {
+                memset(flip_x, 0, count * sizeof(bool));
+        }
+
+        // The caller's tables are added to the buffer's. Their indices
+        // only have to be remapped if the entries end up elsewhere, such
+        // as when an earlier call added some of them already.
+        if (s->tex_rect) {
+                sb_reset(b->remap_sb);
+                uint16_t* remap = sb_add(b->remap_sb, s->tex_rects_len);
+                bool same = true;
+                for (int32_t i = 0; i < s->tex_rects_len; ++i) {
+                        remap[i] = add_tex_rect(b, s->tex_rects[i]);
+                        same = same && remap[i] == i;
+                }
+                if (same) {
+                        memcpy(tex_rect, s->tex_rect, count * sizeof(uint16_t));
+                } else {
+                        for (int32_t i = 0; i < count; ++i) {
+                                tex_rect[i] = remap[s->tex_rect[i]];
+                        }
+                }
+        } else {
+                uint16_t whole = add_tex_rect(b, rect_zero);
+                for (int32_t i = 0; i < count; ++i) {
+                        tex_rect[i] = whole;
+                }
+        }
+
+        sb_reset(b->remap_sb);
+        uint16_t* remap = sb_add(b->remap_sb, s->textures_len);
+        bool same = true;
+        for (int32_t i = 0; i < s->textures_len; ++i) {
+                remap[i] = add_texture(b, s->textures[i]);
+                same = same && remap[i] == i;
+        }
+        if (same) {
+                memcpy(tex, s->tex, count * sizeof(uint16_t));
+        } else {
+                for (int32_t i = 0; i < count; ++i) {
+                        tex[i] = remap[s->tex[i]];
+                }
+        }
+        for (int32_t i = 0; i < count; ++i) {
+                page_id[i] = b->page_ids_sb[tex[i]];
+        }
+}
+
+void sprite_buffer_resolve(sprite_buffer* b, const texture* page)
+{
+        assert(b);
+
+        int32_t count = sb_count(b->textures_sb);
+        for (int32_t i = 0; i < count; ++i) {
+                texture* t = b->textures_sb[i];
+                texture* t_page = texture_get_page(t);
+                if (page && t_page != page) {
+                        continue;
+                }
+
+                sprite_texture* st = &b->resolved_sb[i];
+                st->width = (float)t->width;
+                st->height = (float)t->height;
+                st->page_x = (float)t->page_x;
+                st->page_y = (float)t->page_y;
+                st->page_width = (float)t_page->width;
+                st->page_height = (float)t_page->height;
+        }
+}
+
+// Returns true if the maps for the tables could be allocated.
+bool create_maps(sprite_buffer* b)
+{
+        b->maps = malloc(sizeof(sprite_buffer_maps));
+        if (!b->maps) {
+                goto cleanup;
+        }
+        b->maps->tex_rects = kh_init(tex_rect_map);
+        b->maps->textures = kh_init(texture_map);
+        if (!b->maps->tex_rects || !b->maps->textures) {
+                goto cleanup_maps;
+        }
+        return true;
+
+cleanup_maps:
+        kh_destroy(tex_rect_map, b->maps->tex_rects);
+        kh_destroy(texture_map, b->maps->textures);
+        free(b->maps);
+        b->maps = NULL;
+cleanup:
+        LOGERR("%s", "Failed to allocate sprite buffer maps");
+        return false;
+}
+
+// Returns the index of the rect in the tex rect table, adding it if it
+// isn't there yet. Falls back to the first rect if the table is full.
+uint16_t add_tex_rect(sprite_buffer* b, rect r)
+{
+        if (!b->maps && !create_maps(b)) {
+                return 0;
+        }
+
+        khash_t(tex_rect_map)* map = b->maps->tex_rects;
+        khiter_t iter = kh_get(tex_rect_map, map, r);
+        if (iter != kh_end(map)) {
+                return kh_val(map, iter);
+        }
+
+        int32_t index = sb_count(b->tex_rects_sb);
+        if (index == SPRITE_BUFFER_MAX_TABLE) {
+                log_table_full(b);
+                return 0;
+        }
+
+        int kh_ret;
+        iter = kh_put(tex_rect_map, map, r, &kh_ret);
+        if (kh_ret == -1) {
+                LOGERR("%s", "Failed to add tex rect to tex rect map");
+                return 0;
+        }
+        kh_val(map, iter) = (uint16_t)index;
+        sb_push(b->tex_rects_sb, r);
+        return (uint16_t)index;
+}
+
+// Returns the index of the texture in the texture table, adding it if it
+// isn't there yet. Falls back to the first texture if the table is full.
+uint16_t add_texture(sprite_buffer* b, texture* t)
+{
+        if (!b->maps && !create_maps(b)) {
+                return 0;
+        }
+
+        khash_t(texture_map)* map = b->maps->textures;
+        uint64_t key = (uint64_t)(uintptr_t)t;
+        khiter_t iter = kh_get(texture_map, map, key);
+        if (iter != kh_end(map)) {
+                return kh_val(map, iter);
+        }
+
+        int32_t index = sb_count(b->textures_sb);
+        if (index == SPRITE_BUFFER_MAX_TABLE) {
+                log_table_full(b);
+                return 0;
+        }
+
+        int kh_ret;
+        iter = kh_put(texture_map, map, key, &kh_ret);
+        if (kh_ret == -1) {
+                LOGERR("%s", "Failed to add texture to texture map");
+                return 0;
+        }
+        kh_val(map, iter) = (uint16_t)index;
+        sb_push(b->textures_sb, t);
+        sb_push(b->page_ids_sb, texture_get_page(t)->id);
+        sprite_texture unresolved = {0};
+        sb_push(b->resolved_sb, unresolved);
+        return (uint16_t)index;
+}
+
+// Logs that a table filled up, once per frame.
+void log_table_full(sprite_buffer* b)
+{
+        if (!b->table_full) {
+                LOGERR("More than %d different tex rects or textures this frame",
+                       SPRITE_BUFFER_MAX_TABLE);
+                b->table_full = true;
+        }
+}
+
+// Rects are hashed and compared by their bits so the two always agree.
+khint_t hash_rect(rect r)
+{
+        uint32_t bits[4];
+        memcpy(bits, &r, sizeof(bits));
+        khint_t h = bits[0];
+        for (int32_t i = 1; i < 4; ++i) {
+                h = h * 31 + bits[i];
+        }
+        return h;
+}
+
+bool rects_equal(rect a, rect b)
+{
+        return memcmp(&a, &b, sizeof(rect)) == 0;
+}
\ No newline at end of file
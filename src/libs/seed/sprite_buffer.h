@@ -0,0 +1,87 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include "rect.h"
+
+struct sprite;
+struct sprite_buffer_maps;
+struct sprite_streams;
+struct texture;
+
+// Most different tex rects, and most different textures, the sprites
+// of a buffer can use. Indices into their tables are 16 bits.
+#define SPRITE_BUFFER_MAX_TABLE 65536
+
+// What building quads needs from a texture, resolved once per batch so
+// the quads of its sprites don't each chase texture pointers.
+typedef struct sprite_texture {
+        float width;
+        float height;
+        float page_x; // Where the texture is in its page.
+        float page_y;
+        float page_width;
+        float page_height;
+} sprite_texture;
+
+// The renderer's copy of the sprites added for a frame, stored as one
+// stream per field rather than as an array of sprite structs. Building
+// sort keys and quads then reads contiguous floats and small ints
+// instead of striding over whole sprites with padding and pointers.
+// Every stream is a stretchy buffer with one element per sprite.
+typedef struct sprite_buffer {
+        float* x_pos_sb;
+        float* y_pos_sb;
+        float* x_anchor_sb;
+        float* y_anchor_sb;
+        float* scale_sb;
+        float* rotation_sb;
+        int8_t* depth_sb;
+        bool* flip_x_sb;
+        // Index of each sprite's tex rect in tex_rects_sb and texture in
+        // textures_sb, like the tex_rect and tex streams of sprite_streams.
+        uint16_t* tex_rect_sb;
+        uint16_t* tex_sb;
+        // Id of the texture bound to draw each sprite, which is its
+        // atlas page if its texture was packed.
+        uint32_t* page_id_sb;
+
+        // Tables of the different tex rects and textures the sprites use,
+        // with a page id and, once resolved, a sprite_texture for each
+        // texture. The maps find entries already in the tables.
+        rect* tex_rects_sb;
+        struct texture** textures_sb;
+        uint32_t* page_ids_sb;
+        sprite_texture* resolved_sb;
+        struct sprite_buffer_maps* maps;
+        uint16_t* remap_sb; // Scratch for sprite_buffer_add_streams.
+        bool table_full; // Logged that a table ran out this frame.
+} sprite_buffer;
+
+// Initializes an empty sprite buffer.
+void sprite_buffer_init(sprite_buffer*);
+
+// Frees the streams of the sprite buffer.
+void sprite_buffer_free(sprite_buffer*);
+
+// Removes every sprite but keeps the memory for reuse.
+void sprite_buffer_reset(sprite_buffer*);
+
+// Returns the number of sprites in the buffer.
+uint32_t sprite_buffer_count(const sprite_buffer*);
+
+// Copies sprites_len sprites onto the end of the buffer.
+// Sprites past SPRITE_BUFFER_MAX_TABLE different tex rects or textures
+// are drawn with the first ones and an error is logged.
+void sprite_buffer_add_sprites(sprite_buffer*, const struct sprite* sprites,
+                               int32_t sprites_len);
+
+// Copies the sprites in the streams onto the end of the buffer. Their
+// tex rects and textures are added to the buffer's tables, and the index
+// streams copied straight across when the indices stay the same.
+void sprite_buffer_add_streams(sprite_buffer*, const struct sprite_streams*);
+
+// Fills in the sprite_texture of every texture drawn from page, or of
+// every texture if page is NULL. Those textures must be loaded.
+void sprite_buffer_resolve(sprite_buffer*, const struct texture* page);
\ No newline at end of file
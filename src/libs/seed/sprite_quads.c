@@ -0,0 +1,246 @@
+#include "sprite_quads.h"
+
+#include <math.h>
+
+#include "rect.h"
+#include "sprite_buffer.h"
+
+// Define SPRITE_QUADS_NO_SIMD to force the scalar path, for example to
+// compare the two.
+#if !defined(SPRITE_QUADS_NO_SIMD) && \
+    (defined(__SSE2__) || defined(_M_X64) || \
+     (defined(_M_IX86_FP) && _M_IX86_FP >= 2))
+#define SPRITE_QUADS_SSE2
+#include <emmintrin.h>
+#endif
+
+// Same as kmPIOver180, which is what kmVec2RotateBy used to rotate
+// sprites before this kernel replaced it.
+#define DEGREES_TO_RADIANS 0.017453f
+
+void calc_quad(const sprite_buffer* sprites, uint32_t index, quad_vertex* verts);
+
+#ifdef SPRITE_QUADS_SSE2
+void calc_quads_sse2(const sprite_buffer* sprites, const uint32_t index[4],
+                     quad_vertex* verts);
+#endif
+
+void sprite_quads_calc(const sprite_buffer* sprites, const uint64_t* keys,
+                       uint32_t count, quad_vertex* out)
+{
+        uint32_t i = 0;
+
+#ifdef SPRITE_QUADS_SSE2
+        for (; i + 4 <= count; i += 4) {
+                uint32_t index[4] = {
+                        (uint32_t)keys[i],
+                        (uint32_t)keys[i + 1],
+                        (uint32_t)keys[i + 2],
+                        (uint32_t)keys[i + 3]
+                };
+                calc_quads_sse2(sprites, index, out + i * 4);
+        }
+#endif
+
+        for (; i < count; ++i) {
+                calc_quad(sprites, (uint32_t)keys[i], out + i * 4);
+        }
+}
+
+// Builds the quad for a single sprite. The SSE2 path does exactly the
+// same operations in the same order for each lane.
+void calc_quad(const sprite_buffer* sprites, uint32_t index, quad_vertex* verts)
+{
+        const sprite_texture* t = &sprites->resolved_sb[sprites->tex_sb[index]];
+        const rect* tex_rect = &sprites->tex_rects_sb[sprites->tex_rect_sb[index]];
+        float x_pos = sprites->x_pos_sb[index];
+        float y_pos = sprites->y_pos_sb[index];
+        float x_anchor = sprites->x_anchor_sb[index];
+        float y_anchor = sprites->y_anchor_sb[index];
+        float scale = sprites->scale_sb[index];
+        float rotation = sprites->rotation_sb[index];
+
+        float tex_w = tex_rect->w == 0.0f ? t->width : tex_rect->w;
+        float tex_h = tex_rect->h == 0.0f ? t->height : tex_rect->h;
+
+        float left = x_pos;
+        float right = x_pos + tex_w * scale;
+        float bottom = y_pos;
+        float top = y_pos + tex_h * scale;
+
+        float corner_x[4] = { left, left, right, right };
+        float corner_y[4] = { bottom, top, top, bottom };
+        if (rotation != 0.0f) {
+                // Only worked out once for all 4 corners.
+                float radians = rotation * DEGREES_TO_RADIANS;
+                float sn = sinf(radians);
+                float cs = cosf(radians);
+                for (uint32_t c = 0; c < 4; ++c) {
+                        float ox = corner_x[c] - x_anchor;
+                        float oy = corner_y[c] - y_anchor;
+                        corner_x[c] = (ox * cs - oy * sn) + x_anchor;
+                        corner_y[c] = (ox * sn + oy * cs) + y_anchor;
+                }
+        }
+
+        float tex_x = tex_rect->x + t->page_x;
+        float tex_y = tex_rect->y + t->page_y;
+        float page_w = t->page_width;
+        float page_h = t->page_height;
+        float u0 = tex_x / page_w;
+        float u1 = (tex_x + tex_w) / page_w;
+        bool flip_x = sprites->flip_x_sb[index];
+        float tex_left = flip_x ? u1 : u0;
+        float tex_right = flip_x ? u0 : u1;
+        float tex_top = tex_y / page_h;
+        float tex_bot = (tex_y + tex_h) / page_h;
+
+        float corner_u[4] = { tex_left, tex_left, tex_right, tex_right };
+        float corner_v[4] = { tex_bot, tex_top, tex_top, tex_bot };
+        for (uint32_t c = 0; c < 4; ++c) {
+                verts[c].x = corner_x[c];
+                verts[c].y = corner_y[c];
+                verts[c].u = corner_u[c];
+                verts[c].v = corner_v[c];
+        }
+}
+
+#ifdef SPRITE_QUADS_SSE2
+
+#define SELECT(mask, a, b) _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b))
+
+// Builds the quads for 4 sprites at once, one sprite per lane.
+void calc_quads_sse2(const sprite_buffer* sprites, const uint32_t index[4],
+                     quad_vertex* verts)
+{
+        // Sprites added together usually stay together after sorting so
+        // their fields can be loaded straight from the streams.
+        bool contiguous = index[1] == index[0] + 1 &&
+                          index[2] == index[0] + 2 &&
+                          index[3] == index[0] + 3;
+        __m128 x, y, anchor_x, anchor_y, scale, rotation;
+        if (contiguous) {
+                x = _mm_loadu_ps(&sprites->x_pos_sb[index[0]]);
+                y = _mm_loadu_ps(&sprites->y_pos_sb[index[0]]);
+                anchor_x = _mm_loadu_ps(&sprites->x_anchor_sb[index[0]]);
+                anchor_y = _mm_loadu_ps(&sprites->y_anchor_sb[index[0]]);
+                scale = _mm_loadu_ps(&sprites->scale_sb[index[0]]);
+                rotation = _mm_loadu_ps(&sprites->rotation_sb[index[0]]);
+        } else {
+#define LANES(stream) _mm_setr_ps(stream[index[0]], stream[index[1]], \
+                                  stream[index[2]], stream[index[3]])
+                x = LANES(sprites->x_pos_sb);
+                y = LANES(sprites->y_pos_sb);
+                anchor_x = LANES(sprites->x_anchor_sb);
+                anchor_y = LANES(sprites->y_anchor_sb);
+                scale = LANES(sprites->scale_sb);
+                rotation = LANES(sprites->rotation_sb);
+#undef LANES
+        }
+
+        // Each tex rect is 4 floats so transposing them gives one
+        // register for each. The first 4 floats of each sprite_texture
+        // are transposed the same way.
+        const rect* tex_rects = sprites->tex_rects_sb;
+        const uint16_t* tex_rect = sprites->tex_rect_sb;
+        __m128 rect_x = _mm_loadu_ps(&tex_rects[tex_rect[index[0]]].x);
+        __m128 rect_y = _mm_loadu_ps(&tex_rects[tex_rect[index[1]]].x);
+        __m128 rect_w = _mm_loadu_ps(&tex_rects[tex_rect[index[2]]].x);
+        __m128 rect_h = _mm_loadu_ps(&tex_rects[tex_rect[index[3]]].x);
+        _MM_TRANSPOSE4_PS(rect_x, rect_y, rect_w, rect_h);
+
+        const sprite_texture* t[4];
+        for (uint32_t i = 0; i < 4; ++i) {
+                t[i] = &sprites->resolved_sb[sprites->tex_sb[index[i]]];
+        }
+        __m128 t_w = _mm_loadu_ps(&t[0]->width);
+        __m128 t_h = _mm_loadu_ps(&t[1]->width);
+        __m128 t_x = _mm_loadu_ps(&t[2]->width);
+        __m128 t_y = _mm_loadu_ps(&t[3]->width);
+        _MM_TRANSPOSE4_PS(t_w, t_h, t_x, t_y);
+
+        __m128 zero = _mm_setzero_ps();
+        __m128 tex_w = SELECT(_mm_cmpeq_ps(rect_w, zero), t_w, rect_w);
+        __m128 tex_h = SELECT(_mm_cmpeq_ps(rect_h, zero), t_h, rect_h);
+        __m128 tex_x = _mm_add_ps(rect_x, t_x);
+        __m128 tex_y = _mm_add_ps(rect_y, t_y);
+        __m128 page_w = _mm_setr_ps(t[0]->page_width, t[1]->page_width,
+                                    t[2]->page_width, t[3]->page_width);
+        __m128 page_h = _mm_setr_ps(t[0]->page_height, t[1]->page_height,
+                                    t[2]->page_height, t[3]->page_height);
+        const bool* flip_x = sprites->flip_x_sb;
+        __m128 flipped = _mm_castsi128_ps(_mm_setr_epi32(
+                flip_x[index[0]] ? -1 : 0, flip_x[index[1]] ? -1 : 0,
+                flip_x[index[2]] ? -1 : 0, flip_x[index[3]] ? -1 : 0));
+
+        __m128 left = x;
+        __m128 right = _mm_add_ps(x, _mm_mul_ps(tex_w, scale));
+        __m128 bottom = y;
+        __m128 top = _mm_add_ps(y, _mm_mul_ps(tex_h, scale));
+
+        __m128 corner_x[4] = { left, left, right, right };
+        __m128 corner_y[4] = { bottom, top, top, bottom };
+
+        // Rotation is skipped entirely unless one of the sprites has it
+        // and only the rotated lanes pay for sin and cos.
+        __m128 rotated = _mm_cmpneq_ps(rotation, zero);
+        int rotated_lanes = _mm_movemask_ps(rotated);
+        if (rotated_lanes) {
+                float radians[4];
+                float sn[4] = { 0.0f, 0.0f, 0.0f, 0.0f };
+                float cs[4] = { 1.0f, 1.0f, 1.0f, 1.0f };
+                _mm_storeu_ps(radians, _mm_mul_ps(rotation,
+                                                  _mm_set1_ps(DEGREES_TO_RADIANS)));
+                for (uint32_t i = 0; i < 4; ++i) {
+                        if (rotated_lanes & (1 << i)) {
+                                sn[i] = sinf(radians[i]);
+                                cs[i] = cosf(radians[i]);
+                        }
+                }
+                __m128 sin_lanes = _mm_loadu_ps(sn);
+                __m128 cos_lanes = _mm_loadu_ps(cs);
+
+                for (uint32_t c = 0; c < 4; ++c) {
+                        __m128 ox = _mm_sub_ps(corner_x[c], anchor_x);
+                        __m128 oy = _mm_sub_ps(corner_y[c], anchor_y);
+                        __m128 rx = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(ox, cos_lanes),
+                                                          _mm_mul_ps(oy, sin_lanes)),
+                                               anchor_x);
+                        __m128 ry = _mm_add_ps(_mm_add_ps(_mm_mul_ps(ox, sin_lanes),
+                                                          _mm_mul_ps(oy, cos_lanes)),
+                                               anchor_y);
+                        corner_x[c] = SELECT(rotated, rx, corner_x[c]);
+                        corner_y[c] = SELECT(rotated, ry, corner_y[c]);
+                }
+        }
+
+        // Tex coords, swapping left and right for flipped sprites.
+        __m128 u0 = _mm_div_ps(tex_x, page_w);
+        __m128 u1 = _mm_div_ps(_mm_add_ps(tex_x, tex_w), page_w);
+        __m128 tex_left = SELECT(flipped, u1, u0);
+        __m128 tex_right = SELECT(flipped, u0, u1);
+        __m128 tex_top = _mm_div_ps(tex_y, page_h);
+        __m128 tex_bot = _mm_div_ps(_mm_add_ps(tex_y, tex_h), page_h);
+
+        __m128 corner_u[4] = { tex_left, tex_left, tex_right, tex_right };
+        __m128 corner_v[4] = { tex_bot, tex_top, tex_top, tex_bot };
+
+        // Transpose each corner from lanes into the x, y, u, v of each
+        // sprite's vertex.
+        float* dst = (float*)verts;
+        for (uint32_t c = 0; c < 4; ++c) {
+                __m128 v0 = corner_x[c];
+                __m128 v1 = corner_y[c];
+                __m128 v2 = corner_u[c];
+                __m128 v3 = corner_v[c];
+                _MM_TRANSPOSE4_PS(v0, v1, v2, v3);
+                _mm_storeu_ps(dst + (0 * 4 + c) * 4, v0);
+                _mm_storeu_ps(dst + (1 * 4 + c) * 4, v1);
+                _mm_storeu_ps(dst + (2 * 4 + c) * 4, v2);
+                _mm_storeu_ps(dst + (3 * 4 + c) * 4, v3);
+        }
+}
+
+#undef SELECT
+
+#endif
\ No newline at end of file
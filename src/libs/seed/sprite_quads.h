@@ -0,0 +1,23 @@
+#pragma once
+
+#include <inttypes.h>
+
+struct sprite_buffer;
+
+// Vertices are interleaved position and tex coords. Each sprite is 4 of
+// these drawn as 2 triangles through the shared quad index buffer.
+// The vertices are in the order bottom left, top left, top right,
+// bottom right.
+typedef struct quad_vertex {
+        float x, y;
+        float u, v;
+} quad_vertex;
+
+// Writes the 4 vertices of the quad for each of count sprites into out.
+// The low 32 bits of each key are the index of its sprite in the sprite
+// buffer. The textures of the sprites must have been resolved with
+// sprite_buffer_resolve. Several sprites are done at once with SSE2 where
+// it is available. The SSE2 and scalar paths produce bit identical
+// results.
+void sprite_quads_calc(const struct sprite_buffer* sprites,
+                       const uint64_t* keys, uint32_t count, quad_vertex* out);
\ No newline at end of file
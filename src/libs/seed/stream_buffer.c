@@ -0,0 +1,223 @@
+#include "stream_buffer.h"
+
+#include <assert.h>
+#include <stdlib.h>
+
+#include "log.h"
+
+// Alignment of each allocation so attribute offsets stay aligned.
+#define STREAM_BUFFER_ALIGN 16
+
+typedef struct stream_buffer {
+        GLenum target;
+        GLuint gl_id;
+        bool persistent;
+
+        uint32_t region_size;
+        uint32_t region; // The region currently being written to.
+        uint32_t head; // Offset of the next allocation in the region.
+        GLsync fences[STREAM_BUFFER_REGIONS];
+
+        // Start of the persistently mapped buffer or the staging
+        // copy when persistent mapping is unavailable.
+        uint8_t* data;
+} stream_buffer;
+
+static void wait_fence(stream_buffer* sb, uint32_t region);
+static void next_region(stream_buffer* sb);
+
+stream_buffer* stream_buffer_create(GLenum target, uint32_t region_size)
+{
+        stream_buffer* sb = malloc(sizeof(*sb));
+        if (!sb) {
+                LOGERR("%s", "Failed to allocate stream buffer");
+                return NULL;
+        }
+
+        sb->target = target;
+        sb->region_size = region_size;
+        sb->region = 0;
+        sb->head = 0;
+        sb->data = NULL;
+        for (uint32_t i = 0; i < STREAM_BUFFER_REGIONS; ++i) {
+                sb->fences[i] = NULL;
+        }
+
+        sb->persistent = GLEW_VERSION_4_4 || GLEW_ARB_buffer_storage;
+
+        glGenBuffers(1, &sb->gl_id);
+        glBindBuffer(target, sb->gl_id);
+        if (sb->persistent) {
+                GLbitfield flags = GL_MAP_WRITE_BIT |
+                                   GL_MAP_PERSISTENT_BIT |
+                                   GL_MAP_COHERENT_BIT;
+                GLsizeiptr size = (GLsizeiptr)region_size * STREAM_BUFFER_REGIONS;
+                glBufferStorage(target, size, NULL, flags);
+                sb->data = glMapBufferRange(target, 0, size, flags);
+                if (!sb->data) {
+                        LOGERR("%s", "Failed to map persistent stream buffer");
+                        goto cleanup_buffer;
+                }
+        } else {
+                glBufferData(target, region_size, NULL, GL_STREAM_DRAW);
+                sb->data = malloc(region_size);
+                if (!sb->data) {
+                        LOGERR("%s", "Failed to allocate stream staging buffer");
+                        goto cleanup_buffer;
+                }
+        }
+        glBindBuffer(target, 0);
+
+        LOGDBG("Created %s stream buffer with %u byte regions",
+               sb->persistent ? "persistent" : "orphaning", region_size);
+        return sb;
+
+cleanup_buffer:
+        glBindBuffer(target, 0);
+        glDeleteBuffers(1, &sb->gl_id);
+        free(sb);
+        return NULL;
+}
+
+void stream_buffer_free(stream_buffer* sb)
+{
+        assert(sb);
+
+        for (uint32_t i = 0; i < STREAM_BUFFER_REGIONS; ++i) {
+                if (sb->fences[i]) {
+                        glDeleteSync(sb->fences[i]);
+                }
+        }
+
+        if (sb->persistent) {
+                glBindBuffer(sb->target, sb->gl_id);
+                glUnmapBuffer(sb->target);
+                glBindBuffer(sb->target, 0);
+        } else {
+                free(sb->data);
+        }
+
+        glDeleteBuffers(1, &sb->gl_id);
+        free(sb);
+}
+
+bool stream_buffer_persistent(stream_buffer* sb)
+{
+        assert(sb);
+        return sb->persistent;
+}
+
+GLuint stream_buffer_id(stream_buffer* sb)
+{
+        assert(sb);
+        return sb->gl_id;
+}
+
+uint32_t stream_buffer_max_alloc(stream_buffer* sb)
+{
+        assert(sb);
+        return sb->region_size;
+}
+
+void* stream_buffer_alloc(stream_buffer* sb, uint32_t size, uint32_t* offset)
+{
+        assert(sb);
+        assert(offset);
+
+        if (size > sb->region_size) {
+                LOGERR("Stream buffer allocation of %u bytes exceeds region size %u",
+                       size, sb->region_size);
+                return NULL;
+        }
+
+        // Orphaning and uploading both need the buffer bound.
+        if (!sb->persistent) {
+                glBindBuffer(sb->target, sb->gl_id);
+        }
+
+        uint32_t start = (sb->head + STREAM_BUFFER_ALIGN - 1) &
+                         ~(STREAM_BUFFER_ALIGN - 1);
+        if (start + size > sb->region_size) {
+                next_region(sb);
+                start = 0;
+        }
+        sb->head = start + size;
+
+        if (sb->persistent) {
+                *offset = sb->region * sb->region_size + start;
+                return sb->data + *offset;
+        }
+
+        *offset = start;
+        return sb->data + start;
+}
+
+void stream_buffer_commit(stream_buffer* sb, uint32_t offset, uint32_t size)
+{
+        assert(sb);
+
+        if (!sb->persistent) {
+                glBufferSubData(sb->target, offset, size, sb->data + offset);
+        }
+}
+
+void stream_buffer_end_frame(stream_buffer* sb)
+{
+        assert(sb);
+
+        if (!sb->persistent) {
+                glBindBuffer(sb->target, sb->gl_id);
+        }
+
+        if (sb->head > 0) {
+                next_region(sb);
+        }
+}
+
+// Blocks until the GPU has finished reading from the specified region.
+static void wait_fence(stream_buffer* sb, uint32_t region)
+{
+        GLsync fence = sb->fences[region];
+        if (!fence) {
+                return;
+        }
+
+        GLbitfield flags = 0;
+        GLuint64 timeout = 0;
+        for (;;) {
+                GLenum result = glClientWaitSync(fence, flags, timeout);
+                if (result == GL_ALREADY_SIGNALED ||
+                    result == GL_CONDITION_SATISFIED) {
+                        break;
+                }
+                if (result == GL_WAIT_FAILED) {
+                        LOGERR("Waiting on stream buffer region %u failed", region);
+                        break;
+                }
+
+                // Not done yet so flush and wait properly.
+                flags = GL_SYNC_FLUSH_COMMANDS_BIT;
+                timeout = 1000000; // 1ms
+        }
+
+        glDeleteSync(fence);
+        sb->fences[region] = NULL;
+}
+
+// Fences the current region and moves on to the next one. The buffer
+// must be bound if it isn't persistently mapped.
+static void next_region(stream_buffer* sb)
+{
+        sb->head = 0;
+
+        if (!sb->persistent) {
+                // Orphan the old storage. The driver hands back fresh
+                // memory while the GPU finishes with the old one.
+                glBufferData(sb->target, sb->region_size, NULL, GL_STREAM_DRAW);
+                return;
+        }
+
+        sb->fences[sb->region] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+        sb->region = (sb->region + 1) % STREAM_BUFFER_REGIONS;
+        wait_fence(sb, sb->region);
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+#include <inttypes.h>
+#include <stdbool.h>
+
+#include <glew/glew.h>
+
+// Number of regions in the ring. While the GPU reads from one region
+// the CPU can write into the others.
+#define STREAM_BUFFER_REGIONS 3
+
+// A stream buffer is a GL buffer object that is written to once
+// per draw and then thrown away. It is split into a ring of regions
+// that are fenced as the GPU consumes them so the CPU never writes
+// to memory that is still in use.
+// When GL_ARB_buffer_storage is available the buffer is persistently
+// mapped and data is written straight into GPU visible memory.
+// Otherwise data is written to a staging copy, uploaded with
+// glBufferSubData and the buffer is orphaned whenever it fills up.
+typedef struct stream_buffer stream_buffer;
+
+// Creates a stream buffer for the specified target where each region
+// of the ring can hold region_size bytes.
+// Returns NULL if creation fails.
+stream_buffer* stream_buffer_create(GLenum target, uint32_t region_size);
+
+// Frees the GL buffer, any outstanding fences and the stream buffer.
+// The GL context must be current on the calling thread.
+void stream_buffer_free(stream_buffer*);
+
+// Returns true if the stream buffer is persistently mapped.
+bool stream_buffer_persistent(stream_buffer*);
+
+// Returns the GL buffer object name.
+GLuint stream_buffer_id(stream_buffer*);
+
+// Returns the maximum number of bytes a single allocation can be.
+uint32_t stream_buffer_max_alloc(stream_buffer*);
+
+// Reserves size bytes in the stream buffer and returns a pointer they
+// can be written to. offset is set to the offset of the allocation
+// from the start of the GL buffer, for use with glVertexAttribPointer.
+// Moves on to the next region, waiting on its fence, when the current
+// region is full. Leaves the buffer bound to its target if it isn't
+// persistently mapped.
+// Returns NULL if size is larger than stream_buffer_max_alloc.
+void* stream_buffer_alloc(stream_buffer*, uint32_t size, uint32_t* offset);
+
+// Makes the data written to the allocation at offset visible to GL.
+// If the buffer isn't persistently mapped it must be bound to its
+// target, as stream_buffer_alloc leaves it.
+void stream_buffer_commit(stream_buffer*, uint32_t offset, uint32_t size);
+
+// Fences the data written this frame. Must be called once per frame
+// after the last draw call that reads from the stream buffer. Leaves
+// the buffer bound to its target if it isn't persistently mapped.
+void stream_buffer_end_frame(stream_buffer*);
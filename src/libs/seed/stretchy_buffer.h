@@ -65,6 +65,7 @@
 //         sb_push(TYPE *a, TYPE v)   adds v on the end of the array, a la push_back
 //         sb_add(TYPE *a, int n)     adds n uninitialized elements at end of array & returns pointer to first added
 //         sb_last(TYPE *a)           returns an lvalue of the last item in the array
+//         sb_pop(TYPE *a)            removes the last item from a non-empty array and returns it
 //         sb_reset(TYPE *a)          resets array index to 0 allowing reuse of the array 
 //                                    without new (re)allocs until the old capacity is exceeded
 //         a[n]                       access the nth (counting from 0) element of the array
@@ -172,6 +173,7 @@
 #define sb_count  stb_sb_count
 #define sb_add    stb_sb_add
 #define sb_last   stb_sb_last
+#define sb_pop    stb_sb_pop
 #define sb_reset  stb_sb_reset
 #endif
 
@@ -180,6 +182,7 @@
 #define stb_sb_count(a)        ((a) ? stb__sbn(a) : 0)
 #define stb_sb_add(a,n)        (stb__sbmaybegrow(a,n), stb__sbn(a)+=(n), &(a)[stb__sbn(a)-(n)])
 #define stb_sb_last(a)         ((a)[stb__sbn(a)-1])
+#define stb_sb_pop(a)          ((a)[--stb__sbn(a)])
 #define stb_sb_reset(a)        ((a) ? stb__sbn(a) = 0,0 : 0)
 
 #define stb__sbraw(a) ((int *) (a) - 2)
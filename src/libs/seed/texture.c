@@ -2,14 +2,41 @@
 
 #include <assert.h>
 #include <stddef.h>
+#include <stdlib.h>
 
 #include "log.h"
+#include "platform/atomic.h"
 #include "render.h"
 
 unsigned char* stbi_load(const char*, int*, int*, int*, int);
 void stbi_image_free(void *);
 
-bool texture_init(texture* t, int8_t id, const char* location)
+bool texture_init(texture* t, uint32_t id, const char* location)
+{
+        assert(t);
+
+        texture_init_async(t, id);
+        return texture_load(t, location);
+}
+
+void texture_init_async(texture* t, uint32_t id)
+{
+        assert(t);
+
+        t->id = id;
+        t->gl_id = 0;
+        t->width = 0;
+        t->height = 0;
+        t->channels = 0;
+        t->data = NULL;
+        t->uploaded = false;
+        t->page = NULL;
+        t->page_x = 0;
+        t->page_y = 0;
+        atomic_store_i32(&t->state, texture_loading);
+}
+
+bool texture_load(texture* t, const char* location)
 {
         assert(t);
 
@@ -18,23 +45,61 @@ bool texture_init(texture* t, int8_t id, const char* location)
                             &t->channels, 4);
         if (!t->data) {
                 LOGERR("Failed to load texture %s", location);
+                atomic_store_i32(&t->state, texture_failed);
                 return false;
         }
 
-        t->id = id;
-        t->uploaded = false;
+        // Publish the data before anyone sees the texture as loaded.
+        atomic_store_i32(&t->state, texture_loaded);
+        return true;
+}
 
+bool texture_load_blank(texture* t, int width, int height)
+{
+        assert(t);
+
+        // stbi_image_free is plain free so the data can be freed the
+        // same way as loaded images.
+        t->data = calloc((size_t)width * height, 4);
+        if (!t->data) {
+                LOGERR("%s", "Failed to allocate blank texture");
+                atomic_store_i32(&t->state, texture_failed);
+                return false;
+        }
+
+        t->width = width;
+        t->height = height;
+        t->channels = 4;
+        atomic_store_i32(&t->state, texture_loaded);
         return true;
 }
 
+texture_state texture_get_state(texture* t)
+{
+        assert(t);
+        return (texture_state)atomic_load_i32(&t->state);
+}
+
+texture* texture_get_page(texture* t)
+{
+        assert(t);
+        return t->page ? t->page : t;
+}
+
 void texture_reset(texture* t, renderer* r)
 {
         assert(t);
 
-        render_delete_texture(r, t);
+        if (t->uploaded) {
+                render_delete_texture(r, t);
+        }
 
-        t->id = -1;
+        t->id = UINT32_MAX;
         t->gl_id = -1;
+        t->uploaded = false;
+        t->page = NULL;
+        t->page_x = 0;
+        t->page_y = 0;
 
         t->width = 0;
         t->height = 0;
@@ -3,8 +3,17 @@
 #include <inttypes.h>
 #include <stdbool.h>
 
+typedef enum {
+        texture_loading,
+        texture_loaded,
+        texture_failed
+} texture_state;
+
+// Largest id a texture can have. The renderer sorts on 24 bits of it.
+#define TEXTURE_MAX_ID 0xffffff
+
 typedef struct texture {
-        uint8_t id;
+        uint32_t id;
         uint32_t gl_id;
 
         int width;
@@ -13,12 +22,45 @@ typedef struct texture {
         unsigned char* data;
 
         bool uploaded;
+
+        // Set when the texture has been packed into an atlas page. The
+        // texture is then drawn from the page with its tex coords offset
+        // by page_x and page_y and has no data of its own.
+        struct texture* page;
+        int32_t page_x;
+        int32_t page_y;
+
+        // A texture_state. The fields above are only valid once
+        // the texture is loaded. Use texture_get_state to read it.
+        volatile int32_t state;
 } texture;
 
 // Initializes the specified texture from the specified file
 // and assigns it the specified id.
 // Returns false if initialization failed. Errors will be logged.
-bool texture_init(texture*, int8_t id, const char* location);
+bool texture_init(texture*, uint32_t id, const char* location);
+
+// Initializes the specified texture in the loading state and assigns
+// it the specified id. The texture has no data until texture_load is
+// called, which may happen on another thread.
+void texture_init_async(texture*, uint32_t id);
+
+// Loads the image data for a texture initialized with texture_init_async
+// and marks it as loaded or failed.
+// Returns false if loading failed. Errors will be logged.
+bool texture_load(texture*, const char* location);
+
+// Gives a texture initialized with texture_init_async fully transparent
+// 4 channel data of the specified size and marks it as loaded.
+// Returns false if the data could not be allocated.
+bool texture_load_blank(texture*, int width, int height);
+
+// Returns the load state of the texture. Safe to call from any thread.
+texture_state texture_get_state(texture*);
+
+// Returns the texture that is bound to draw the texture, which is the
+// atlas page it was packed into or the texture itself if it wasn't.
+texture* texture_get_page(texture*);
 
 // Deletes the texture data and resets all fields to 0.
 // Also removes the texture data from GPU memory if it was uploaded.